@@ -0,0 +1,231 @@
+// runs the benchmark corpus against a build of main, see `make bench`
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define MAX_BENCHES 64
+#define MAX_RUNS 1000
+
+typedef struct {
+    char name[64];
+    double median_ms;
+    double p95_ms;
+    uint64_t instructions;
+    long peak_rss_kb;
+} Result;
+
+typedef struct {
+    Result data[MAX_BENCHES];
+    size_t count;
+} Results;
+
+void usage(char *file) {
+    fprintf(stderr, "usage: %s --main <path> [--runs <n>] [--warmup <n>] [--baseline <file>] [--out <file>] [--threshold <percent>] <files.cano>\n", file);
+    exit(1);
+}
+
+// runs argv with stdout discarded and stderr into err_fd when it is not -1,
+// returns the exit status and fills in the wall time and peak rss of the child
+int run(char **argv, int err_fd, double *ms, long *rss_kb) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if(pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if(pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        if(err_fd != -1) dup2(err_fd, STDERR_FILENO);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *ms = (end.tv_sec - start.tv_sec)*1e3 + (end.tv_nsec - start.tv_nsec)/1e6;
+    *rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// main --count prints the instructions it executed to stderr after the program finishes
+uint64_t count_instructions(char *main_path, char *tim_path) {
+    FILE *err = tmpfile();
+    if(err == NULL) {
+        perror("tmpfile");
+        exit(1);
+    }
+    char *argv[] = {main_path, "--count", "run", tim_path, NULL};
+    double ms;
+    long rss;
+    if(run(argv, fileno(err), &ms, &rss) != 0) {
+        fprintf(stderr, "error: %s failed\n", tim_path);
+        exit(1);
+    }
+    rewind(err);
+    char line[256];
+    uint64_t count = 0;
+    while(fgets(line, sizeof(line), err) != NULL) {
+        sscanf(line, "instructions: %" SCNu64, &count);
+    }
+    fclose(err);
+    return count;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+Result bench(char *main_path, char *file, size_t runs, size_t warmup) {
+    Result result = {0};
+    char *base = strrchr(file, '/');
+    base = base == NULL ? file : base + 1;
+    snprintf(result.name, sizeof(result.name), "%.*s", (int)strcspn(base, "."), base);
+
+    // com writes the .tim next to the source, the same way append_ext names it
+    char tim_path[1024];
+    char *ext = strrchr(base, '.');
+    int stem = ext == NULL ? (int)strlen(file) : (int)(ext - file);
+    snprintf(tim_path, sizeof(tim_path), "%.*s.tim", stem, file);
+    char *com[] = {main_path, "com", file, NULL};
+    double ms;
+    long rss;
+    if(run(com, -1, &ms, &rss) != 0) {
+        fprintf(stderr, "error: could not compile %s\n", file);
+        exit(1);
+    }
+    result.instructions = count_instructions(main_path, tim_path);
+
+    char *argv[] = {main_path, "run", tim_path, NULL};
+    double times[MAX_RUNS];
+    for(size_t i = 0; i < warmup + runs; i++) {
+        if(run(argv, -1, &ms, &rss) != 0) {
+            fprintf(stderr, "error: %s failed\n", tim_path);
+            exit(1);
+        }
+        if(i < warmup) continue;
+        times[i - warmup] = ms;
+        if(rss > result.peak_rss_kb) result.peak_rss_kb = rss;
+    }
+    unlink(tim_path);
+
+    qsort(times, runs, sizeof(*times), compare_doubles);
+    result.median_ms = runs % 2 == 1 ? times[runs/2] : (times[runs/2 - 1] + times[runs/2])/2;
+    // nearest rank
+    size_t rank = (runs*95 + 99)/100;
+    result.p95_ms = times[rank - 1];
+    return result;
+}
+
+void write_results(Results *results, char *path, size_t runs, size_t warmup) {
+    FILE *file = fopen(path, "w");
+    if(file == NULL) {
+        fprintf(stderr, "error: could not write to %s\n", path);
+        exit(1);
+    }
+    fprintf(file, "{\n  \"runs\": %zu,\n  \"warmup\": %zu,\n  \"benchmarks\": [\n", runs, warmup);
+    // one benchmark per line, read_results depends on it
+    for(size_t i = 0; i < results->count; i++) {
+        Result *result = &results->data[i];
+        fprintf(file, "    {\"name\": \"%s\", \"median_ms\": %.3f, \"p95_ms\": %.3f, \"instructions\": %" PRIu64 ", \"peak_rss_kb\": %ld}%s\n",
+                result->name, result->median_ms, result->p95_ms, result->instructions, result->peak_rss_kb,
+                i + 1 < results->count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+// reads a file written by write_results, returns false when there is none
+bool read_results(Results *results, char *path) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL) return false;
+    char line[512];
+    while(results->count < MAX_BENCHES && fgets(line, sizeof(line), file) != NULL) {
+        Result result = {0};
+        int read = sscanf(line, " {\"name\": \"%63[^\"]\", \"median_ms\": %lf, \"p95_ms\": %lf, \"instructions\": %" SCNu64 ", \"peak_rss_kb\": %ld}",
+                          result.name, &result.median_ms, &result.p95_ms, &result.instructions, &result.peak_rss_kb);
+        if(read == 5) results->data[results->count++] = result;
+    }
+    fclose(file);
+    return true;
+}
+
+double change(double now, double before) {
+    return before == 0 ? 0 : (now - before)*100.0/before;
+}
+
+int main(int argc, char **argv) {
+    char *program = argv[0];
+    char *main_path = NULL;
+    char *baseline_path = NULL;
+    char *out_path = NULL;
+    size_t runs = 10;
+    size_t warmup = 2;
+    double threshold = 5;
+    Results results = {0};
+    char *files[MAX_BENCHES];
+    size_t files_count = 0;
+    for(int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if(strcmp(argv[i], "--main") == 0 && has_value) main_path = argv[++i];
+        else if(strcmp(argv[i], "--runs") == 0 && has_value) runs = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--warmup") == 0 && has_value) warmup = strtoull(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--baseline") == 0 && has_value) baseline_path = argv[++i];
+        else if(strcmp(argv[i], "--out") == 0 && has_value) out_path = argv[++i];
+        else if(strcmp(argv[i], "--threshold") == 0 && has_value) threshold = strtod(argv[++i], NULL);
+        else if(argv[i][0] == '-') usage(program);
+        else if(files_count < MAX_BENCHES) files[files_count++] = argv[i];
+    }
+    if(main_path == NULL || files_count == 0 || runs == 0 || runs > MAX_RUNS) usage(program);
+
+    Results baseline = {0};
+    bool has_baseline = baseline_path != NULL && read_results(&baseline, baseline_path);
+
+    printf("%-16s %12s %12s %14s %10s", "benchmark", "median ms", "p95 ms", "instructions", "rss kb");
+    if(has_baseline) printf(" %9s %9s", "median", "insts");
+    printf("\n");
+    size_t slower = 0;
+    for(size_t i = 0; i < files_count; i++) {
+        Result result = bench(main_path, files[i], runs, warmup);
+        results.data[results.count++] = result;
+        printf("%-16s %12.3f %12.3f %14" PRIu64 " %10ld", result.name, result.median_ms, result.p95_ms,
+               result.instructions, result.peak_rss_kb);
+        for(size_t j = 0; has_baseline && j < baseline.count; j++) {
+            Result *before = &baseline.data[j];
+            if(strcmp(before->name, result.name) != 0) continue;
+            double time = change(result.median_ms, before->median_ms);
+            printf(" %+8.1f%% %+8.1f%%", time, change(result.instructions, before->instructions));
+            if(time > threshold) {
+                printf("  slower");
+                slower++;
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if(out_path != NULL) {
+        write_results(&results, out_path, runs, warmup);
+        printf("\nresults written to %s\n", out_path);
+    }
+    if(baseline_path != NULL && !has_baseline) printf("no baseline at %s, save one with `make bench-save`\n", baseline_path);
+    if(slower > 0) printf("%zu benchmarks more than %.1f%% slower than %s\n", slower, threshold, baseline_path);
+    return 0;
+}
@@ -32,8 +32,6 @@ char *data_typesss[DATA_COUNT] = {
     "U64",                	
 };    
 	
-bool reassigning = false;
-	
 DataType type_to_data[DATA_COUNT] = {
     INT_TYPE,
     PTR_TYPE, 
@@ -87,7 +85,7 @@ void gen_push_u(Program_State *state, uint64_t value, DataType type) {
     state->stack_s++;   
 }
 	
-void gen_native(Program_State *state, int value) {
+void gen_native(Program_State *state, uint32_t value) {
 	Inst inst = create_inst(INST_NATIVE, (Word){.as_int=value}, INT_TYPE);
 	DA_APPEND(&state->machine.instructions, inst);
 }
@@ -128,6 +126,13 @@ void gen_mul(Program_State *state) {
     state->stack_s--;   
 }
 
+// picks the typed opcode when the operand tags allow it
+void gen_bin_op(Program_State *state, Operator_Type op, int lhs, int rhs) {
+	Inst inst = create_inst(bin_inst(op, lhs, rhs), (Word){.as_int=0}, 0);
+	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s--;   
+}
+
 void gen_div(Program_State *state) {
 	Inst inst = create_inst(INST_DIV, (Word){.as_int=0}, 0);
 	DA_APPEND(&state->machine.instructions, inst);
@@ -154,11 +159,27 @@ void gen_indup(Program_State *state, size_t value) {
 }
 	
 void gen_global_indup(Program_State *state, size_t value) {
-	gen_ss(state);
-	gen_push(state, value);
-	gen_sub(state);
-	Inst inst = create_inst(INST_INDUP, (Word){.as_int=0}, 0);
+	Inst inst = create_inst(INST_LOAD_GLOBAL, (Word){.as_int=value}, INT_TYPE);
 	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s++;
+}
+	
+void gen_load_local(Program_State *state, int64_t slot) {
+	Inst inst = create_inst(INST_LOAD_LOCAL, (Word){.as_int=slot}, INT_TYPE);
+	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s++;
+}
+
+void gen_store_local(Program_State *state, int64_t slot) {
+	Inst inst = create_inst(INST_STORE_LOCAL, (Word){.as_int=slot}, INT_TYPE);
+	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s--;
+}
+
+void gen_store_global(Program_State *state, size_t value) {
+	Inst inst = create_inst(INST_STORE_GLOBAL, (Word){.as_int=value}, INT_TYPE);
+	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s--;
 }
 	
 void gen_inswap(Program_State *state, size_t value) {
@@ -171,7 +192,7 @@ void gen_inswap(Program_State *state, size_t value) {
 void gen_global_inswap(Program_State *state, size_t value) {
 	gen_ss(state);
 	gen_push(state, value);
-	gen_sub(state);
+	gen_bin_op(state, OP_MINUS, INT_TYPE, INT_TYPE);
 	Inst inst = create_inst(INST_INSWAP, (Word){.as_int=0}, 0);
 	DA_APPEND(&state->machine.instructions, inst);
 	state->stack_s--;
@@ -193,6 +214,17 @@ void gen_while_jmp(Program_State *state, size_t label) {
 	DA_APPEND(&state->machine.instructions, inst);
 }
 
+void gen_copy(Program_State *state) {
+	Inst inst = create_inst(INST_COPY, (Word){.as_int=0}, 0);
+	DA_APPEND(&state->machine.instructions, inst);
+}
+
+void gen_dealloc(Program_State *state) {
+	Inst inst = create_inst(INST_DEALLOC, (Word){.as_int=0}, 0);
+	DA_APPEND(&state->machine.instructions, inst);
+	state->stack_s--;
+}
+
 void gen_label(Program_State *state, size_t label) {
 	Inst inst = create_inst(INST_NOP, (Word){.as_int=0}, 0);
 	while(state->labels.count <= label) DA_APPEND(&state->labels, 0);
@@ -220,25 +252,39 @@ void gen_while_label(Program_State *state, size_t label) {
 	DA_APPEND(&state->machine.instructions, inst);	
 }
     
+void gen_alloc_inst(Program_State *state) {
+	Inst inst = create_inst(state->region_alloc ? INST_REGION_ALLOC : INST_ALLOC, (Word){.as_int=0}, 0);
+	DA_APPEND(&state->machine.instructions, inst);
+}
+
 void gen_alloc(Program_State *state, Expr *s, size_t type_s) {
     gen_push(state, type_s);
     gen_expr(state, s);
-    gen_mul(state);
-	Inst inst = create_inst(INST_ALLOC, (Word){.as_int=0}, 0);
-	DA_APPEND(&state->machine.instructions, inst);
+    gen_bin_op(state, OP_MULT, INT_TYPE, expr_tag(state, s));
+	gen_alloc_inst(state);
 }
 	
 void gen_alloc_s(Program_State *state, size_t s, size_t type_s) {
     gen_push(state, type_s);
     gen_push(state, s);
-    gen_mul(state);
-	Inst inst = create_inst(INST_ALLOC, (Word){.as_int=0}, 0);
-	DA_APPEND(&state->machine.instructions, inst);
+    gen_bin_op(state, OP_MULT, INT_TYPE, INT_TYPE);
+	gen_alloc_inst(state);
 }
     
 void gen_struct_alloc(Program_State *state, size_t total_s) {
     gen_push(state, total_s);
-	Inst inst = create_inst(INST_ALLOC, (Word){.as_int=0}, 0);
+	gen_alloc_inst(state);
+}
+
+// returns the stack position the mark lives at
+size_t gen_region_mark(Program_State *state) {
+	Inst inst = create_inst(INST_REGION_MARK, (Word){.as_int=0}, 0);
+	DA_APPEND(&state->machine.instructions, inst);
+	return ++state->stack_s;
+}
+
+void gen_region_reset(Program_State *state, size_t mark) {
+	Inst inst = create_inst(INST_REGION_RESET, (Word){.as_int=(int64_t)mark - frame_base(state) - 1}, 0);
 	DA_APPEND(&state->machine.instructions, inst);
 }
 
@@ -248,10 +294,13 @@ void gen_dup(Program_State *state) {
     state->stack_s++;
 }
 
+void gen_swap(Program_State *state) {
+	Inst inst = create_inst(INST_SWAP, (Word){.as_int=0}, 0);
+	DA_APPEND(&state->machine.instructions, inst);
+}
+
 void gen_offset(Program_State *state, size_t offset) {
-    gen_push(state, offset);
-    gen_add(state);
-	Inst inst = create_inst(INST_TOVP, (Word){.as_int=0}, 0);
+	Inst inst = create_inst(INST_PTR_ADD_IMM, (Word){.as_int=offset}, INT_TYPE);
 	DA_APPEND(&state->machine.instructions, inst);
 }
 
@@ -267,24 +316,26 @@ void gen_read(Program_State *state) {
     state->stack_s -= 2;
 }
     
-void gen_arr_offset(Program_State *state, size_t var_index, Expr *arr_index, Type_Type type) {
-    gen_indup(state, state->stack_s-var_index);    
+void gen_arr_offset(Program_State *state, Variable var, Expr *arr_index, Type_Type type) {
+    gen_load_var(state, var);
+    gen_expr(state, arr_index);
+	Inst inst = create_inst(INST_INDEX_ADDR, (Word){.as_int=data_type_s[type]}, INT_TYPE);
+	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s--;
+}
+
+void gen_indexed_load(Program_State *state, Variable var, Expr *arr_index, Type_Type type) {
+    gen_load_var(state, var);
     gen_expr(state, arr_index);
-    gen_push(state, data_type_s[type]);            
-    gen_mul(state);
-    gen_add(state);
-	Inst inst = create_inst(INST_TOVP, (Word){.as_int=0}, 0);
+	Inst inst = create_inst(INST_INDEXED_LOAD, (Word){.as_int=data_type_s[type]}, INT_TYPE);
+	inst.register_index = type_to_data[type];
 	DA_APPEND(&state->machine.instructions, inst);
+    state->stack_s--;
 }
 
 void gen_struct_offset(Program_State *state, Type_Type type, size_t offset) {
     gen_dup(state);
-    gen_push(state, offset);
-    gen_push(state, data_type_s[type]);            
-    gen_mul(state);
-    gen_add(state);
-	Inst inst = create_inst(INST_TOVP, (Word){.as_int=0}, 0);
-	DA_APPEND(&state->machine.instructions, inst);
+    gen_offset(state, offset*data_type_s[type]);
 }
     
 void gen_struct_value(Program_State *state, size_t field_pos, Node *field, Node *value) {
@@ -301,10 +352,7 @@ void gen_struct_value(Program_State *state, size_t field_pos, Node *field, Node
 
 void gen_structure_field(Program_State *state, size_t offset, Expr *expr) {
 	gen_dup(state);
-	gen_push(state, offset);
-	gen_add(state);
-	Inst inst = create_inst(INST_TOVP, (Word){.as_int=0}, 0);
-	DA_APPEND(&state->machine.instructions, inst);
+	gen_offset(state, offset);
 	gen_expr(state, expr);
 	gen_push(state, data_type_s[expr->data_type]);
 	gen_write(state);
@@ -331,6 +379,9 @@ char *append_ext(char *filename, char *ext) {
 char *op_types[] = {"add", "sub", "mul", "div", "mod", "cmpe", "cmpne", "cmpge", "cmple", "cmpg", "cmpl", "and", "or"};
 Inst_Set op_types_inst[] = {INST_ADD, INST_SUB, INST_MUL, INST_DIV, INST_MOD, INST_CMPE, 
 						 INST_CMPNE, INST_CMPGE, INST_CMPLE, INST_CMPG, INST_CMPL, INST_AND, INST_OR};
+// first opcode of each typed family, the families are laid out in the order i64 u8 u16 u32 u64 f32 f64
+Inst_Set op_types_typed[] = {INST_ADD_I64, INST_SUB_I64, INST_MUL_I64, INST_DIV_I64, INST_COUNT, INST_CMPE_I64,
+						 INST_CMPNE_I64, INST_CMPGE_I64, INST_CMPLE_I64, INST_CMPG_I64, INST_CMPL_I64, INST_COUNT, INST_COUNT};
 
 Function *get_func(Functions functions, String_View name) {
     for(size_t i = 0; i < functions.count; i++) {
@@ -391,6 +442,35 @@ Variable get_variable(Program_State *state, String_View name) {
 Type_Type get_variable_type(Program_State *state, String_View name) {
 	return get_variable(state, name).type;
 }
+
+// call points the frame pointer just past the args, so args get negative slots and locals
+// count up from 0. at the top level the frame pointer is the bottom of the stack
+size_t frame_base(Program_State *state) {
+	if(state->frame_stack.count == 0) return 0;
+	return state->frame_stack.data[state->frame_stack.count-1];
+}
+
+bool in_frame(Program_State *state, Variable var) {
+	if(state->frame_stack.count == 0) return true;
+	return var.stack_pos > state->ret_stack.data[state->ret_stack.count-1];
+}
+
+void gen_load_var(Program_State *state, Variable var) {
+	if(var.global) gen_global_indup(state, var.stack_pos);
+	else if(in_frame(state, var)) gen_load_local(state, (int64_t)var.stack_pos - frame_base(state) - 1);
+	else gen_indup(state, state->stack_s-var.stack_pos);
+}
+
+void gen_store_var(Program_State *state, Variable var) {
+	if(var.global) {
+		gen_store_global(state, var.stack_pos);
+	} else if(in_frame(state, var)) {
+		gen_store_local(state, (int64_t)var.stack_pos - frame_base(state) - 1);
+	} else {
+		gen_inswap(state, state->stack_s-var.stack_pos);
+		gen_pop(state);
+	}
+}
 	
 Ext_Funcs gen_ext_func_wrapper(Ext_Funcs funcs, Location loc) {
 	char *output_name = malloc(sizeof(char)*256);
@@ -437,18 +517,18 @@ Ext_Funcs gen_ext_func_wrapper(Ext_Funcs funcs, Location loc) {
 
 void gen_builtin(Program_State *state, Expr *expr) {
     ASSERT(expr->type == EXPR_BUILTIN, "type is incorrect");
-    for(size_t i = 0; i < expr->value.builtin.value.count; i++) {
-         gen_expr(state, expr->value.builtin.value.data[i]);
+    // spawn evaluates the arguments of its call itself
+    for(size_t i = 0; expr->value.builtin.type != BUILTIN_SPAWN && i < expr->value.builtin.value.count; i++) {
+         Builtin_Type type = expr->value.builtin.type;
+         if(type == BUILTIN_COPY || (type == BUILTIN_GET && i == 0)) gen_borrowed(state, expr->value.builtin.value.data[i]);
+         else gen_expr(state, expr->value.builtin.value.data[i]);
     }
     switch(expr->value.builtin.type) {
         case BUILTIN_ALLOC: {
-			Inst inst = create_inst(INST_ALLOC, (Word){.as_int=0}, 0);
-			DA_APPEND(&state->machine.instructions, inst);
+			gen_alloc_inst(state);
         } break;
         case BUILTIN_DEALLOC: {
-			Inst inst = create_inst(INST_DEALLOC, (Word){.as_int=0}, 0);
-			DA_APPEND(&state->machine.instructions, inst);
-            state->stack_s--;
+			gen_dealloc(state);
         } break;
         case BUILTIN_TOVP: {
 			Inst inst = create_inst(INST_TOVP, (Word){.as_int=0}, 0);
@@ -482,8 +562,7 @@ void gen_builtin(Program_State *state, Expr *expr) {
 				View_Arg(expr->value.builtin.ext_funcs.file_name));
 				
 			if(system(command) != 0) {
-				printf("Command failed!\n");
-				exit(1);
+				tim_fail("Command failed!\n");
 			}
 			//gen_push_str(state, (String_View){"\0", 1});											
 			for(size_t i = 0; i < new_funcs.count; i++) {
@@ -513,6 +592,79 @@ void gen_builtin(Program_State *state, Expr *expr) {
 			DA_APPEND(&state->machine.instructions, inst);
             //state->stack_s -= 2;
         } break;
+        case BUILTIN_COPY: {
+            if(expr->value.builtin.value.count != 1) {
+                PRINT_ERROR(expr->loc, "incorrect arg amounts for copy");
+            }
+            gen_copy(state);
+        } break;
+        case BUILTIN_ARENA: {
+            if(expr->value.builtin.value.count != 1) {
+                PRINT_ERROR(expr->loc, "incorrect arg amounts for arena");
+            }
+			Inst inst = create_inst(INST_ARENA_NEW, (Word){.as_int=0}, 0);
+			DA_APPEND(&state->machine.instructions, inst);
+        } break;
+        case BUILTIN_ARENA_ALLOC: {
+            if(expr->value.builtin.value.count != 2) {
+                PRINT_ERROR(expr->loc, "incorrect arg amounts for arena_alloc");
+            }
+			Inst inst = create_inst(INST_ARENA_ALLOC, (Word){.as_int=0}, 0);
+			DA_APPEND(&state->machine.instructions, inst);
+            state->stack_s--;
+        } break;
+        case BUILTIN_ARENA_RESET:
+        case BUILTIN_ARENA_FREE: {
+            if(expr->value.builtin.value.count != 1) {
+                PRINT_ERROR(expr->loc, "incorrect arg amounts for arena_reset or arena_free");
+            }
+            Inst_Set type = expr->value.builtin.type == BUILTIN_ARENA_RESET ? INST_ARENA_RESET : INST_ARENA_FREE;
+			Inst inst = create_inst(type, (Word){.as_int=0}, 0);
+			DA_APPEND(&state->machine.instructions, inst);
+            state->stack_s--;
+        } break;
+        // arguments an embedder set with tim_context_set_ptr or tim_context_set_int
+        case BUILTIN_ARG:
+        case BUILTIN_ARG_INT: {
+            if(expr->value.builtin.value.count != 1) {
+                PRINT_ERROR(expr->loc, "incorrect arg amounts for arg or arg_int");
+            }
+			Inst inst = create_inst(INST_ARG, (Word){.as_int=0}, 0);
+			DA_APPEND(&state->machine.instructions, inst);
+        } break;
+        // the call is not made here, its arguments are handed to a new coroutine that runs it
+        case BUILTIN_SPAWN: {
+            Expr *call = expr->value.builtin.value.count == 1 ? expr->value.builtin.value.data[0] : NULL;
+            if(call == NULL || call->type != EXPR_FUNCALL) {
+                PRINT_ERROR(expr->loc, "spawn expects a function call");
+            }
+            Function *function = get_func(state->program.functions, call->value.func_call.name);
+            if(!function) {
+                PRINT_ERROR(call->loc, "function `"View_Print"` referenced before assignment\n", View_Arg(call->value.func_call.name));
+            }
+            if(function->args.count != call->value.func_call.args.count) {
+                PRINT_ERROR(call->loc, "args count do not match for function `"View_Print"`\n", View_Arg(function->name));
+            }
+            gen_call_args(state, function, call->value.func_call.args);
+            gen_push(state, call->value.func_call.args.count);
+            size_t loc = get_func_loc(state->program.functions, call->value.func_call.name);
+			Inst inst = create_inst(INST_SPAWN, (Word){.as_int=loc}, INT_TYPE);
+			DA_APPEND(&state->machine.instructions, inst);
+            state->stack_s -= call->value.func_call.args.count;
+        } break;
+        case BUILTIN_YIELD: {
+			Inst inst = create_inst(INST_YIELD, (Word){.as_int=0}, 0);
+			DA_APPEND(&state->machine.instructions, inst);
+        } break;
+        case BUILTIN_RESUME:
+        case BUILTIN_JOIN: {
+            if(expr->value.builtin.value.count != 1) {
+                PRINT_ERROR(expr->loc, "incorrect arg amounts for resume or join");
+            }
+            Inst_Set type = expr->value.builtin.type == BUILTIN_RESUME ? INST_RESUME : INST_JOIN;
+			Inst inst = create_inst(type, (Word){.as_int=0}, 0);
+			DA_APPEND(&state->machine.instructions, inst);
+        } break;
     }
 }
 
@@ -532,16 +684,516 @@ void gen_field_offset(Program_State *state, Struct structure, String_View var) {
 void gen_struct_field_offset(Program_State *state, String_View struct_name, String_View var) {
     Variable struct_var = get_variable(state, struct_name);
     Struct structure = get_struct(state->structs, struct_var.struct_name).value.structs;
-    gen_indup(state, state->stack_s-struct_var.stack_pos);	
+    gen_load_var(state, struct_var);
 	gen_field_offset(state, structure, var);
 }
     
+// the generic arithmetic ops switch on the runtime tag of their operands. infer_tags
+// works out those tags ahead of time so gen_expr can emit the typed opcodes instead.
+// variables are keyed by name only, shadowed names get merged which is conservative:
+// a conflict just means the generic opcode is kept
+
+int *get_tag(Value_Tags *tags, String_View name) {
+	for(size_t i = 0; i < tags->count; i++) {
+		if(view_cmp(tags->data[i].name, name)) return &tags->data[i].tag;
+	}
+	Value_Tag tag = {.name = name, .tag = TAG_NONE};
+	DA_APPEND(tags, tag);
+	return &tags->data[tags->count-1].tag;
+}
+	
+int find_tag(Value_Tags tags, String_View name) {
+	for(size_t i = 0; i < tags.count; i++) {
+		if(view_cmp(tags.data[i].name, name)) return tags.data[i].tag;
+	}
+	return TAG_NONE;
+}
+	
+// returns true if dst changed, once strict is set a store we know nothing about poisons dst
+bool merge_tag(int *dst, int tag, bool strict) {
+	if(tag == TAG_NONE) {
+		if(!strict) return false;
+		tag = TAG_UNKNOWN;
+	}
+	if(*dst == tag || *dst == TAG_UNKNOWN) return false;
+	*dst = (*dst == TAG_NONE) ? tag : TAG_UNKNOWN;
+	return true;
+}
+
+// the result tag of the generic ops only depends on the lhs, see BIN_OP in tim.h
+int bin_result_tag(Operator_Type op, int lhs) {
+	if(op == OP_MOD || op == OP_AND || op == OP_OR) return INT_TYPE;
+	switch(lhs) {
+		case PTR_TYPE:
+		case U64_TYPE:
+			return U64_TYPE;
+		case CHAR_TYPE:
+		case U8_TYPE:
+			return U8_TYPE;
+		case INT_TYPE:
+		case U16_TYPE:
+		case U32_TYPE:
+		case FLOAT_TYPE:
+		case DOUBLE_TYPE:
+			return lhs;
+		case TAG_NONE:
+			return TAG_NONE;
+		default:
+			return TAG_UNKNOWN;
+	}
+}
+	
+int expr_tag(Program_State *state, Expr *expr) {
+	switch(expr->type) {
+		case EXPR_BIN:
+			return bin_result_tag(expr->value.bin.op.type, expr_tag(state, expr->value.bin.lhs));
+		case EXPR_INT:
+			return type_to_data[expr->data_type];
+		case EXPR_FLOAT:
+			return FLOAT_TYPE;
+		case EXPR_STR:
+		case EXPR_STRUCT:
+			return PTR_TYPE;
+		case EXPR_CHAR:
+			return CHAR_TYPE;
+		case EXPR_VAR:
+			return find_tag(state->var_tags, expr->value.variable);
+		case EXPR_FUNCALL:
+			return find_tag(state->ret_tags, expr->value.func_call.name);
+		case EXPR_ARR:
+		case EXPR_FIELD_ARR:
+			return find_tag(state->elem_tags, expr->value.array.name);
+		case EXPR_BUILTIN:
+			if(expr->value.builtin.type == BUILTIN_ALLOC || expr->value.builtin.type == BUILTIN_TOVP ||
+			   expr->value.builtin.type == BUILTIN_COPY || expr->value.builtin.type == BUILTIN_ARENA_ALLOC) return PTR_TYPE;
+			if(expr->value.builtin.type == BUILTIN_ARENA || expr->value.builtin.type == BUILTIN_ARG_INT ||
+			   expr->value.builtin.type == BUILTIN_SPAWN || expr->value.builtin.type == BUILTIN_RESUME) return INT_TYPE;
+			return TAG_UNKNOWN;
+		default:
+			return TAG_UNKNOWN;
+	}
+}
+
+// which typed family the generic op would end up computing in, -1 if it has to stay generic
+int typed_family(Operator_Type op, int lhs, int rhs) {
+	if(op == OP_MOD || op == OP_AND || op == OP_OR) return -1;
+	bool rhs_wide = rhs == INT_TYPE || rhs == U64_TYPE || rhs == PTR_TYPE;
+	switch(lhs) {
+		case INT_TYPE:
+			return rhs_wide ? 0 : -1;
+		case U64_TYPE:
+		case PTR_TYPE:
+			return rhs_wide ? 4 : -1;
+		case U8_TYPE:
+			return rhs == U8_TYPE ? 1 : -1;
+		case U16_TYPE:
+			return rhs == U16_TYPE ? 2 : -1;
+		case U32_TYPE:
+			return rhs == U32_TYPE ? 3 : -1;
+		case FLOAT_TYPE:
+			return rhs == FLOAT_TYPE ? 5 : -1;
+		case DOUBLE_TYPE:
+			return rhs == DOUBLE_TYPE ? 6 : -1;
+		case CHAR_TYPE:
+			// chars are sign extended by the generic ops, so only the ops where that cannot matter
+			if(rhs != CHAR_TYPE) return -1;
+			if(op == OP_PLUS || op == OP_MINUS || op == OP_MULT || op == OP_EQ || op == OP_NOT_EQ) return 1;
+			return -1;
+		default:
+			return -1;
+	}
+}
+
+Inst_Set bin_inst(Operator_Type op, int lhs, int rhs) {
+	int family = typed_family(op, lhs, rhs);
+	if(family < 0) return op_types_inst[op];
+	return op_types_typed[op] + family;
+}
+
+void infer_expr_tags(Program_State *state, Expr *expr, bool strict, bool *changed) {
+	switch(expr->type) {
+		case EXPR_BIN:
+			infer_expr_tags(state, expr->value.bin.lhs, strict, changed);
+			infer_expr_tags(state, expr->value.bin.rhs, strict, changed);
+			break;
+		case EXPR_FUNCALL: {
+			Function *function = get_func(state->program.functions, expr->value.func_call.name);
+			for(size_t i = 0; i < expr->value.func_call.args.count; i++) {
+				Expr *arg = expr->value.func_call.args.data[i];
+				infer_expr_tags(state, arg, strict, changed);
+				if(function == NULL || i >= function->args.count) continue;
+				int *tag = get_tag(&state->var_tags, function->args.data[i].value.var.name);
+				*changed |= merge_tag(tag, expr_tag(state, arg), strict);
+			}
+		} break;
+		case EXPR_ARR:
+		case EXPR_FIELD_ARR:
+			infer_expr_tags(state, expr->value.array.index, strict, changed);
+			break;
+		case EXPR_STRUCT:
+			for(size_t i = 0; i < expr->value.structure.values.count; i++) {
+				infer_expr_tags(state, expr->value.structure.values.data[i], strict, changed);
+			}
+			break;
+		case EXPR_BUILTIN:
+			for(size_t i = 0; i < expr->value.builtin.value.count; i++) {
+				infer_expr_tags(state, expr->value.builtin.value.data[i], strict, changed);
+			}
+			break;
+		case EXPR_EXT:
+			for(size_t i = 0; i < expr->value.ext.args.count; i++) {
+				infer_expr_tags(state, expr->value.ext.args.data[i], strict, changed);
+			}
+			break;
+		default:
+			break;
+	}
+}
+	
+void infer_exprs_tags(Program_State *state, Exprs exprs, bool strict, bool *changed) {
+	for(size_t i = 0; i < exprs.count; i++) {
+		infer_expr_tags(state, exprs.data[i], strict, changed);
+	}
+}
+
+void infer_var_tags(Program_State *state, Variable var, bool strict, bool *changed) {
+	*changed |= merge_tag(get_tag(&state->elem_tags, var.name), type_to_data[var.type], true);
+	if(var.is_array && var.type != TYPE_STR) {
+		*changed |= merge_tag(get_tag(&state->var_tags, var.name), PTR_TYPE, strict);
+	} else if(var.value.count > 0) {
+		*changed |= merge_tag(get_tag(&state->var_tags, var.name), expr_tag(state, var.value.data[0]), strict);
+	}
+}
+	
+bool infer_nodes_tags(Program_State *state, Nodes nodes, bool strict) {
+	bool changed = false;
+	String_View function = {0};
+	for(size_t i = 0; i < nodes.count; i++) {
+		Node *node = &nodes.data[i];
+		switch(node->type) {
+			case TYPE_NATIVE:
+				for(size_t j = 0; j < node->value.native.args.count; j++) {
+					Arg arg = node->value.native.args.data[j];
+					if(arg.type == ARG_EXPR) infer_expr_tags(state, arg.value.expr, strict, &changed);
+				}
+				break;
+			case TYPE_VAR_DEC:
+				infer_exprs_tags(state, node->value.var.value, strict, &changed);
+				if(node->value.var.array_s) infer_expr_tags(state, node->value.var.array_s, strict, &changed);
+				infer_var_tags(state, node->value.var, strict, &changed);
+				break;
+			case TYPE_VAR_REASSIGN:
+				infer_exprs_tags(state, node->value.var.value, strict, &changed);
+				changed |= merge_tag(get_tag(&state->var_tags, node->value.var.name),
+									 expr_tag(state, node->value.var.value.data[0]), strict);
+				break;
+			case TYPE_FIELD_REASSIGN:
+				infer_exprs_tags(state, node->value.field.value, strict, &changed);
+				break;
+			case TYPE_ARR_INDEX:
+				infer_expr_tags(state, node->value.array.index, strict, &changed);
+				infer_exprs_tags(state, node->value.array.value, strict, &changed);
+				break;
+			case TYPE_FUNC_DEC:
+				function = node->value.func_dec.name;
+				for(size_t j = 0; j < node->value.func_dec.args.count; j++) {
+					Variable arg = node->value.func_dec.args.data[j].value.var;
+					changed |= merge_tag(get_tag(&state->elem_tags, arg.name), type_to_data[arg.type], true);
+				}
+				break;
+			case TYPE_FUNC_CALL: {
+				Expr call = {.type = EXPR_FUNCALL, .value.func_call = node->value.func_call};
+				infer_expr_tags(state, &call, strict, &changed);
+			} break;
+			case TYPE_RET:
+				infer_expr_tags(state, node->value.expr, strict, &changed);
+				changed |= merge_tag(get_tag(&state->ret_tags, function), expr_tag(state, node->value.expr), strict);
+				break;
+			case TYPE_IF:
+			case TYPE_WHILE:
+				infer_expr_tags(state, node->value.conditional, strict, &changed);
+				break;
+			case TYPE_EXPR_STMT:
+				infer_expr_tags(state, node->value.expr_stmt, strict, &changed);
+				break;
+			default:
+				break;
+		}
+	}
+	return changed;
+}
+
+void infer_tags(Program_State *state, Program *program) {
+	// optimistic first: tags only grow from none to a type to unknown, so this terminates.
+	// the strict rounds then turn anything that still depends on an unresolved tag into unknown
+	bool strict = false;
+	for(;;) {
+		bool changed = infer_nodes_tags(state, program->vars, strict);
+		changed |= infer_nodes_tags(state, program->nodes, strict);
+		if(changed) continue;
+		if(strict) break;
+		strict = true;
+	}
+}
+	
+// escape analysis: arrays, structs and `alloc n` with a constant size that are declared in
+// a function and never leave it are bumped out of the frame region instead of the heap.
+// a variable escapes when its value is used as anything but the base of an index or field,
+// the address of get or store, the argument of copy or write, or an argument for a
+// parameter that does not escape itself. like the tags, names are only keyed by function
+
+#define MAX_REGION_OBJECT 4096
+
+bool var_in(Escapes *set, String_View function, String_View name) {
+	for(size_t i = 0; i < set->count; i++) {
+		Escape escape = set->data[i];
+		if(view_cmp(escape.function, function) && view_cmp(escape.name, name)) return true;
+	}
+	return false;
+}
+
+void mark_var(Escapes *set, String_View function, String_View name, bool *changed) {
+	if(var_in(set, function, name)) return;
+	Escape escape = {.function = function, .name = name};
+	DA_APPEND(set, escape);
+	*changed = true;
+}
+
+// the function a name used in function is keyed by, none for a global
+String_View var_scope(Program_State *state, String_View function, String_View name) {
+	if(function.data == NULL || var_in(&state->locals, function, name)) return function;
+	return (String_View){0};
+}
+
+bool var_escapes(Program_State *state, String_View function, String_View name) {
+	return var_in(&state->escapes, var_scope(state, function, name), name);
+}
+
+void mark_escape(Program_State *state, String_View function, String_View name, bool *changed) {
+	mark_var(&state->escapes, var_scope(state, function, name), name, changed);
+}
+
+// a str variable only needs its own copy of a literal when something writes through it: an
+// index, the address of store, or an argument for a parameter that is written through. the
+// writes through an alias are not followed, so a variable that escapes gets a copy as well.
+// one that is only ever assigned literals and never escapes owns the copy it holds
+void mark_written(Program_State *state, String_View function, Expr *expr, bool *changed) {
+	if(expr->type != EXPR_VAR) return;
+	mark_var(&state->writes, var_scope(state, function, expr->value.variable), expr->value.variable, changed);
+}
+
+bool var_owns_copy(Program_State *state, String_View function, String_View name) {
+	return !var_escapes(state, function, name) && !var_in(&state->shared, var_scope(state, function, name), name);
+}
+
+// an escaping variable can be aliased or stored somewhere that is written through later
+bool var_may_be_written(Program_State *state, String_View function, String_View name) {
+	return var_in(&state->writes, var_scope(state, function, name), name) || var_escapes(state, function, name);
+}
+
+void escape_expr(Program_State *state, String_View function, Expr *expr, bool *changed);
+
+// a bare variable here is only read through
+void escape_borrow(Program_State *state, String_View function, Expr *expr, bool *changed) {
+	if(expr->type == EXPR_VAR) return;
+	escape_expr(state, function, expr, changed);
+}
+
+void escape_call(Program_State *state, String_View function, String_View name, Exprs args, bool *changed) {
+	Function *callee = get_func(state->program.functions, name);
+	for(size_t i = 0; i < args.count; i++) {
+		if(callee != NULL && i < callee->args.count &&
+		   !var_escapes(state, callee->name, callee->args.data[i].value.var.name)) {
+			escape_borrow(state, function, args.data[i], changed);
+		} else {
+			escape_expr(state, function, args.data[i], changed);
+		}
+		if(callee != NULL && i < callee->args.count && var_in(&state->writes, callee->name, callee->args.data[i].value.var.name)) {
+			mark_written(state, function, args.data[i], changed);
+		}
+	}
+}
+
+void escape_exprs(Program_State *state, String_View function, Exprs exprs, bool *changed) {
+	for(size_t i = 0; i < exprs.count; i++) {
+		escape_expr(state, function, exprs.data[i], changed);
+	}
+}
+
+void escape_expr(Program_State *state, String_View function, Expr *expr, bool *changed) {
+	switch(expr->type) {
+		case EXPR_VAR:
+			mark_escape(state, function, expr->value.variable, changed);
+			break;
+		case EXPR_BIN:
+			escape_expr(state, function, expr->value.bin.lhs, changed);
+			escape_expr(state, function, expr->value.bin.rhs, changed);
+			break;
+		case EXPR_FUNCALL:
+			escape_call(state, function, expr->value.func_call.name, expr->value.func_call.args, changed);
+			break;
+		case EXPR_ARR:
+		case EXPR_FIELD_ARR:
+			escape_expr(state, function, expr->value.array.index, changed);
+			break;
+		case EXPR_STRUCT:
+			escape_exprs(state, function, expr->value.structure.values, changed);
+			break;
+		case EXPR_BUILTIN: {
+			Builtin builtin = expr->value.builtin;
+			// a spawned call can outlive the frame spawning it, so nothing it gets is borrowed
+			if(builtin.type == BUILTIN_SPAWN && builtin.value.count == 1 && builtin.value.data[0]->type == EXPR_FUNCALL) {
+				escape_exprs(state, function, builtin.value.data[0]->value.func_call.args, changed);
+				break;
+			}
+			for(size_t i = 0; i < builtin.value.count; i++) {
+				bool address = i == 0 && (builtin.type == BUILTIN_GET || builtin.type == BUILTIN_STORE);
+				if(address && builtin.type == BUILTIN_STORE) mark_written(state, function, builtin.value.data[i], changed);
+				if(address || builtin.type == BUILTIN_COPY) escape_borrow(state, function, builtin.value.data[i], changed);
+				else escape_expr(state, function, builtin.value.data[i], changed);
+			}
+		} break;
+		case EXPR_EXT:
+			escape_exprs(state, function, expr->value.ext.args, changed);
+			break;
+		default:
+			break;
+	}
+}
+
+bool escape_nodes(Program_State *state, Nodes nodes) {
+	bool changed = false;
+	String_View function = {0};
+	size_t depth = 0;
+	for(size_t i = 0; i < nodes.count; i++) {
+		Node *node = &nodes.data[i];
+		switch(node->type) {
+			case TYPE_FUNC_DEC:
+				function = node->value.func_dec.name;
+				depth = 1;
+				for(size_t j = 0; j < node->value.func_dec.args.count; j++) {
+					mark_var(&state->shared, function, node->value.func_dec.args.data[j].value.var.name, &changed);
+				}
+				break;
+			case TYPE_IF:
+			case TYPE_WHILE:
+				depth++;
+				escape_expr(state, function, node->value.conditional, &changed);
+				break;
+			case TYPE_END:
+				if(depth > 0 && --depth == 0) function = (String_View){0};
+				break;
+			case TYPE_NATIVE:
+				for(size_t j = 0; j < node->value.native.args.count; j++) {
+					Arg arg = node->value.native.args.data[j];
+					if(arg.type == ARG_EXPR) escape_borrow(state, function, arg.value.expr, &changed);
+				}
+				break;
+			case TYPE_VAR_DEC:
+			case TYPE_VAR_REASSIGN:
+				escape_exprs(state, function, node->value.var.value, &changed);
+				if(node->value.var.array_s) escape_expr(state, function, node->value.var.array_s, &changed);
+				if(node->value.var.value.count == 0 || node->value.var.value.data[0]->type != EXPR_STR) {
+					mark_var(&state->shared, var_scope(state, function, node->value.var.name), node->value.var.name, &changed);
+				}
+				break;
+			case TYPE_FIELD_REASSIGN:
+				escape_exprs(state, function, node->value.field.value, &changed);
+				break;
+			case TYPE_ARR_INDEX:
+				mark_var(&state->writes, var_scope(state, function, node->value.array.name), node->value.array.name, &changed);
+				escape_expr(state, function, node->value.array.index, &changed);
+				escape_exprs(state, function, node->value.array.value, &changed);
+				break;
+			case TYPE_FUNC_CALL:
+				escape_call(state, function, node->value.func_call.name, node->value.func_call.args, &changed);
+				break;
+			case TYPE_RET:
+				escape_expr(state, function, node->value.expr, &changed);
+				break;
+			case TYPE_EXPR_STMT:
+				escape_expr(state, function, node->value.expr_stmt, &changed);
+				break;
+			default:
+				break;
+		}
+	}
+	return changed;
+}
+
+void escape_analysis(Program_State *state, Program *program) {
+	// what each function declares itself, see var_scope
+	bool changed = false;
+	for(size_t i = 0; i < program->nodes.count; i++) {
+		Node *node = &program->nodes.data[i];
+		if(node->type == TYPE_FUNC_DEC) {
+			for(size_t j = 0; j < node->value.func_dec.args.count; j++) {
+				mark_var(&state->locals, node->value.func_dec.name, node->value.func_dec.args.data[j].value.var.name, &changed);
+			}
+		} else if(node->type == TYPE_VAR_DEC && node->value.var.function.data != NULL) {
+			mark_var(&state->locals, node->value.var.function, node->value.var.name, &changed);
+		}
+	}
+	// parameters start out as not escaping, a call only makes its arguments escape once
+	// the callee's parameter does, so this runs until nothing new escapes
+	while(escape_nodes(state, program->vars) | escape_nodes(state, program->nodes));
+}
+
+// size of the aggregate a declaration allocates, 0 if it is not a constant
+size_t region_size(Variable var) {
+	if(var.is_array && var.type != TYPE_STR) {
+		if(var.array_s == NULL || var.array_s->type != EXPR_INT || var.array_s->value.integer <= 0) return 0;
+		return var.array_s->value.integer*data_type_s[var.type];
+	}
+	if(var.value.count == 0) return 0;
+	Expr *value = var.value.data[0];
+	if(var.is_struct && value->type == EXPR_STRUCT) return 1;
+	if(value->type == EXPR_BUILTIN && value->value.builtin.type == BUILTIN_ALLOC) {
+		Exprs args = value->value.builtin.value;
+		if(args.count != 1 || args.data[0]->type != EXPR_INT || args.data[0]->value.integer <= 0) return 0;
+		return args.data[0]->value.integer;
+	}
+	return 0;
+}
+
+bool region_var(Program_State *state, Variable var) {
+	if(state->frame_stack.count == 0) return false;
+	size_t size = region_size(var);
+	if(size == 0 || size > MAX_REGION_OBJECT) return false;
+	String_View function = state->functions.data[state->functions.count-1].name;
+	return !var_escapes(state, function, var.name);
+}
+
+// whether the block that starts at nodes[start] declares anything region_var accepts
+bool block_has_region(Program_State *state, Nodes nodes, size_t start) {
+	size_t depth = 1;
+	for(size_t i = start; i < nodes.count && depth > 0; i++) {
+		Node *node = &nodes.data[i];
+		if(node->type == TYPE_IF || node->type == TYPE_WHILE) depth++;
+		if(node->type == TYPE_END) depth--;
+		if(node->type == TYPE_VAR_DEC && region_var(state, node->value.var)) return true;
+	}
+	return false;
+}
+	
+// instructions emitted from here on are attributed to loc, returns the location it replaces
+Location gen_loc(Program_State *state, Location loc) {
+	Location prev = state->loc;
+	if(loc.filename == NULL) return prev;
+	state->loc = loc;
+	line_table_add(&state->machine.lines, state->machine.instructions.count, view_create(loc.filename, strlen(loc.filename)), loc.row);
+	return prev;
+}
+
 void gen_expr(Program_State *state, Expr *expr) {
+	Location prev = gen_loc(state, expr->loc);
     switch(expr->type) {
         case EXPR_BIN:
-            gen_expr(state, expr->value.bin.lhs);
-            gen_expr(state, expr->value.bin.rhs);
-			Inst inst = create_inst(op_types_inst[expr->value.bin.op.type], (Word){.as_int=0}, 0);
+            gen_borrowed(state, expr->value.bin.lhs);
+            gen_borrowed(state, expr->value.bin.rhs);
+			Inst_Set type = bin_inst(expr->value.bin.op.type, expr_tag(state, expr->value.bin.lhs),
+									 expr_tag(state, expr->value.bin.rhs));
+			Inst inst = create_inst(type, (Word){.as_int=0}, 0);
 			DA_APPEND(&state->machine.instructions, inst);
             state->stack_s--;
             break;
@@ -565,6 +1217,7 @@ void gen_expr(Program_State *state, Expr *expr) {
             break;
         case EXPR_STR:
             gen_push_str(state, expr->value.string);
+            gen_copy(state);
             break;
         case EXPR_CHAR:
             gen_push_char(state, expr->value.string);
@@ -574,8 +1227,7 @@ void gen_expr(Program_State *state, Expr *expr) {
             if(index == -1) {
                 PRINT_ERROR(expr->loc, "variable `"View_Print"` referenced before assignment", View_Arg(expr->value.variable));
             }
-			if(get_variable(state, expr->value.variable).global) gen_global_indup(state, index);
-            else gen_indup(state, state->stack_s-index); 
+			gen_load_var(state, get_variable(state, expr->value.variable));
         } break;
 		case EXPR_STRUCT: {
 			size_t size = 0;
@@ -584,6 +1236,7 @@ void gen_expr(Program_State *state, Expr *expr) {
 			}
 			// TODO: this size can be wrong if not all the fields are declared upfront
             gen_struct_alloc(state, size);
+			state->region_alloc = false;
 			size_t offset = 0;			
 			for(size_t i = 0; i < expr->value.structure.values.count; i++) {
 				gen_structure_field(state, offset, expr->value.structure.values.data[i]);
@@ -598,9 +1251,7 @@ void gen_expr(Program_State *state, Expr *expr) {
             if(function->args.count != expr->value.func_call.args.count) {
                 PRINT_ERROR(expr->loc, "args count do not match for function `"View_Print"`\n", View_Arg(function->name));
             }
-            for(size_t i = 0; i < expr->value.func_call.args.count; i++) {
-                gen_expr(state, expr->value.func_call.args.data[i]);
-            }
+            gen_call_args(state, function, expr->value.func_call.args);
             gen_func_call(state, expr->value.func_call.name);
 			for(size_t i = 0; i < expr->value.func_call.args.count; i++) {
 				state->stack_s--;		
@@ -613,10 +1264,7 @@ void gen_expr(Program_State *state, Expr *expr) {
                 PRINT_ERROR(expr->loc, "variable `"View_Print"` referenced before assignment", View_Arg(expr->value.array.name));
             }
             Type_Type type = get_variable_type(state, expr->value.array.name);                        
-            gen_arr_offset(state, index, expr->value.array.index, type);
-            gen_push(state, data_type_s[type]);
-			gen_push(state, type_to_data[type]);
-            gen_read(state);
+            gen_indexed_load(state, get_variable(state, expr->value.array.name), expr->value.array.index, type);
         } break;
         case EXPR_FIELD_ARR: {
             int index = get_variable_location(state, expr->value.array.name);
@@ -625,10 +1273,7 @@ void gen_expr(Program_State *state, Expr *expr) {
             }
             Type_Type type = get_variable_type(state, expr->value.array.name);                        
 			Variable var = get_variable(state, expr->value.array.name);
-			gen_arr_offset(state, index, expr->value.array.index, type);
-            gen_push(state, data_type_s[type]);
-			gen_push(state, type_to_data[type]);			
-            gen_read(state);
+			gen_indexed_load(state, var, expr->value.array.index, type);
 			Struct structure = get_struct(state->structs, var.struct_name).value.structs;
             String_View var_name = expr->value.array.var_name;			
 			gen_field_offset(state, structure, var_name);			
@@ -654,16 +1299,36 @@ void gen_expr(Program_State *state, Expr *expr) {
         } break;
 		case EXPR_EXT: {
 			String_View name = expr->value.ext.name;
+			// a native can write through a str it is given, so it gets copies of literals
+			// that are freed again once it returns
+			size_t base = state->stack_s;
+			size_t copies = 0;
 			for(size_t i = 0; i < expr->value.ext.args.count; i++) {
+				if(expr->value.ext.args.data[i]->type != EXPR_STR) continue;
 				gen_expr(state, expr->value.ext.args.data[i]);
+				copies++;
+			}
+			for(size_t i = 0, copy = 0; i < expr->value.ext.args.count; i++) {
+				if(expr->value.ext.args.data[i]->type == EXPR_STR) gen_indup(state, state->stack_s - (base + ++copy));
+				else gen_expr(state, expr->value.ext.args.data[i]);
 			}
 			size_t ext_count = 0;			
 			for(size_t i = 0; i < state->symbols.count; i++) {
 				if(state->symbols.data[i].type == SYMBOL_EXT) {
 					if(view_cmp(state->symbols.data[i].val.ext.name, name)) {
-						gen_native(state, ext_count+2);
+						// the declaration tells the verifier what the call does to the stack
+						uint32_t value = ext_count + 2;
+						if(expr->value.ext.args.count <= 0xFF) {
+							value |= NATIVE_DECLARED | expr->value.ext.args.count << 16;
+							if(expr->value.ext.return_type != TYPE_VOID) value |= NATIVE_RETURNS;
+						}
+						gen_native(state, value);
 						state->stack_s -= expr->value.ext.args.count;
 						if(expr->value.ext.return_type != TYPE_VOID) state->stack_s++;
+						for(size_t i = 0; i < copies; i++) {
+							if(expr->value.ext.return_type != TYPE_VOID) gen_swap(state);
+							gen_dealloc(state);
+						}
 						break;
 					}
 					ext_count++;					
@@ -677,6 +1342,7 @@ void gen_expr(Program_State *state, Expr *expr) {
         default:
             ASSERT(false, "UNREACHABLE, %d\n", expr->type);
     }       
+	gen_loc(state, prev);
 }
 
 void scope_end(Program_State *state) {
@@ -699,9 +1365,42 @@ void ret_scope_end(Program_State *state) {
     }
 }
 	
+// literals live in the read-only string pool. gen_expr copies one, because it can not tell
+// where the pointer ends up, the places that can tell push the pool string with this instead
+void gen_borrowed(Program_State *state, Expr *expr) {
+	if(expr->type == EXPR_STR) gen_push_str(state, expr->value.string);
+	else gen_expr(state, expr);
+}
+
+// a literal argument is only copied for a parameter that may be written through
+void gen_call_args(Program_State *state, Function *function, Exprs args) {
+	for(size_t i = 0; i < args.count; i++) {
+		if(i < function->args.count && !var_may_be_written(state, function->name, function->args.data[i].value.var.name)) {
+			gen_borrowed(state, args.data[i]);
+		} else {
+			gen_expr(state, args.data[i]);
+		}
+	}
+}
+
+// a str variable that may be written through gets its own copy of a literal. reassigning one
+// that owns its copy frees the old one, otherwise every run of a loop would leave a copy behind
+void gen_str_copy(Program_State *state, Variable var, Expr *value, bool reassign) {
+	if(var.type != TYPE_STR || value->type != EXPR_STR) return;
+	String_View function = state->frame_stack.count == 0 ? (String_View){0} : state->functions.data[state->functions.count-1].name;
+	if(!var_may_be_written(state, function, var.name)) return;
+	gen_copy(state);
+	if(reassign && var_owns_copy(state, function, var.name)) {
+		gen_load_var(state, var);
+		gen_dealloc(state);
+	}
+}
+	
 void gen_var_dec(Program_State *state, Node *node) {
+       state->region_alloc = region_var(state, node->value.var);
        if(node->value.var.is_array && node->value.var.type != TYPE_STR) {
            gen_alloc(state, node->value.var.array_s, data_type_s[node->value.var.type]);
+           state->region_alloc = false;
            for(size_t i = 0; i < node->value.var.value.count; i++) {
                gen_dup(state);
                gen_offset(state, data_type_s[node->value.var.type]*i);
@@ -723,8 +1422,10 @@ void gen_var_dec(Program_State *state, Node *node) {
             }
 			gen_expr(state, node->value.var.value.data[0]);
        } else {
-           gen_expr(state, node->value.var.value.data[0]);                                    
+           gen_borrowed(state, node->value.var.value.data[0]);
+           gen_str_copy(state, node->value.var, node->value.var.value.data[0], false);
        }
+       state->region_alloc = false;
        node->value.var.stack_pos = state->stack_s;                 
        DA_APPEND(&state->vars, node->value.var);    
 }
@@ -732,6 +1433,7 @@ void gen_var_dec(Program_State *state, Node *node) {
 void gen_vars(Program_State *state, Program *program) {
 	for(size_t i = 0; i < program->vars.count; i++) {
 		Node *node = &program->vars.data[i];
+		gen_loc(state, node->loc);
 		switch(node->type) {
             case TYPE_VAR_DEC: {
 				gen_var_dec(state, node);
@@ -755,15 +1457,15 @@ size_t get_struct_size(Struct structure) {
 void gen_program(Program_State *state, Nodes nodes) {
     for(size_t i = 0; i < nodes.count; i++) {
         Node *node = &nodes.data[i];
+		gen_loc(state, node->loc);
         switch(node->type) {
             case TYPE_NATIVE:
                 switch(node->value.native.type) {
                     case NATIVE_WRITE: {
                         if(node->value.native.args.count > 1) {
-                            fprintf(stderr, "error: too many args\n");
-                            exit(1);
+                            tim_fail("error: too many args\n");
                         }
-                        gen_expr(state, node->value.native.args.data[0].value.expr);
+                        gen_borrowed(state, node->value.native.args.data[0].value.expr);
                         gen_push(state, STDOUT);
 						Inst inst = create_inst(INST_NATIVE, (Word){.as_int=node->value.native.type}, INT_TYPE);
 						DA_APPEND(&state->machine.instructions, inst);
@@ -788,16 +1490,15 @@ void gen_program(Program_State *state, Nodes nodes) {
             } break;
             case TYPE_VAR_REASSIGN: {
 				ASSERT(!node->value.var.is_const, "const variable cannot be reassigned");
-                gen_expr(state, node->value.var.value.data[0]);
+                gen_borrowed(state, node->value.var.value.data[0]);
 				Variable var = get_variable(state, node->value.var.name);
+				gen_str_copy(state, var, node->value.var.value.data[0], true);
                 //int index = get_variable_location(state, node->value.var.name);
 				int index = var.stack_pos;
                 if(index == -1) {
                     PRINT_ERROR(node->loc, "variable `"View_Print"` referenced before assignment", View_Arg(node->value.var.name));
                 }
-				if(var.global) gen_global_inswap(state, index);
-                else gen_inswap(state, state->stack_s-index);    
-				if(!var.is_struct) gen_pop(state);
+				gen_store_var(state, var);
             } break;
             case TYPE_FIELD_REASSIGN: {
                 String_View structure = node->value.field.structure;
@@ -817,7 +1518,7 @@ void gen_program(Program_State *state, Nodes nodes) {
                     PRINT_ERROR(node->loc, "array `"View_Print"` referenced before assignment", View_Arg(node->value.var.name));
                 }
                 Type_Type type = get_variable_type(state, node->value.array.name);                                            
-                gen_arr_offset(state, index, node->value.array.index, type);
+                gen_arr_offset(state, get_variable(state, node->value.array.name), node->value.array.index, type);
                 gen_expr(state, node->value.array.value.data[0]);                                                    
                 gen_push(state, data_type_s[type]);
                 gen_write(state);
@@ -837,8 +1538,12 @@ void gen_program(Program_State *state, Nodes nodes) {
                     var.struct_name = function.args.data[i].value.var.struct_name;		
                     DA_APPEND(&state->vars, var);    
                 }
+                DA_APPEND(&state->frame_stack, state->stack_s);
                 gen_jmp(state, node->value.func_dec.label);                                
                 gen_func_label(state, function.name);
+                size_t mark = block_has_region(state, nodes, i + 1) ? gen_region_mark(state) : 0;
+                DA_APPEND(&state->region_stack, mark);
+                DA_APPEND(&state->func_regions, mark);
             } break;
             case TYPE_FUNC_CALL: {
                 Function *function = get_func(state->program.functions, node->value.func_call.name);
@@ -846,9 +1551,7 @@ void gen_program(Program_State *state, Nodes nodes) {
                 if(function->args.count != node->value.func_call.args.count) {
                     PRINT_ERROR(node->loc, "args count do not match for function `"View_Print"`\n", View_Arg(function->name));
                 }
-                for(size_t i = 0; i < node->value.func_call.args.count; i++) {
-                    gen_expr(state, node->value.func_call.args.data[i]);
-                }
+                gen_call_args(state, function, node->value.func_call.args);
                 gen_func_call(state, node->value.func_call.name);
                 state->stack_s -= node->value.func_call.args.count;
                 // for the return value
@@ -868,8 +1571,10 @@ void gen_program(Program_State *state, Nodes nodes) {
 				// + 1 because we need to place it on the top of the stack after scope_end
                 size_t pos = state->ret_stack.data[state->ret_stack.count-1] + 1;
                 gen_expr(state, node->value.expr);
+                size_t mark = state->func_regions.data[state->func_regions.count-1];
+                if(mark) gen_region_reset(state, mark);
                 ASSERT(pos <= state->stack_s, "pos is too great: pos = %zu and ss = %zu", pos, state->stack_s);
-                gen_inswap(state, state->stack_s-pos);
+                if(pos < state->stack_s) gen_store_local(state, (int64_t)pos - frame_base(state) - 1);
                 size_t pre_stack_s = state->stack_s;
                 ret_scope_end(state);
                 state->stack_s = pre_stack_s;
@@ -899,9 +1604,16 @@ void gen_program(Program_State *state, Nodes nodes) {
             case TYPE_THEN: {
                 gen_zjmp(state, node->value.label.num);            
 				DA_APPEND(&state->scope_stack, state->stack_s);
+				// a loop body hands its region back every iteration
+				bool loop = state->block_stack.count > 0 && state->block_stack.data[state->block_stack.count-1] == BLOCK_WHILE;
+				size_t mark = loop && block_has_region(state, nodes, i + 1) ? gen_region_mark(state) : 0;
+				DA_APPEND(&state->region_stack, mark);
             } break;
             case TYPE_END: {
                 ASSERT(state->block_stack.count > 0, "block stack was underflowed");
+                ASSERT(state->region_stack.count > 0, "region stack was underflowed");
+                size_t mark = state->region_stack.data[--state->region_stack.count];
+                if(mark) gen_region_reset(state, mark);
                 scope_end(state);                    
                 state->scope_stack.count--;
                 Block_Type block = state->block_stack.data[--state->block_stack.count];
@@ -910,6 +1622,9 @@ void gen_program(Program_State *state, Nodes nodes) {
                 } else if(block == BLOCK_FUNC) {
 					Inst inst = create_inst(INST_RET, (Word){.as_int=0}, 0);
 					DA_APPEND(&state->machine.instructions, inst);
+					state->frame_stack.count--;
+					state->ret_stack.count--;
+					state->func_regions.count--;
                 }
                 gen_label(state, node->value.label.num);
             } break;
@@ -932,12 +1647,14 @@ void gen_label_arr(Program_State *state) {
 			case INST_ZJMP:
 			case INST_NZJMP:
 				if(instructions.data[i].data_type == PTR_TYPE) {
-					instructions.data[i].data_type = INT_TYPE;
+					// a while jmp keeps its mark so the loader encodes it as INST_LOOP
+					if(instructions.data[i].type != INST_JMP) instructions.data[i].data_type = INT_TYPE;
 					break;
 				}
 				instructions.data[i].value.as_int = state->labels.data[instructions.data[i].value.as_int];			
 				break;
 			case INST_CALL:
+			case INST_SPAWN:
 				instructions.data[i].value.as_int = state->functions.data[instructions.data[i].value.as_int].label;						
 				break;
 			default:
@@ -980,6 +1697,8 @@ void generate(Program_State *state, Program *program) {
 		gen_builtin(state, program->ext_nodes.data[i].value.expr_stmt);
 	}
 
+	infer_tags(state, program);
+	escape_analysis(state, program);
 	gen_vars(state, program);
     gen_program(state, program->nodes);
 	gen_label_arr(state);	
@@ -17,12 +17,41 @@ typedef struct {
 	size_t capacity;
 } Ext_Numbers;
 
+// expr_tag results that are not a DataType
+#define TAG_NONE -1
+#define TAG_UNKNOWN -2
+
+// runtime tag a variable or function result is known to carry, see infer_tags
+typedef struct {
+	String_View name;
+	int tag;
+} Value_Tag;
+
+typedef struct {
+	Value_Tag *data;
+	size_t count;
+	size_t capacity;
+} Value_Tags;
+
+// a variable or parameter whose value may outlive its scope, see escape_analysis
+typedef struct {
+	String_View function;
+	String_View name;
+} Escape;
+
+typedef struct {
+	Escape *data;
+	size_t count;
+	size_t capacity;
+} Escapes;
+
 typedef struct {
     Variables vars;
     Functions functions;
     size_t stack_s;
     Size_Stack scope_stack;
     Size_Stack ret_stack;
+    Size_Stack frame_stack;
     size_t while_label;
     Size_Stack while_labels;
     Block_Stack block_stack;    
@@ -32,6 +61,22 @@ typedef struct {
 	Ext_Numbers exts;	
 	Machine machine;
 	Symbols symbols;
+	Value_Tags var_tags;
+	Value_Tags elem_tags;
+	Value_Tags ret_tags;
+	Escapes escapes;
+	// str variables written through and ones assigned something other than a literal
+	Escapes writes;
+	Escapes shared;
+	// the parameters and variables each function declares, any other name it uses is a global
+	Escapes locals;
+	// stack position of each scope's region mark, 0 if it has none
+	Size_Stack region_stack;
+	Size_Stack func_regions;
+	// the alloc being generated goes into the frame region
+	bool region_alloc;
+	// source position recorded for the instructions being emitted
+	Location loc;
 } Program_State;
     
 void gen_push(Program_State *state, int value);
@@ -39,9 +84,21 @@ void gen_pop(Program_State *state);
 void gen_push_str(Program_State *state, String_View value);
 void gen_indup(Program_State *state, size_t value);
 void gen_inswap(Program_State *state, size_t value);
+size_t frame_base(Program_State *state);
+void gen_load_local(Program_State *state, int64_t slot);
+void gen_store_local(Program_State *state, int64_t slot);
+void gen_store_global(Program_State *state, size_t value);
+void gen_load_var(Program_State *state, Variable var);
+void gen_store_var(Program_State *state, Variable var);
 void gen_zjmp(Program_State *state, size_t label);
 void gen_jmp(Program_State *state, size_t label);
 void gen_while_jmp(Program_State *state, size_t label);
+void gen_copy(Program_State *state);
+void gen_dealloc(Program_State *state);
+void gen_swap(Program_State *state);
+void gen_alloc_inst(Program_State *state);
+size_t gen_region_mark(Program_State *state);
+void gen_region_reset(Program_State *state, size_t mark);
 void gen_label(Program_State *state, size_t label);
 void gen_func_label(Program_State *state, String_View label);
 void gen_func_call(Program_State *state, String_View label);
@@ -51,8 +108,22 @@ char *append_ext(char *filename, char *ext);
 Function *get_func(Functions functions, String_View name);
 size_t get_func_loc(Functions functions, String_View name);
 int get_variable_location(Program_State *state, String_View name);
+int find_tag(Value_Tags tags, String_View name);
+int bin_result_tag(Operator_Type op, int lhs);
+Inst_Set bin_inst(Operator_Type op, int lhs, int rhs);
+int expr_tag(Program_State *state, Expr *expr);
+void infer_tags(Program_State *state, Program *program);
+bool var_escapes(Program_State *state, String_View function, String_View name);
+bool var_may_be_written(Program_State *state, String_View function, String_View name);
+void escape_analysis(Program_State *state, Program *program);
+bool region_var(Program_State *state, Variable var);
+bool block_has_region(Program_State *state, Nodes nodes, size_t start);
+Location gen_loc(Program_State *state, Location loc);
 void gen_expr(Program_State *state, Expr *expr);
 void scope_end(Program_State *state);
+void gen_borrowed(Program_State *state, Expr *expr);
+void gen_call_args(Program_State *state, Function *function, Exprs args);
+void gen_str_copy(Program_State *state, Variable var, Expr *value, bool reassign);
 void gen_program(Program_State *state, Nodes nodes);
 void generate(Program_State *state, Program *program);
 
@@ -0,0 +1,166 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// expects tim.h to be included first, BATCH_IMPLEMENTATION also needs TIM_IMPLEMENTATION
+
+// runs the program once per input on jobs threads, each with its own machine sharing the
+// program's code, see machine_share. a run reads its input's path with `arg 0`, the file's contents with
+// `arg 1`, their length with `arg_int 2` and its index in inputs with `arg_int 3`.
+// what a run writes to stdout is buffered and printed in input order, errors and a
+// non zero exit are reported on stderr. returns the number of runs that failed
+size_t batch_run_instructions(Machine *machine, char **inputs, size_t count, size_t jobs);
+
+#endif // BATCH_H
+
+#ifdef BATCH_IMPLEMENTATION
+
+typedef struct {
+    char *output;
+    size_t output_size;
+    char error[512];
+    bool failed;
+    bool done;
+} Batch_Job;
+
+typedef struct {
+    Machine *program;
+    char **inputs;
+    Batch_Job *jobs;
+    size_t count;
+    // next job to hand out, taken with an atomic add
+    size_t next;
+    // jobs before this one have been printed, guarded by lock
+    size_t flushed;
+    size_t failed;
+    pthread_mutex_t lock;
+} Batch;
+
+static char *batch_read_input(char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return NULL;
+    char *data = NULL;
+    if(fseek(file, 0, SEEK_END) == 0) {
+        long len = ftell(file);
+        if(len >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+            data = malloc(len + 1);
+            if(data != NULL && fread(data, 1, len, file) == (size_t)len) {
+                data[len] = '\0';
+                *size = len;
+            } else {
+                free(data);
+                data = NULL;
+            }
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+static void batch_run_job(Batch *batch, Machine *machine, size_t index) {
+    Batch_Job *job = &batch->jobs[index];
+    char *path = batch->inputs[index];
+    size_t size = 0;
+    char *contents = batch_read_input(path, &size);
+    if(contents == NULL) {
+        snprintf(job->error, sizeof(job->error), "error: could not read %s\n", path);
+        job->failed = true;
+        return;
+    }
+    FILE *out = open_memstream(&job->output, &job->output_size);
+    ASSERT(out != NULL, "outta ram");
+    machine->out = out;
+    machine->args[0] = (Data){.word.as_pointer = path, .type = PTR_TYPE};
+    machine->args[1] = (Data){.word.as_pointer = contents, .type = PTR_TYPE};
+    machine->args[2] = (Data){.word.as_int = size, .type = INT_TYPE};
+    machine->args[3] = (Data){.word.as_int = index, .type = INT_TYPE};
+
+    Tim_Trap trap = {0};
+    Tim_Trap *prev = tim_trap;
+    tim_trap = &trap;
+    int trapped = sigsetjmp(trap.jump, 1);
+    if(trapped == 0) {
+        machine_init_stacks(machine);
+        run_code(machine, machine->code_offsets[machine->entrypoint], false);
+    }
+    tim_trap = prev;
+    if(trapped == TIM_TRAP_ERROR) {
+        snprintf(job->error, sizeof(job->error), "%s", trap.message);
+        job->failed = true;
+    } else if(trapped == TIM_TRAP_EXIT && trap.exit_code != 0) {
+        snprintf(job->error, sizeof(job->error), "error: exited with %d\n", trap.exit_code);
+        job->failed = true;
+    }
+
+    fclose(out);
+    machine->out = NULL;
+    machine_reset(machine);
+    // the natives a run loaded with load_library are loaded again by the next one
+    machine->native_ptrs_s = batch->program->native_ptrs_s;
+    free(contents);
+}
+
+// prints every finished job that is next in line, whichever worker finishes the job
+// the others were waiting on prints them
+static void batch_flush(Batch *batch, size_t index) {
+    pthread_mutex_lock(&batch->lock);
+    batch->jobs[index].done = true;
+    while(batch->flushed < batch->count && batch->jobs[batch->flushed].done) {
+        Batch_Job *job = &batch->jobs[batch->flushed];
+        if(job->output != NULL) fwrite(job->output, 1, job->output_size, stdout);
+        if(job->failed) {
+            fflush(stdout);
+            fprintf(stderr, "%s: %s", batch->inputs[batch->flushed], job->error);
+            batch->failed++;
+        }
+        free(job->output);
+        job->output = NULL;
+        batch->flushed++;
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void *batch_worker(void *arg) {
+    Batch *batch = arg;
+    Machine machine;
+    machine_share(&machine, batch->program, batch->program->stack_capacity);
+    while(true) {
+        size_t index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if(index >= batch->count) break;
+        batch_run_job(batch, &machine, index);
+        batch_flush(batch, index);
+    }
+    machine_free_shared(&machine);
+    return NULL;
+}
+
+size_t batch_run_instructions(Machine *machine, char **inputs, size_t count, size_t jobs) {
+	machine_load_native(machine, native_write);
+	machine_load_native(machine, native_exit);
+    if(machine->code == NULL) machine_load_code(machine);
+    machine_verify(machine);
+
+    Batch batch = {
+        .program = machine,
+        .inputs = inputs,
+        .count = count,
+        .jobs = calloc(count + 1, sizeof(Batch_Job)),
+    };
+    ASSERT(batch.jobs != NULL, "outta ram");
+    pthread_mutex_init(&batch.lock, NULL);
+    if(jobs == 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if(jobs > count) jobs = count;
+    pthread_t *threads = calloc(jobs + 1, sizeof(pthread_t));
+    ASSERT(threads != NULL, "outta ram");
+    for(size_t i = 0; i < jobs; i++) {
+        if(pthread_create(&threads[i], NULL, batch_worker, &batch) != 0) TIM_ERROR("error: could not start a batch worker\n");
+    }
+    for(size_t i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+    fflush(stdout);
+
+    pthread_mutex_destroy(&batch.lock);
+    free(threads);
+    free(batch.jobs);
+    return batch.failed;
+}
+
+#endif // BATCH_IMPLEMENTATION
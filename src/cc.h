@@ -0,0 +1,281 @@
+#ifndef CC_H
+#define CC_H
+
+// expects tim.h to be included first, CC_IMPLEMENTATION also needs TIM_IMPLEMENTATION
+
+// the generated program includes tim.h, so it has to know where to find it
+#ifndef TIM_INCLUDE_DIR
+#define TIM_INCLUDE_DIR "src"
+#endif
+
+// lowers the program into a C translation unit: one label per jump target, the stack ops on
+// locals and call/ret through the return stack plus a switch over return addresses.
+// instructions without a C template are run by the interpreter on the embedded bytecode
+void cc_write_program(Machine *machine, char *file_path);
+// writes <filename>.c next to the source and builds it into <filename> with the system compiler
+void cc_compile_program(Machine *machine, char *filename);
+
+#endif // CC_H
+
+#ifdef CC_IMPLEMENTATION
+
+// the helpers the generated code is written in, on top of the engine macros from tim.h
+static const char *cc_prelude =
+    "#define TIM_IMPLEMENTATION\n"
+    "#define ARENA_IMPLEMENTATION\n"
+    "#include \"tim.h\"\n"
+    "\n"
+    "void *custom_realloc(void *ptr, size_t size) {\n"
+    "    void *new_ptr = realloc(ptr, size);\n"
+    "    ASSERT(new_ptr != NULL, \"outta ram\");\n"
+    "    return new_ptr;\n"
+    "}\n"
+    "\n"
+    "#define LOAD_LOCAL(k) do { Data *slot = fp + (k); \\\n"
+    "    if(slot < stack || slot >= sp) TIM_ERROR(\"error: index out of range\\n\"); \\\n"
+    "    a = *slot; VM_PUSH(a.word, a.type); } while(0)\n"
+    "#define STORE_LOCAL(k) do { VM_POP(a); Data *slot = fp + (k); \\\n"
+    "    if(slot < stack || slot >= sp) TIM_ERROR(\"error: index out of range\\n\"); \\\n"
+    "    *slot = a; } while(0)\n"
+    "#define LOAD_GLOBAL(k) do { int64_t index = (int64_t)(k) - 1; \\\n"
+    "    if(index < 0 || index >= sp - stack) TIM_ERROR(\"error: index out of range\\n\"); \\\n"
+    "    a = stack[index]; VM_PUSH(a.word, a.type); } while(0)\n"
+    "#define STORE_GLOBAL(k) do { VM_POP(a); int64_t index = (int64_t)(k) - 1; \\\n"
+    "    if(index < 0 || index >= sp - stack) TIM_ERROR(\"error: index out of range\\n\"); \\\n"
+    "    stack[index] = a; } while(0)\n"
+    "// a dropped value is still read, so popping an empty stack reaches the guard page below it\n"
+    "#define POP() do { sp--; (void)*(volatile uint8_t*)sp; } while(0)\n"
+    "#define DIV_CHECK() do { if(sp > stack && sp[-1].word.as_int == 0) TIM_ERROR(\"error: cannot divide by 0\\n\"); } while(0)\n"
+    "#define CALL(back, target) do { machine->return_stack[rs].ret = (back); \\\n"
+    "    machine->return_stack[rs].fp = fp - stack; rs++; fp = sp; goto target; } while(0)\n"
+    "#define RET() do { rs--; next = machine->return_stack[rs].ret; \\\n"
+    "    fp = stack + machine->return_stack[rs].fp; goto dispatch; } while(0)\n"
+    "// runs one instruction in the interpreter and follows it if it jumped\n"
+    "#define STEP(offset, fallthrough) do { VM_SAVE(); machine->frame_pointer = fp - stack; \\\n"
+    "    machine->return_stack_size = rs; next = run_code(machine, (offset), true); \\\n"
+    "    VM_LOAD(); fp = stack + machine->frame_pointer; rs = machine->return_stack_size; \\\n"
+    "    if(next != (fallthrough)) goto dispatch; } while(0)\n"
+    "\n";
+
+// typed families in Inst_Set order, each has one opcode per type in the order below
+static const char *cc_typed_ops[] = {"+", "-", "*", "/", "==", "!=", ">", "<", ">=", "<="};
+static const char *cc_typed_words[] = {"as_int", "as_u8", "as_u16", "as_u32", "as_u64", "as_float", "as_double"};
+static const char *cc_typed_tags[] = {"INT_TYPE", "U8_TYPE", "U16_TYPE", "U32_TYPE", "U64_TYPE", "FLOAT_TYPE", "DOUBLE_TYPE"};
+
+static const char *cc_bin_op(Inst_Set type) {
+    switch(type) {
+        case INST_ADD: return "+";
+        case INST_SUB: return "-";
+        case INST_MUL: return "*";
+        case INST_DIV: return "/";
+        case INST_CMPE: return "==";
+        case INST_CMPNE: return "!=";
+        case INST_CMPG: return ">";
+        case INST_CMPL: return "<";
+        case INST_CMPGE: return ">=";
+        case INST_CMPLE: return "<=";
+        default: return NULL;
+    }
+}
+
+// emits the C for the instruction at offset, false if it has no template
+static bool cc_write_inst(FILE *file, Machine *machine, size_t offset) {
+    uint8_t *pc = machine->code + offset;
+    size_t next = offset + 1 + operand_size[*pc];
+    Inst_Set type = *pc;
+    if(type >= INST_ADD_I64 && type <= INST_CMPLE_F64) {
+        size_t family = (type - INST_ADD_I64) / 7;
+        size_t word = (type - INST_ADD_I64) % 7;
+        if(family == 3) fprintf(file, "TYPED_DIV(%s, %s);", cc_typed_words[word], cc_typed_tags[word]);
+        else fprintf(file, "TYPED_OP(%s, %s, %s);", cc_typed_words[word], cc_typed_tags[word], cc_typed_ops[family]);
+        return true;
+    }
+    if(cc_bin_op(type) != NULL) {
+        if(type == INST_DIV) fprintf(file, "DIV_CHECK(); ");
+        fprintf(file, "BIN_OP(%s);", cc_bin_op(type));
+        return true;
+    }
+    switch(type) {
+        case INST_NOP:
+            return true;
+        case INST_PUSH:
+            if(pc[1] == REGISTER_TYPE) return false;
+            fprintf(file, "VM_PUSH((Word){.as_u64=%" PRIu64 "ULL}, %d);", code_read_word(pc + 2).as_u64, pc[1]);
+            return true;
+        case INST_POP:
+            fprintf(file, "POP();");
+            return true;
+        case INST_DUP:
+            fprintf(file, "a = sp[-1]; VM_PUSH(a.word, a.type);");
+            return true;
+        case INST_SWAP:
+            fprintf(file, "a = sp[-1]; sp[-1] = sp[-2]; sp[-2] = a;");
+            return true;
+        case INST_MOD:
+            fprintf(file, "DIV_CHECK(); MATH_OP(as_int, %%, INT_TYPE);");
+            return true;
+        case INST_AND:
+            fprintf(file, "MATH_OP(as_int, &&, INT_TYPE);");
+            return true;
+        case INST_OR:
+            fprintf(file, "MATH_OP(as_int, ||, INT_TYPE);");
+            return true;
+        case INST_LOAD_LOCAL:
+            fprintf(file, "LOAD_LOCAL(%d);", (int32_t)code_read_u32(pc + 1));
+            return true;
+        case INST_STORE_LOCAL:
+            fprintf(file, "STORE_LOCAL(%d);", (int32_t)code_read_u32(pc + 1));
+            return true;
+        case INST_LOAD_GLOBAL:
+            fprintf(file, "LOAD_GLOBAL(%u);", code_read_u32(pc + 1));
+            return true;
+        case INST_STORE_GLOBAL:
+            fprintf(file, "STORE_GLOBAL(%u);", code_read_u32(pc + 1));
+            return true;
+        case INST_PTR_ADD_IMM:
+            fprintf(file, "VM_PUSH((Word){.as_int=%u}, INT_TYPE); BIN_OP(+); sp[-1].type = PTR_TYPE;", code_read_u32(pc + 1));
+            return true;
+        case INST_INDEX_ADDR:
+            fprintf(file, "INDEX_ADDR(%u);", code_read_u32(pc + 1));
+            return true;
+        case INST_INDEXED_LOAD:
+            fprintf(file, "INDEX_ADDR(%d); { Data data = {0}; data.type = %d; "
+                    "memcpy(&data.word, sp[-1].word.as_pointer, %d); sp[-1] = data; }", pc[1], pc[2], pc[1]);
+            return true;
+        case INST_JMP:
+        case INST_LOOP:
+            fprintf(file, "goto L%u;", code_read_u32(pc + 1));
+            return true;
+        case INST_ZJMP:
+            fprintf(file, "VM_POP(a); if(a.word.as_int == 0) goto L%u;", code_read_u32(pc + 1));
+            return true;
+        case INST_NZJMP:
+            fprintf(file, "VM_POP(a); if(a.word.as_int != 0) goto L%u;", code_read_u32(pc + 1));
+            return true;
+        case INST_CALL:
+            fprintf(file, "CALL(%zu, L%u);", next, code_read_u32(pc + 1));
+            return true;
+        case INST_RET:
+            fprintf(file, "RET();");
+            return true;
+        case INST_NATIVE:
+            fprintf(file, "VM_SAVE(); machine->native_ptrs[%u](machine); VM_LOAD();", NATIVE_INDEX(code_read_u32(pc + 1)));
+            return true;
+        case INST_HALT:
+            fprintf(file, "goto done;");
+            return true;
+        default:
+            return false;
+    }
+}
+
+void cc_write_program(Machine *machine, char *file_path) {
+    if(machine->code == NULL) machine_load_code(machine);
+    // the generated code keeps one stack in its locals and only has labels at jump targets
+    if(machine_has_coroutines(machine)) TIM_ERROR("error: cannot compile a program that uses coroutines, run it instead\n");
+    machine_load_insts(machine);
+    FILE *file = fopen(file_path, "w");
+    if(file == NULL) TIM_ERROR("error: could not write to %s\n", file_path);
+    fprintf(file, "%s", cc_prelude);
+
+    // the interpreter fallback runs off the same bytecode, so it ships with the program
+    fprintf(file, "static Inst program[] = {\n");
+    for(size_t i = 0; i < machine->program_size; i++) {
+        Inst inst = machine->instructions.data[i];
+        fprintf(file, "    {%d, {.as_u64=%" PRIu64 "ULL}, %d, %zu},\n", inst.type, inst.value.as_u64, inst.data_type, inst.register_index);
+    }
+    fprintf(file, "};\n\nstatic String_View strings[] = {\n");
+    for(size_t i = 0; i < machine->str_stack.count; i++) {
+        String_View str = machine->str_stack.data[i];
+        fprintf(file, "    {\"");
+        for(size_t c = 0; c < str.len; c++) fprintf(file, "\\%03o", (uint8_t)str.data[c]);
+        fprintf(file, "\", %zu},\n", str.len);
+    }
+    fprintf(file, "    {0},\n};\n\n");
+
+    // labels are only needed where something jumps to
+    bool *targets = calloc(machine->code_size, sizeof(bool));
+    ASSERT(targets != NULL, "outta ram");
+    targets[machine->code_offsets[machine->entrypoint]] = true;
+    targets[machine->code_size - 1] = true;
+    for(size_t offset = 0; offset < machine->code_size; offset += 1 + operand_size[machine->code[offset]]) {
+        uint8_t *pc = machine->code + offset;
+        switch(*pc) {
+            case INST_CALL:
+                targets[offset + 1 + operand_size[*pc]] = true;
+                // fallthrough
+            case INST_JMP:
+            case INST_LOOP:
+            case INST_ZJMP:
+            case INST_NZJMP:
+                targets[code_read_u32(pc + 1)] = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    fprintf(file, "int main(void) {\n");
+    fprintf(file, "    static Tim_Trap trap = {0};\n");
+    fprintf(file, "    int trapped = sigsetjmp(trap.jump, 1);\n");
+    fprintf(file, "    if(trapped != 0) tim_trap_exit(&trap, trapped);\n");
+    fprintf(file, "    tim_trap = &trap;\n");
+    fprintf(file, "    static Machine vm = {0};\n");
+    fprintf(file, "    Machine *machine = &vm;\n");
+    fprintf(file, "    machine->instructions = (Insts){program, %zu, %zu};\n", machine->program_size, machine->program_size);
+    fprintf(file, "    machine->program_size = %zu;\n", machine->program_size);
+    fprintf(file, "    machine->entrypoint = %zu;\n", machine->entrypoint);
+    fprintf(file, "    machine->str_stack = (Str_Stack){strings, %zu, %zu};\n", machine->str_stack.count, machine->str_stack.count);
+    fprintf(file, "    machine->stack_capacity = %zu;\n", machine->stack_capacity);
+    fprintf(file, "    machine_load_native(machine, native_write);\n");
+    fprintf(file, "    machine_load_native(machine, native_exit);\n");
+    fprintf(file, "    machine_load_code(machine);\n");
+    fprintf(file, "    machine_init_stacks(machine);\n");
+    fprintf(file, "    Data *stack = machine->stack;\n");
+    fprintf(file, "    Data *sp = stack;\n");
+    fprintf(file, "    Data *fp = stack;\n");
+    fprintf(file, "    int rs = 0;\n");
+    fprintf(file, "    size_t next = 0;\n");
+    fprintf(file, "    Data a, b;\n");
+    fprintf(file, "    (void)b;\n");
+    fprintf(file, "    goto L%zu;\n", machine->code_offsets[machine->entrypoint]);
+    for(size_t offset = 0; offset < machine->code_size; offset += 1 + operand_size[machine->code[offset]]) {
+        uint8_t *pc = machine->code + offset;
+        if(targets[offset]) fprintf(file, "L%zu:;\n", offset);
+        fprintf(file, "    ");
+        if(!cc_write_inst(file, machine, offset)) fprintf(file, "STEP(%zu, %zu);", offset, offset + 1 + operand_size[*pc]);
+        fprintf(file, " // %s\n", instructions[*pc]);
+    }
+    fprintf(file, "dispatch:\n");
+    fprintf(file, "    switch(next) {\n");
+    for(size_t offset = 0; offset < machine->code_size; offset++) {
+        if(targets[offset]) fprintf(file, "        case %zu: goto L%zu;\n", offset, offset);
+    }
+    fprintf(file, "        default: TIM_ERROR(\"error: cannot jump to %%zu\\n\", next);\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "done:\n");
+    fprintf(file, "    return 0;\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    free(targets);
+}
+
+void cc_compile_program(Machine *machine, char *filename) {
+    char *source = append_ext(filename, "c");
+    char *output = append_ext(filename, "");
+    output[strlen(output) - 1] = '\0';
+    cc_write_program(machine, source);
+
+    char command[1024] = {0};
+    snprintf(command, sizeof(command), "gcc -O2 -pthread -I%s -o %s %s %s/view.c",
+        TIM_INCLUDE_DIR, output, source, TIM_INCLUDE_DIR);
+    printf("Compiling %s...\n", output);
+    if(system(command) != 0) {
+        printf("Command failed!\n");
+        exit(1);
+    }
+    free(source);
+    free(output);
+}
+
+#endif // CC_IMPLEMENTATION
@@ -0,0 +1,23 @@
+#include "main.h"
+
+bool compile_file(Compiler *compiler, Program_State *state, char *filename) {
+	compiler->token_arena = arena_init(sizeof(Token)*ARENA_INIT_SIZE);
+	compiler->string_arena = arena_init(sizeof(char)*ARENA_INIT_SIZE);
+	compiler->node_arena = arena_init(sizeof(Node)*ARENA_INIT_SIZE);
+	Tim_Trap *prev = tim_trap;
+	tim_trap = &compiler->trap;
+	if(sigsetjmp(compiler->trap.jump, 1) != 0) {
+		tim_trap = prev;
+		return false;
+	}
+    Token_Arr tokens = lex(compiler, filename);
+    Blocks block_stack = {0};
+    Program program = parse(compiler, tokens, &block_stack);
+	state->program = program;
+    state->structs = program.structs;
+	state->symbols = program.symbols;
+    generate(state, &program);
+	state->machine.program_size = state->machine.instructions.count;
+	tim_trap = prev;
+	return true;
+}
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <setjmp.h>
 
 #include "view.h"
 #include "arena.h"
@@ -18,13 +19,30 @@
 
 #define STDOUT 1
 
+// errors anywhere in the compiler or the VM end the process, unless the thread has set
+// tim_trap, then they jump back to it with TIM_TRAP_ERROR and the message, and exit jumps
+// back with TIM_TRAP_EXIT. tim.h defines these with TIM_IMPLEMENTATION
+#define TIM_TRAP_ERROR 1
+#define TIM_TRAP_EXIT 2
+
+typedef struct {
+    sigjmp_buf jump;
+    char message[512];
+    int exit_code;
+} Tim_Trap;
+
+extern _Thread_local Tim_Trap *tim_trap;
+
+_Noreturn void tim_fail(const char *format, ...) __attribute__((format(printf, 1, 2)));
+_Noreturn void tim_fail_at(const char *file, size_t row, size_t col, const char *format, ...) __attribute__((format(printf, 4, 5)));
+_Noreturn void tim_assert_fail(const char *file, int line, const char *format, ...) __attribute__((format(printf, 3, 4)));
+_Noreturn void tim_exit(int code);
+_Noreturn void tim_trap_exit(Tim_Trap *trap, int trapped);
+
 #define ASSERT(cond, ...) \
     do { \
         if (!(cond)) { \
-            fprintf(stderr, "%s:%d: ASSERTION FAILED: ", __FILE__, __LINE__); \
-            fprintf(stderr, __VA_ARGS__); \
-            fprintf(stderr, "\n"); \
-            exit(1); \
+            tim_assert_fail(__FILE__, __LINE__, __VA_ARGS__); \
         } \
     } while (0)
 
@@ -49,10 +67,7 @@
 #define PRINT_ERROR(loc, ...)                                                 \
     do {                                                                           \
 		ASSERT((loc).filename != NULL, "Filename cannot be NULL");			\
-        fprintf(stderr, "%s:%zu:%zu: error: ", loc.filename, loc.row, loc.col);  \
-        fprintf(stderr, __VA_ARGS__);    \
-        fprintf(stderr, "\n"); \
-        exit(1);                                                                   \
+        tim_fail_at((loc).filename, (loc).row, (loc).col, __VA_ARGS__);  \
     } while(0)
     
 typedef enum {
@@ -63,6 +78,17 @@ typedef enum {
     BUILTIN_GET,        
 	BUILTIN_DLL,
 	BUILTIN_CALL,	
+	BUILTIN_COPY,
+	BUILTIN_ARENA,
+	BUILTIN_ARENA_ALLOC,
+	BUILTIN_ARENA_RESET,
+	BUILTIN_ARENA_FREE,
+	BUILTIN_ARG,
+	BUILTIN_ARG_INT,
+	BUILTIN_SPAWN,
+	BUILTIN_YIELD,
+	BUILTIN_RESUME,
+	BUILTIN_JOIN,
 } Builtin_Type;
     
 typedef struct {
@@ -532,6 +558,20 @@ typedef struct {
 	Symbols symbols;
 } Parser;
 
+struct hashmap_s;
+
+// everything one compilation owns. the compiler keeps no state of its own between calls,
+// so threads can compile at the same time as long as each has its own, see compile_file
+typedef struct {
+    // PRINT_ERROR and ASSERT jump here with the message while compile_file runs
+    Tim_Trap trap;
+    Arena token_arena;
+    Arena string_arena;
+    Arena node_arena;
+    // @def macros the preprocessor has seen, made by lex
+    struct hashmap_s *defines;
+} Compiler;
+
 void *custom_realloc(void *ptr, size_t size);
     
 #endif // DEFS_H
@@ -1,5 +1,6 @@
 #include "frontend.h"
 
+#define TIPP_ERROR(...) tim_fail(__VA_ARGS__)
 #define TIPP_IMPLEMENTATION
 #include "tipp.h"
 
@@ -78,8 +79,7 @@ char get_escape(char c){
 String_View read_file_to_view(Arena *arena, char *filename) {
     FILE *file = fopen(filename, "r");
 	if(file == NULL) {
-		fprintf(stderr, "cannot read from file: %s\n", filename);
-		exit(1);
+		tim_fail("cannot read from file: %s\n", filename);
 	}
     
     fseek(file, 0, SEEK_END);
@@ -142,6 +142,17 @@ Keyword builtins_list[] = {
 	{LITERAL_VIEW("get"), BUILTIN_GET},	
 	{LITERAL_VIEW("dll"), BUILTIN_DLL},	
 	{LITERAL_VIEW("call"), BUILTIN_CALL},			
+	{LITERAL_VIEW("copy"), BUILTIN_COPY},
+	{LITERAL_VIEW("arena"), BUILTIN_ARENA},
+	{LITERAL_VIEW("arena_alloc"), BUILTIN_ARENA_ALLOC},
+	{LITERAL_VIEW("arena_reset"), BUILTIN_ARENA_RESET},
+	{LITERAL_VIEW("arena_free"), BUILTIN_ARENA_FREE},
+	{LITERAL_VIEW("arg"), BUILTIN_ARG},
+	{LITERAL_VIEW("arg_int"), BUILTIN_ARG_INT},
+	{LITERAL_VIEW("spawn"), BUILTIN_SPAWN},
+	{LITERAL_VIEW("yield"), BUILTIN_YIELD},
+	{LITERAL_VIEW("resume"), BUILTIN_RESUME},
+	{LITERAL_VIEW("join"), BUILTIN_JOIN},
 };
 #define BUILTIN_COUNT sizeof(builtins_list)/sizeof(*builtins_list)
 
@@ -290,8 +301,15 @@ Dynamic_Str generate_string(Arena *arena, String_View *view, Token token, char d
 	return word;
 }
 
-Token_Arr lex(Arena *arena, Arena *string_arena, char *entry_filename, String_View view) {
-	view = prepro(entry_filename, 0);
+Token_Arr lex(Compiler *compiler, char *entry_filename) {
+	Arena *arena = &compiler->token_arena;
+	Arena *string_arena = &compiler->string_arena;
+	if(compiler->defines == NULL) {
+		compiler->defines = calloc(1, sizeof(struct hashmap_s));
+		ASSERT(compiler->defines != NULL, "outta ram");
+		if(hashmap_create(1, compiler->defines) != 0) tim_fail("error: could not create the macro table\n");
+	}
+	String_View view = prepro(compiler->defines, entry_filename, 0);
     size_t row = 1;
     Token_Arr tokens = {0};
     const char *start = view.data;
@@ -306,10 +324,10 @@ Token_Arr lex(Arena *arena, Arena *string_arena, char *entry_filename, String_Vi
 				view = view_chop_left(view);
 				Dynamic_Str prepro_filename = {0};
 				while(view.len > 0 && *view.data != '"') {
-					ADA_APPEND(arena, &prepro_filename, *view.data);
+					ADA_APPEND(string_arena, &prepro_filename, *view.data);
 					view = view_chop_left(view);
 				}
-				ADA_APPEND(arena, &prepro_filename, '\0');
+				ADA_APPEND(string_arena, &prepro_filename, '\0');
 				if(view.len == 0) PRINT_ERROR(token.loc, "invalid preprocessor directive");
 				// consume `"` and space
 				view = view_chop_left(view);
@@ -656,7 +674,7 @@ Builtin parse_builtin_node(Builtin_Type type, Parser *parser) {
 				break;
 			}
 		}
-	} else {
+	} else if(builtin.type != BUILTIN_YIELD) {
 	    ADA_APPEND(arena, &builtin.value, parse_expr(parser));
 	    while(token_peek(tokens, 0).type == TT_COMMA) {
 	        token_consume(tokens);
@@ -667,16 +685,29 @@ Builtin parse_builtin_node(Builtin_Type type, Parser *parser) {
         case BUILTIN_TOVP:
         case BUILTIN_GET:        
         case BUILTIN_ALLOC:
+		case BUILTIN_ARENA_ALLOC:
+		case BUILTIN_ARG:
             builtin.return_type = TYPE_PTR;
             break;
         case BUILTIN_STORE:
         case BUILTIN_DEALLOC:
 		case BUILTIN_DLL:
+		case BUILTIN_ARENA_RESET:
+		case BUILTIN_ARENA_FREE:
+		case BUILTIN_YIELD:
             builtin.return_type = TYPE_VOID;
             break;        
 		case BUILTIN_CALL:
+		case BUILTIN_ARENA:
+		case BUILTIN_ARG_INT:
+		case BUILTIN_SPAWN:
+		case BUILTIN_RESUME:
+		case BUILTIN_JOIN:
 			builtin.return_type = TYPE_INT;
 			break;
+		case BUILTIN_COPY:
+			builtin.return_type = TYPE_STR;
+			break;
     }
     return builtin;
 }
@@ -697,23 +728,26 @@ Variable get_var(Location loc, Parser *parser, String_View name) {
 			if(view_cmp(func.args.data[i].value.var.name, name)) return func.args.data[i].value.var;
 		}
 	}
+	// a function sees its own variables first and then the globals declared before it
+	Variable *global = NULL;
     for(size_t i = 0; i < parser->symbols.count; i++) {
         if(parser->symbols.data[i].type == SYMBOL_VAR && view_cmp(parser->symbols.data[i].val.var.name, name)) {
 			String_View func = parser->symbols.data[i].val.var.function;
 			if(is_in_function(parser->blocks)) {
 				if(func.data != NULL && view_cmp(get_cur_function(parser->blocks), func))
 					return parser->symbols.data[i].val.var;
+				if(func.data == NULL && global == NULL) global = &parser->symbols.data[i].val.var;
 			} else if(func.data == NULL) {
 					return parser->symbols.data[i].val.var;
 			}
 		}
     }
+	if(global != NULL) return *global;
 // TODO: fix
 	if(loc.filename)
 		PRINT_ERROR(loc, "Unknown variable: "View_Print, View_Arg(name));
 	else {
-		fprintf(stderr, "no var");
-		exit(1);
+		tim_fail("no var");
 	}
 }
 
@@ -1103,7 +1137,8 @@ int parse_reassign_left(Parser *parser, Node *node) {
     return 0;
 }
     
-Program parse(Arena *arena, Token_Arr tokens, Blocks *block_stack) {
+Program parse(Compiler *compiler, Token_Arr tokens, Blocks *block_stack) {
+	Arena *arena = &compiler->node_arena;
     // TODO: initialize the Program struct at the top of func
     Nodes root = {0};
     Functions functions = {0};
@@ -1395,3 +1430,14 @@ Program parse(Arena *arena, Token_Arr tokens, Blocks *block_stack) {
 	program.ext_nodes = parser.ext_nodes;
     return program;
 }
+
+void compiler_free(Compiler *compiler) {
+	arena_free(&compiler->token_arena);
+	arena_free(&compiler->string_arena);
+	arena_free(&compiler->node_arena);
+	if(compiler->defines != NULL) {
+		hashmap_destroy(compiler->defines);
+		free(compiler->defines);
+	}
+	*compiler = (Compiler){0};
+}
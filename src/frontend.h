@@ -14,7 +14,7 @@ Token handle_data_type(Token token, String_View str);
 bool is_operator(String_View view);
 Token create_operator_token(char *filename, size_t row, size_t col, String_View *view);
 void print_token_arr(Token_Arr arr);
-Token_Arr lex(Arena *arena, Arena *string_arena, char *filename, String_View view);
+Token_Arr lex(Compiler *compiler, char *filename);
 Token token_consume(Token_Arr *tokens);
 Token token_peek(Token_Arr *tokens, size_t peek_by);
 Token expect_token(Token_Arr *tokens, Token_Type type);
@@ -26,10 +26,11 @@ Expr *parse_primary(Parser *parser);
 Expr *parse_expr_1(Parser *parser, Expr *lhs, Precedence min_precedence);
 Node parse_native_node(Parser *parser, int native_value);
 Node parse_var_dec(Parser *parser);
-Program parse(Arena *arena, Token_Arr tokens, Blocks *block_stack);
+Program parse(Compiler *compiler, Token_Arr tokens, Blocks *block_stack);
 Struct get_structure(Location loc, Parser *parser, String_View name);
 bool is_field(Struct *structure, String_View field);
 bool is_in_function(Blocks *blocks);
 String_View get_cur_function(Blocks *blocks);
+void compiler_free(Compiler *compiler);
 
 #endif // FRONTEND_H
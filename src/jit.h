@@ -0,0 +1,764 @@
+#ifndef JIT_H
+#define JIT_H
+
+// expects tim.h to be included first, JIT_IMPLEMENTATION also needs TIM_IMPLEMENTATION
+
+// translates the compact code into x86-64 with one template per opcode, anything without
+// a template (or whose fast path bails) is run by the interpreter one instruction at a time.
+// the VM stacks stay in memory, only sp, fp and the return stack pointer live in registers
+void jit_run_instructions(Machine *machine);
+// interprets, but records one iteration of every hot while loop and runs it as native code
+void trace_run_instructions(Machine *machine);
+
+#endif // JIT_H
+
+#ifdef JIT_IMPLEMENTATION
+
+#if defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+// register state handed between the native code and the interpreter
+typedef struct {
+    Data *sp;
+    Data *fp;
+    Call_Frame *rs;
+} Jit_Regs;
+
+typedef struct {
+    uint8_t *data;
+    size_t count;
+    size_t capacity;
+} Jit_Buffer;
+
+// rel32 operand at `at` that jumps to the byte offset `target`
+typedef struct {
+    size_t at;
+    size_t target;
+} Jit_Fixup;
+
+typedef struct {
+    Jit_Fixup *data;
+    size_t count;
+    size_t capacity;
+} Jit_Fixups;
+
+#define JIT_MAX_SLOW 8
+
+typedef struct {
+    Jit_Buffer buf;
+    Jit_Fixups fixups;
+    // buffer position of every instruction, indexed by byte offset
+    size_t *pos;
+    size_t exit;
+    size_t dispatch;
+    // jumps from the current fast path to its slow path
+    size_t slow[JIT_MAX_SLOW];
+    size_t slow_count;
+} Jit;
+
+typedef enum {
+    JIT_ADD,
+    JIT_SUB,
+    JIT_MUL,
+    JIT_DIV,
+    JIT_MOD,
+    JIT_CMPE,
+    JIT_CMPNE,
+    JIT_CMPG,
+    JIT_CMPL,
+    JIT_CMPGE,
+    JIT_CMPLE,
+} Jit_Op;
+
+// returns the byte offset the code left at, only meaningful for traces
+typedef size_t (*Jit_Entry)(Machine *machine, Jit_Regs *regs, void *start, void **table);
+
+_Static_assert(sizeof(Data) == 16 && offsetof(Data, type) == 8, "jit templates assume a 16 byte Data");
+_Static_assert(sizeof(Call_Frame) == 16 && offsetof(Call_Frame, fp) == 8, "jit templates assume a 16 byte Call_Frame");
+
+#define NO_POS ((size_t)-1)
+#define NO_GUARD -1
+
+// registers: rbx = sp, r12 = machine, r13 = fp, r14 = return stack pointer, r15 = offset -> native table
+#define EMIT(...) jit_emit(jit, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void jit_emit(Jit *jit, const uint8_t *bytes, size_t count) {
+    for(size_t i = 0; i < count; i++) DA_APPEND(&jit->buf, bytes[i]);
+}
+
+static void jit_u32(Jit *jit, uint32_t value) {
+    uint8_t bytes[4];
+    memcpy(bytes, &value, sizeof(value));
+    jit_emit(jit, bytes, sizeof(bytes));
+}
+
+static void jit_u64(Jit *jit, uint64_t value) {
+    uint8_t bytes[8];
+    memcpy(bytes, &value, sizeof(value));
+    jit_emit(jit, bytes, sizeof(bytes));
+}
+
+// leaves a zero rel32 and returns where it is so it can be patched
+static size_t jit_rel32(Jit *jit) {
+    size_t at = jit->buf.count;
+    jit_u32(jit, 0);
+    return at;
+}
+
+static void jit_patch(Jit *jit, size_t at, size_t target) {
+    int32_t rel = (int64_t)target - (int64_t)(at + 4);
+    memcpy(jit->buf.data + at, &rel, sizeof(rel));
+}
+
+static void jit_jump_to_offset(Jit *jit, size_t target) {
+    DA_APPEND(&jit->fixups, ((Jit_Fixup){.at = jit_rel32(jit), .target = target}));
+}
+
+// jcc rel32 to the slow path of the instruction being compiled
+static void jit_slow_if(Jit *jit, uint8_t cc) {
+    ASSERT(jit->slow_count < JIT_MAX_SLOW, "too many slow paths");
+    EMIT(0x0F, cc);
+    jit->slow[jit->slow_count++] = jit_rel32(jit);
+}
+
+#define JIT_JB 0x82
+#define JIT_JAE 0x83
+#define JIT_JE 0x84
+#define JIT_JNE 0x85
+#define JIT_JA 0x87
+
+static void jit_save_regs(Jit *jit) {
+    EMIT(0x48, 0x8B, 0x14, 0x24);       // mov rdx, [rsp]
+    EMIT(0x48, 0x89, 0x1A);             // mov [rdx], rbx
+    EMIT(0x4C, 0x89, 0x6A, 0x08);       // mov [rdx+8], r13
+    EMIT(0x4C, 0x89, 0x72, 0x10);       // mov [rdx+16], r14
+}
+
+static void jit_load_regs(Jit *jit) {
+    EMIT(0x48, 0x8B, 0x14, 0x24);       // mov rdx, [rsp]
+    EMIT(0x48, 0x8B, 0x1A);             // mov rbx, [rdx]
+    EMIT(0x4C, 0x8B, 0x6A, 0x08);       // mov r13, [rdx+8]
+    EMIT(0x4C, 0x8B, 0x72, 0x10);       // mov r14, [rdx+16]
+}
+
+// op r64, [r12 + offsetof(Machine, stack)]
+static void jit_stack_base(Jit *jit, uint8_t rex, uint8_t op, uint8_t reg) {
+    EMIT(rex, op, 0x84 | (reg << 3), 0x24);
+    jit_u32(jit, offsetof(Machine, stack));
+}
+
+static size_t jit_step(Machine *machine, uint32_t offset, Jit_Regs *regs) {
+    machine->stack_size = regs->sp - machine->stack;
+    machine->frame_pointer = regs->fp - machine->stack;
+    machine->return_stack_size = regs->rs - machine->return_stack;
+    size_t next = run_code(machine, offset, true);
+    regs->sp = machine->stack + machine->stack_size;
+    regs->fp = machine->stack + machine->frame_pointer;
+    regs->rs = machine->return_stack + machine->return_stack_size;
+    return next;
+}
+
+// runs the instruction at offset in the interpreter and continues wherever it went
+static void jit_fallback(Jit *jit, size_t offset, size_t next) {
+    jit_save_regs(jit);
+    EMIT(0x4C, 0x89, 0xE7);             // mov rdi, r12
+    EMIT(0xBE);                         // mov esi, offset
+    jit_u32(jit, offset);
+    EMIT(0x48, 0xB8);                   // mov rax, jit_step
+    jit_u64(jit, (uintptr_t)&jit_step);
+    EMIT(0xFF, 0xD0);                   // call rax
+    jit_load_regs(jit);
+    EMIT(0x48, 0x3D);                   // cmp rax, next
+    jit_u32(jit, next);
+    EMIT(0x0F, JIT_JNE);                // jne dispatch
+    jit_patch(jit, jit_rel32(jit), jit->dispatch);
+}
+
+// the entry, exit and indirect dispatch stubs shared by every instruction
+static void jit_stubs(Jit *jit) {
+    EMIT(0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57); // push rbx, rbp, r12-r15
+    EMIT(0x48, 0x83, 0xEC, 0x08);       // sub rsp, 8
+    EMIT(0x48, 0x89, 0x34, 0x24);       // mov [rsp], rsi
+    EMIT(0x49, 0x89, 0xFC);             // mov r12, rdi
+    EMIT(0x49, 0x89, 0xCF);             // mov r15, rcx
+    EMIT(0x48, 0x89, 0xD0);             // mov rax, rdx
+    jit_load_regs(jit);
+    EMIT(0xFF, 0xE0);                   // jmp rax
+
+    jit->exit = jit->buf.count;
+    jit_save_regs(jit);
+    EMIT(0x48, 0x83, 0xC4, 0x08);       // add rsp, 8
+    EMIT(0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B); // pop r15-r12, rbp, rbx
+    EMIT(0xC3);                         // ret
+
+    jit->dispatch = jit->buf.count;
+    EMIT(0x41, 0xFF, 0x24, 0xC7);       // jmp [r15 + rax*8]
+}
+
+// guard that the tag of the Data at [rbx+disp] is exactly `tag`
+static void jit_guard_tag(Jit *jit, int8_t disp, DataType tag) {
+    EMIT(0x83, 0x7B, (uint8_t)disp, tag);   // cmp dword [rbx+disp], tag
+    jit_slow_if(jit, JIT_JNE);
+}
+
+// guard that the tag of the Data at [rbx+disp] is INT_TYPE, U64_TYPE or PTR_TYPE
+static void jit_guard_wide(Jit *jit, int8_t disp) {
+    EMIT(0x8B, 0x43, (uint8_t)disp);    // mov eax, [rbx+disp]
+    EMIT(0x83, 0xF8, PTR_TYPE);         // cmp eax, PTR_TYPE
+    jit_slow_if(jit, JIT_JA);
+    EMIT(0xB9);                         // mov ecx, wide tags
+    jit_u32(jit, (1u << INT_TYPE) | (1u << U64_TYPE) | (1u << PTR_TYPE));
+    EMIT(0x0F, 0xA3, 0xC1);             // bt ecx, eax
+    jit_slow_if(jit, JIT_JAE);
+}
+
+static void jit_push_rax(Jit *jit, DataType tag) {
+    EMIT(0x48, 0x89, 0x03);             // mov [rbx], rax
+    EMIT(0xC7, 0x43, 0x08);             // mov dword [rbx+8], tag
+    jit_u32(jit, tag);
+    EMIT(0x48, 0x83, 0xC3, 0x10);       // add rbx, 16
+}
+
+// copies the Data at [rax] onto the top of the stack, word and tag are moved separately
+// since they are usually written separately and a 16 byte load would not forward from those
+static void jit_push_slot(Jit *jit) {
+    EMIT(0x48, 0x8B, 0x08);             // mov rcx, [rax]
+    EMIT(0x8B, 0x50, 0x08);             // mov edx, [rax+8]
+    EMIT(0x48, 0x89, 0x0B);             // mov [rbx], rcx
+    EMIT(0x89, 0x53, 0x08);             // mov [rbx+8], edx
+    EMIT(0x48, 0x83, 0xC3, 0x10);       // add rbx, 16
+}
+
+// pops the top of the stack into [rax], the slot has to be below the new sp
+static void jit_pop_slot(Jit *jit) {
+    EMIT(0x48, 0x8D, 0x4B, 0xF0);       // lea rcx, [rbx-16]
+    EMIT(0x48, 0x39, 0xC8);             // cmp rax, rcx
+    jit_slow_if(jit, JIT_JAE);
+    jit_stack_base(jit, 0x49, 0x3B, 0); // cmp rax, stack
+    jit_slow_if(jit, JIT_JB);
+    EMIT(0x48, 0x8B, 0x11);             // mov rdx, [rcx]
+    EMIT(0x48, 0x89, 0x10);             // mov [rax], rdx
+    EMIT(0x8B, 0x51, 0x08);             // mov edx, [rcx+8]
+    EMIT(0x89, 0x50, 0x08);             // mov [rax+8], edx
+    EMIT(0x48, 0x89, 0xCB);             // mov rbx, rcx
+}
+
+// pushes a Call_Frame returning to `next` and makes the current sp the new frame
+static void jit_call_frame(Jit *jit, size_t next) {
+    EMIT(0x4C, 0x89, 0xE8);             // mov rax, r13
+    jit_stack_base(jit, 0x49, 0x2B, 0); // sub rax, stack
+    EMIT(0x48, 0xC1, 0xF8, 0x04);       // sar rax, 4
+    EMIT(0x49, 0x89, 0x46, 0x08);       // mov [r14+8], rax
+    EMIT(0x49, 0xC7, 0x06);             // mov qword [r14], next
+    jit_u32(jit, next);
+    EMIT(0x49, 0x83, 0xC6, 0x10);       // add r14, 16
+    EMIT(0x49, 0x89, 0xDD);             // mov r13, rbx
+}
+
+// pops the Call_Frame, restores fp and leaves the return offset in rax
+static void jit_ret_frame(Jit *jit) {
+    EMIT(0x49, 0x83, 0xEE, 0x10);       // sub r14, 16
+    EMIT(0x49, 0x8B, 0x46, 0x08);       // mov rax, [r14+8]
+    EMIT(0x48, 0xC1, 0xE0, 0x04);       // shl rax, 4
+    jit_stack_base(jit, 0x49, 0x03, 0); // add rax, stack
+    EMIT(0x49, 0x89, 0xC5);             // mov r13, rax
+    EMIT(0x49, 0x8B, 0x06);             // mov rax, [r14]
+}
+
+// a = [rbx-32], b = [rbx-16], the result replaces a
+static bool jit_int_op(Jit *jit, Jit_Op op, int guard, DataType result, bool is_signed) {
+    if(guard != NO_GUARD) {
+        jit_guard_tag(jit, -24, guard);
+        jit_guard_tag(jit, -8, guard);
+    }
+    EMIT(0x48, 0x8B, 0x43, 0xE0);       // mov rax, [rbx-32]
+    switch(op) {
+        case JIT_ADD:
+            EMIT(0x48, 0x03, 0x43, 0xF0);   // add rax, [rbx-16]
+            break;
+        case JIT_SUB:
+            EMIT(0x48, 0x2B, 0x43, 0xF0);   // sub rax, [rbx-16]
+            break;
+        case JIT_MUL:
+            EMIT(0x48, 0x0F, 0xAF, 0x43, 0xF0); // imul rax, [rbx-16]
+            break;
+        case JIT_DIV:
+        case JIT_MOD:
+            EMIT(0x48, 0x8B, 0x4B, 0xF0);   // mov rcx, [rbx-16]
+            EMIT(0x48, 0x85, 0xC9);         // test rcx, rcx
+            jit_slow_if(jit, JIT_JE);
+            if(is_signed) EMIT(0x48, 0x99, 0x48, 0xF7, 0xF9);   // cqo; idiv rcx
+            else EMIT(0x31, 0xD2, 0x48, 0xF7, 0xF1);            // xor edx, edx; div rcx
+            if(op == JIT_MOD) EMIT(0x48, 0x89, 0xD0);           // mov rax, rdx
+            break;
+        default: {
+            static const uint8_t signed_cc[] = {
+                [JIT_CMPE] = 0x94, [JIT_CMPNE] = 0x95, [JIT_CMPG] = 0x9F,
+                [JIT_CMPL] = 0x9C, [JIT_CMPGE] = 0x9D, [JIT_CMPLE] = 0x9E,
+            };
+            static const uint8_t unsigned_cc[] = {
+                [JIT_CMPE] = 0x94, [JIT_CMPNE] = 0x95, [JIT_CMPG] = 0x97,
+                [JIT_CMPL] = 0x92, [JIT_CMPGE] = 0x93, [JIT_CMPLE] = 0x96,
+            };
+            EMIT(0x48, 0x3B, 0x43, 0xF0);   // cmp rax, [rbx-16]
+            EMIT(0x0F, is_signed ? signed_cc[op] : unsigned_cc[op], 0xC0); // setcc al
+            EMIT(0x0F, 0xB6, 0xC0);         // movzx eax, al
+        } break;
+    }
+    EMIT(0x48, 0x89, 0x43, 0xE0);       // mov [rbx-32], rax
+    EMIT(0xC7, 0x43, 0xE8);             // mov dword [rbx-24], result
+    jit_u32(jit, result);
+    EMIT(0x48, 0x83, 0xEB, 0x10);       // sub rbx, 16
+    return true;
+}
+
+// leaves base + index*size in rax and pops the index, both have to be wide integers
+static bool jit_index_addr(Jit *jit, uint32_t size) {
+    if(size > INT32_MAX) return false;
+    jit_guard_wide(jit, -24);
+    jit_guard_wide(jit, -8);
+    EMIT(0x48, 0x8B, 0x43, 0xF0);       // mov rax, [rbx-16]
+    EMIT(0x48, 0x69, 0xC0);             // imul rax, rax, size
+    jit_u32(jit, size);
+    EMIT(0x48, 0x03, 0x43, 0xE0);       // add rax, [rbx-32]
+    EMIT(0x48, 0x83, 0xEB, 0x10);       // sub rbx, 16
+    return true;
+}
+
+#define JIT_INT_FAMILY(name, op) \
+    case INST_##name: \
+    case INST_##name##_I64_Q: return jit_int_op(jit, op, INT_TYPE, INT_TYPE, true); \
+    case INST_##name##_I64: return jit_int_op(jit, op, NO_GUARD, INT_TYPE, true); \
+    case INST_##name##_U64_Q: return jit_int_op(jit, op, U64_TYPE, U64_TYPE, false); \
+    case INST_##name##_U64: return jit_int_op(jit, op, NO_GUARD, U64_TYPE, false);
+
+// emits the native fast path for the instruction at pc, false if it has none
+static bool jit_fast_path(Jit *jit, Machine *machine, uint8_t *pc) {
+    size_t next = pc - machine->code + 1 + operand_size[*pc];
+    switch((Inst_Set)*pc) {
+        case INST_NOP:
+            return true;
+        case INST_PUSH: {
+            if(pc[1] == REGISTER_TYPE) return false;
+            EMIT(0x48, 0xB8);               // mov rax, value
+            jit_u64(jit, code_read_word(pc + 2).as_u64);
+            jit_push_rax(jit, pc[1]);
+            return true;
+        }
+        case INST_POP:
+            // touches the slot so popping an empty stack faults in the guard page
+            EMIT(0x8B, 0x43, 0xF8);         // mov eax, [rbx-8]
+            EMIT(0x48, 0x83, 0xEB, 0x10);   // sub rbx, 16
+            return true;
+        case INST_DUP:
+            EMIT(0x48, 0x8D, 0x43, 0xF0);   // lea rax, [rbx-16]
+            jit_push_slot(jit);
+            return true;
+        case INST_SWAP:
+            EMIT(0x48, 0x8B, 0x43, 0xF0);   // mov rax, [rbx-16]
+            EMIT(0x48, 0x8B, 0x4B, 0xE0);   // mov rcx, [rbx-32]
+            EMIT(0x48, 0x89, 0x43, 0xE0);   // mov [rbx-32], rax
+            EMIT(0x48, 0x89, 0x4B, 0xF0);   // mov [rbx-16], rcx
+            EMIT(0x8B, 0x43, 0xF8);         // mov eax, [rbx-8]
+            EMIT(0x8B, 0x4B, 0xE8);         // mov ecx, [rbx-24]
+            EMIT(0x89, 0x43, 0xE8);         // mov [rbx-24], eax
+            EMIT(0x89, 0x4B, 0xF8);         // mov [rbx-8], ecx
+            return true;
+        // the _V forms were proven in range by machine_verify and skip the bounds checks
+        case INST_LOAD_LOCAL:
+        case INST_STORE_LOCAL:
+        case INST_LOAD_LOCAL_V:
+        case INST_STORE_LOCAL_V: {
+            int64_t disp = (int64_t)(int32_t)code_read_u32(pc + 1) * (int64_t)sizeof(Data);
+            if(disp < INT32_MIN || disp > INT32_MAX) return false;
+            EMIT(0x49, 0x8D, 0x85);         // lea rax, [r13+disp]
+            jit_u32(jit, disp);
+            if(*pc == INST_STORE_LOCAL || *pc == INST_STORE_LOCAL_V) {
+                jit_pop_slot(jit);
+                return true;
+            }
+            if(*pc == INST_LOAD_LOCAL_V) {
+                jit_push_slot(jit);
+                return true;
+            }
+            EMIT(0x48, 0x39, 0xD8);         // cmp rax, rbx
+            jit_slow_if(jit, JIT_JAE);
+            jit_stack_base(jit, 0x49, 0x3B, 0); // cmp rax, stack
+            jit_slow_if(jit, JIT_JB);
+            jit_push_slot(jit);
+            return true;
+        }
+        case INST_LOAD_GLOBAL:
+        case INST_STORE_GLOBAL:
+        case INST_LOAD_GLOBAL_V:
+        case INST_STORE_GLOBAL_V: {
+            uint32_t index = code_read_u32(pc + 1);
+            if(index == 0 || (uint64_t)(index - 1) * sizeof(Data) > INT32_MAX) return false;
+            jit_stack_base(jit, 0x49, 0x8B, 0); // mov rax, stack
+            EMIT(0x48, 0x05);               // add rax, (index-1)*16
+            jit_u32(jit, (index - 1) * sizeof(Data));
+            if(*pc == INST_STORE_GLOBAL || *pc == INST_STORE_GLOBAL_V) {
+                jit_pop_slot(jit);
+                return true;
+            }
+            if(*pc == INST_LOAD_GLOBAL_V) {
+                jit_push_slot(jit);
+                return true;
+            }
+            EMIT(0x48, 0x39, 0xD8);         // cmp rax, rbx
+            jit_slow_if(jit, JIT_JAE);
+            jit_push_slot(jit);
+            return true;
+        }
+        JIT_INT_FAMILY(ADD, JIT_ADD)
+        JIT_INT_FAMILY(SUB, JIT_SUB)
+        JIT_INT_FAMILY(MUL, JIT_MUL)
+        JIT_INT_FAMILY(DIV, JIT_DIV)
+        JIT_INT_FAMILY(CMPE, JIT_CMPE)
+        JIT_INT_FAMILY(CMPNE, JIT_CMPNE)
+        JIT_INT_FAMILY(CMPG, JIT_CMPG)
+        JIT_INT_FAMILY(CMPL, JIT_CMPL)
+        JIT_INT_FAMILY(CMPGE, JIT_CMPGE)
+        JIT_INT_FAMILY(CMPLE, JIT_CMPLE)
+        case INST_MOD:
+            return jit_int_op(jit, JIT_MOD, NO_GUARD, INT_TYPE, true);
+        case INST_PTR_ADD_IMM: {
+            uint32_t offset = code_read_u32(pc + 1);
+            if(offset > INT32_MAX) return false;
+            jit_guard_wide(jit, -8);
+            EMIT(0x48, 0x81, 0x43, 0xF0);   // add qword [rbx-16], offset
+            jit_u32(jit, offset);
+            EMIT(0xC7, 0x43, 0xF8);         // mov dword [rbx-8], PTR_TYPE
+            jit_u32(jit, PTR_TYPE);
+            return true;
+        }
+        case INST_INDEX_ADDR:
+            if(!jit_index_addr(jit, code_read_u32(pc + 1))) return false;
+            EMIT(0x48, 0x89, 0x43, 0xF0);   // mov [rbx-16], rax
+            EMIT(0xC7, 0x43, 0xF8);         // mov dword [rbx-8], PTR_TYPE
+            jit_u32(jit, PTR_TYPE);
+            return true;
+        case INST_INDEXED_LOAD:
+            if(pc[1] != 1 && pc[1] != 2 && pc[1] != 4 && pc[1] != 8) return false;
+            jit_index_addr(jit, pc[1]);
+            switch(pc[1]) {
+                case 1: EMIT(0x0F, 0xB6, 0x00); break;      // movzx eax, byte [rax]
+                case 2: EMIT(0x0F, 0xB7, 0x00); break;      // movzx eax, word [rax]
+                case 4: EMIT(0x8B, 0x00); break;            // mov eax, [rax]
+                case 8: EMIT(0x48, 0x8B, 0x00); break;      // mov rax, [rax]
+            }
+            EMIT(0x48, 0x89, 0x43, 0xF0);   // mov [rbx-16], rax
+            EMIT(0xC7, 0x43, 0xF8);         // mov dword [rbx-8], type
+            jit_u32(jit, pc[2]);
+            return true;
+        case INST_JMP:
+        case INST_LOOP:
+            EMIT(0xE9);
+            jit_jump_to_offset(jit, code_read_u32(pc + 1));
+            return true;
+        case INST_ZJMP:
+        case INST_NZJMP:
+            EMIT(0x48, 0x8B, 0x43, 0xF0);   // mov rax, [rbx-16]
+            EMIT(0x48, 0x83, 0xEB, 0x10);   // sub rbx, 16
+            EMIT(0x48, 0x85, 0xC0);         // test rax, rax
+            EMIT(0x0F, *pc == INST_ZJMP ? JIT_JE : JIT_JNE);
+            jit_jump_to_offset(jit, code_read_u32(pc + 1));
+            return true;
+        case INST_CALL:
+            jit_call_frame(jit, next);
+            EMIT(0xE9);
+            jit_jump_to_offset(jit, code_read_u32(pc + 1));
+            return true;
+        case INST_RET:
+            jit_ret_frame(jit);
+            EMIT(0x41, 0xFF, 0x24, 0xC7);   // jmp [r15 + rax*8]
+            return true;
+        case INST_NATIVE: {
+            uint32_t index = NATIVE_INDEX(code_read_u32(pc + 1));
+            if(index >= sizeof(machine->native_ptrs)/sizeof(*machine->native_ptrs)) return false;
+            // natives work on the Machine, so sp goes through stack_size around the call
+            EMIT(0x48, 0x89, 0xD8);         // mov rax, rbx
+            jit_stack_base(jit, 0x49, 0x2B, 0); // sub rax, stack
+            EMIT(0x48, 0xC1, 0xF8, 0x04);   // sar rax, 4
+            EMIT(0x41, 0x89, 0x84, 0x24);   // mov [r12+stack_size], eax
+            jit_u32(jit, offsetof(Machine, stack_size));
+            EMIT(0x4C, 0x89, 0xE7);         // mov rdi, r12
+            EMIT(0x41, 0xFF, 0x94, 0x24);   // call [r12+native_ptrs+index*8]
+            jit_u32(jit, offsetof(Machine, native_ptrs) + index*sizeof(native));
+            EMIT(0x49, 0x63, 0x84, 0x24);   // movsxd rax, [r12+stack_size]
+            jit_u32(jit, offsetof(Machine, stack_size));
+            EMIT(0x48, 0xC1, 0xE0, 0x04);   // shl rax, 4
+            jit_stack_base(jit, 0x49, 0x03, 0); // add rax, stack
+            EMIT(0x48, 0x89, 0xC3);         // mov rbx, rax
+            return true;
+        }
+        case INST_HALT:
+            EMIT(0xE9);
+            jit_patch(jit, jit_rel32(jit), jit->exit);
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void jit_compile_inst(Jit *jit, Machine *machine, size_t offset) {
+    uint8_t *pc = machine->code + offset;
+    size_t next = offset + 1 + operand_size[*pc];
+    jit->slow_count = 0;
+    size_t start = jit->buf.count;
+    if(!jit_fast_path(jit, machine, pc)) {
+        // a template can give up halfway, throw away whatever it emitted
+        jit->buf.count = start;
+        jit->slow_count = 0;
+        jit_fallback(jit, offset, next);
+        return;
+    }
+    if(jit->slow_count == 0) return;
+    EMIT(0xE9);                         // jmp over the slow path
+    size_t skip = jit_rel32(jit);
+    for(size_t i = 0; i < jit->slow_count; i++) jit_patch(jit, jit->slow[i], jit->buf.count);
+    jit_fallback(jit, offset, next);
+    jit_patch(jit, skip, jit->buf.count);
+}
+
+void jit_run_instructions(Machine *machine) {
+    if(machine->code == NULL) machine_load_code(machine);
+    if(machine_has_coroutines(machine)) {
+        run_instructions(machine);
+        return;
+    }
+	machine_load_native(machine, native_write);
+	machine_load_native(machine, native_exit);
+    machine_init_stacks(machine);
+    if(machine->code_size > INT32_MAX) TIM_ERROR("error: program is too large to jit\n");
+
+    Jit jit = {0};
+    jit.pos = malloc(sizeof(size_t)*machine->code_size);
+    ASSERT(jit.pos != NULL, "outta ram");
+    for(size_t i = 0; i < machine->code_size; i++) jit.pos[i] = NO_POS;
+    jit_stubs(&jit);
+    for(size_t offset = 0; offset < machine->code_size; offset += 1 + operand_size[machine->code[offset]]) {
+        jit.pos[offset] = jit.buf.count;
+        jit_compile_inst(&jit, machine, offset);
+    }
+    for(size_t i = 0; i < jit.fixups.count; i++) {
+        Jit_Fixup fixup = jit.fixups.data[i];
+        ASSERT(fixup.target < machine->code_size && jit.pos[fixup.target] != NO_POS, "jump into the middle of an instruction");
+        jit_patch(&jit, fixup.at, jit.pos[fixup.target]);
+    }
+
+    size_t size = jit.buf.count;
+    uint8_t *native_code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(native_code == MAP_FAILED) TIM_ERROR("error: could not map %zu bytes for the jit\n", size);
+    memcpy(native_code, jit.buf.data, size);
+    if(mprotect(native_code, size, PROT_READ | PROT_EXEC) != 0) TIM_ERROR("error: could not make the jit code executable\n");
+
+    void **table = malloc(sizeof(void*)*machine->code_size);
+    ASSERT(table != NULL, "outta ram");
+    for(size_t i = 0; i < machine->code_size; i++) {
+        table[i] = jit.pos[i] == NO_POS ? NULL : native_code + jit.pos[i];
+    }
+
+    Jit_Regs regs = {
+        .sp = machine->stack + machine->stack_size,
+        .fp = machine->stack + machine->frame_pointer,
+        .rs = machine->return_stack + machine->return_stack_size,
+    };
+    Jit_Entry entry;
+    *(void**)(&entry) = native_code;
+    entry(machine, &regs, table[machine->code_offsets[machine->entrypoint]], table);
+    machine->stack_size = regs.sp - machine->stack;
+    machine->frame_pointer = regs.fp - machine->stack;
+    machine->return_stack_size = regs.rs - machine->return_stack;
+
+    munmap(native_code, size);
+    free(table);
+    free(jit.pos);
+    free(jit.buf.data);
+    free(jit.fixups.data);
+}
+
+// a hot loop has its next iteration recorded one instruction at a time, starting and ending
+// at the loop header. the straight line trace is compiled with the same templates, but every
+// branch becomes a guard on the direction the recording took, generic ops are guarded on the
+// tags quickening saw during the recording, and anything leaving the recorded path exits
+// back into the interpreter at the right offset
+#define MAX_TRACE 1024
+
+typedef struct {
+    size_t offset;
+    size_t next;
+} Trace_Step;
+
+typedef struct {
+    Trace_Step *data;
+    size_t count;
+    size_t capacity;
+} Trace_Steps;
+
+typedef struct {
+    Jit_Entry entry;
+    uint8_t *code;
+    size_t size;
+    size_t start;
+} Trace;
+
+// runs one iteration from head in the interpreter, false if it left the loop some other way
+static bool trace_record(Machine *machine, size_t head, Trace_Steps *steps, size_t *resume) {
+    size_t offset = head;
+    size_t depth = 0;
+    for(;;) {
+        uint8_t *pc = machine->code + offset;
+        if(steps->count == MAX_TRACE || *pc == INST_HALT) break;
+        // nested loops get their own trace
+        if(*pc == INST_LOOP && code_read_u32(pc + 1) != head) break;
+        if(*pc == INST_RET && depth == 0) break;
+        if(*pc == INST_CALL) depth++;
+        if(*pc == INST_RET) depth--;
+        size_t next = run_code(machine, offset, true);
+        DA_APPEND(steps, ((Trace_Step){.offset = offset, .next = next}));
+        offset = next;
+        if(*pc == INST_LOOP) {
+            *resume = offset;
+            return true;
+        }
+    }
+    *resume = offset;
+    return false;
+}
+
+static void trace_exit_if(Jit *jit, Jit_Fixups *exits, uint8_t cc, size_t offset) {
+    EMIT(0x0F, cc);
+    DA_APPEND(exits, ((Jit_Fixup){.at = jit_rel32(jit), .target = offset}));
+}
+
+static Trace *trace_compile(Machine *machine, Trace_Steps steps) {
+    Jit state = {0};
+    Jit *jit = &state;
+    Jit_Fixups exits = {0};
+    jit_stubs(jit);
+    // there is no offset table in a trace, anything that went somewhere else just leaves
+    jit->dispatch = jit->exit;
+    size_t start = jit->buf.count;
+    for(size_t i = 0; i < steps.count; i++) {
+        Trace_Step step = steps.data[i];
+        uint8_t *pc = machine->code + step.offset;
+        size_t fallthrough = step.offset + 1 + operand_size[*pc];
+        switch(*pc) {
+            case INST_JMP:
+                break;
+            case INST_LOOP:
+                EMIT(0xE9);
+                jit_patch(jit, jit_rel32(jit), start);
+                break;
+            case INST_ZJMP:
+            case INST_NZJMP: {
+                size_t target = code_read_u32(pc + 1);
+                if(target == fallthrough) {
+                    EMIT(0x48, 0x83, 0xEB, 0x10);       // sub rbx, 16
+                    break;
+                }
+                EMIT(0x48, 0x8B, 0x43, 0xF0);           // mov rax, [rbx-16]
+                EMIT(0x48, 0x83, 0xEB, 0x10);           // sub rbx, 16
+                EMIT(0x48, 0x85, 0xC0);                 // test rax, rax
+                bool jumps_on_zero = *pc == INST_ZJMP;
+                if(step.next == target) trace_exit_if(jit, &exits, jumps_on_zero ? JIT_JNE : JIT_JE, fallthrough);
+                else trace_exit_if(jit, &exits, jumps_on_zero ? JIT_JE : JIT_JNE, target);
+            } break;
+            case INST_CALL:
+                jit_call_frame(jit, fallthrough);
+                break;
+            case INST_RET:
+                jit_ret_frame(jit);
+                EMIT(0x48, 0x3D);                       // cmp rax, recorded return
+                jit_u32(jit, step.next);
+                EMIT(0x0F, JIT_JNE);                    // jne exit, rax is where it returned to
+                jit_patch(jit, jit_rel32(jit), jit->exit);
+                break;
+            default:
+                jit_compile_inst(jit, machine, step.offset);
+                break;
+        }
+    }
+    for(size_t i = 0; i < exits.count; i++) {
+        jit_patch(jit, exits.data[i].at, jit->buf.count);
+        EMIT(0xB8);                                     // mov eax, offset
+        jit_u32(jit, exits.data[i].target);
+        EMIT(0xE9);                                     // jmp exit
+        jit_patch(jit, jit_rel32(jit), jit->exit);
+    }
+
+    Trace *trace = malloc(sizeof(Trace));
+    ASSERT(trace != NULL, "outta ram");
+    trace->size = jit->buf.count;
+    trace->start = start;
+    trace->code = mmap(NULL, trace->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(trace->code == MAP_FAILED) TIM_ERROR("error: could not map %zu bytes for a trace\n", trace->size);
+    memcpy(trace->code, jit->buf.data, trace->size);
+    if(mprotect(trace->code, trace->size, PROT_READ | PROT_EXEC) != 0) TIM_ERROR("error: could not make a trace executable\n");
+    *(void**)(&trace->entry) = trace->code;
+    free(jit->buf.data);
+    free(jit->fixups.data);
+    free(exits.data);
+    return trace;
+}
+
+static size_t trace_loop_hook(Machine *machine, uint32_t index, size_t target) {
+    Loop_State *loop = &machine->loops[index];
+    if(loop->trace == NULL) {
+        Trace_Steps steps = {0};
+        size_t resume = target;
+        bool recorded = trace_record(machine, target, &steps, &resume);
+        if(recorded) loop->trace = trace_compile(machine, steps);
+        free(steps.data);
+        // a loop that could not be recorded stays interpreted, its count is past HOT_LOOP now
+        if(!recorded) return resume;
+    }
+    Trace *trace = loop->trace;
+    Jit_Regs regs = {
+        .sp = machine->stack + machine->stack_size,
+        .fp = machine->stack + machine->frame_pointer,
+        .rs = machine->return_stack + machine->return_stack_size,
+    };
+    size_t offset = trace->entry(machine, &regs, trace->code + trace->start, NULL);
+    machine->stack_size = regs.sp - machine->stack;
+    machine->frame_pointer = regs.fp - machine->stack;
+    machine->return_stack_size = regs.rs - machine->return_stack;
+    return offset;
+}
+
+void trace_run_instructions(Machine *machine) {
+    if(machine->code == NULL) machine_load_code(machine);
+    // a trace keeps the stack it started on, so coroutines stay interpreted
+    if(!machine_has_coroutines(machine)) machine->loop_hook = trace_loop_hook;
+    run_instructions(machine);
+    for(size_t i = 0; i < machine->loops_count; i++) {
+        Trace *trace = machine->loops[i].trace;
+        if(trace == NULL) continue;
+        munmap(trace->code, trace->size);
+        free(trace);
+        machine->loops[i].trace = NULL;
+    }
+}
+
+#undef EMIT
+#undef NO_POS
+#undef NO_GUARD
+#undef JIT_INT_FAMILY
+
+#else
+
+// no code generator for this target, the interpreter is the jit
+void jit_run_instructions(Machine *machine) {
+    run_instructions(machine);
+}
+
+void trace_run_instructions(Machine *machine) {
+    run_instructions(machine);
+}
+
+#endif // __x86_64__
+
+#endif // JIT_IMPLEMENTATION
@@ -0,0 +1,139 @@
+#define ARENA_IMPLEMENTATION
+#define TIM_IMPLEMENTATION
+#include "tim.h"
+
+#include "libtim.h"
+
+_Static_assert(TIM_CONTEXT_ARGS == MACHINE_ARGS, "libtim.h and tim.h disagree on the argument count");
+
+struct Tim_Program {
+    // loaded, verified and never run, contexts copy everything but the per run state from it
+    Machine machine;
+    size_t contexts;
+};
+
+struct Tim_Context {
+    Tim_Program *program;
+    Machine machine;
+    bool ran;
+    int exit_code;
+};
+
+static _Thread_local char last_error[256];
+
+void *custom_realloc(void *ptr, size_t size) {
+    void *new_ptr = realloc(ptr, size);
+    ASSERT(new_ptr != NULL, "Out of memory, maybe close some programs? Alternatively you could buy some more RAM.");
+    return new_ptr;
+}
+
+static void set_error(const char *message) {
+    snprintf(last_error, sizeof(last_error), "%s", message);
+    // TIM_ERROR messages end in a newline for stderr
+    size_t len = strlen(last_error);
+    if(len > 0 && last_error[len - 1] == '\n') last_error[len - 1] = '\0';
+}
+
+const char *tim_last_error(void) {
+    return last_error;
+}
+
+Tim_Program *tim_program_load(const char *path) {
+    Tim_Program *program = calloc(1, sizeof(Tim_Program));
+    if(program == NULL) {
+        set_error("error: out of memory");
+        return NULL;
+    }
+    Tim_Trap trap = {0};
+    Tim_Trap *prev = tim_trap;
+    tim_trap = &trap;
+    if(sigsetjmp(trap.jump, 1) != 0) {
+        tim_trap = prev;
+        set_error(trap.message);
+        machine_free(&program->machine);
+        free(program);
+        return NULL;
+    }
+    read_program_from_file(&program->machine, (char*)path);
+    machine_load_native(&program->machine, native_write);
+    machine_load_native(&program->machine, native_exit);
+    if(program->machine.code == NULL) machine_load_code(&program->machine);
+    machine_verify(&program->machine);
+    tim_trap = prev;
+    return program;
+}
+
+void tim_program_free(Tim_Program *program) {
+    if(program == NULL) return;
+    ASSERT(__atomic_load_n(&program->contexts, __ATOMIC_RELAXED) == 0, "a program cannot be freed while it still has contexts");
+    machine_free(&program->machine);
+    free(program);
+}
+
+Tim_Context *tim_context_new(Tim_Program *program, size_t stack_entries) {
+    Tim_Context *context = calloc(1, sizeof(Tim_Context));
+    if(context == NULL) {
+        set_error("error: out of memory");
+        return NULL;
+    }
+    context->program = program;
+    machine_share(&context->machine, &program->machine, stack_entries);
+    // contexts can be made and freed on different threads
+    __atomic_add_fetch(&program->contexts, 1, __ATOMIC_RELAXED);
+    return context;
+}
+
+void tim_context_free(Tim_Context *context) {
+    if(context == NULL) return;
+    machine_free_shared(&context->machine);
+    __atomic_sub_fetch(&context->program->contexts, 1, __ATOMIC_RELAXED);
+    free(context);
+}
+
+void tim_context_reset(Tim_Context *context) {
+    machine_reset(&context->machine);
+    // natives the last run loaded with load_library are loaded again by the next one
+    context->machine.native_ptrs_s = context->program->machine.native_ptrs_s;
+    context->ran = false;
+    context->exit_code = 0;
+}
+
+int tim_context_set_ptr(Tim_Context *context, size_t index, void *value) {
+    if(index >= MACHINE_ARGS) return -1;
+    context->machine.args[index] = (Data){.word.as_pointer = value, .type = PTR_TYPE};
+    return 0;
+}
+
+int tim_context_set_int(Tim_Context *context, size_t index, int64_t value) {
+    if(index >= MACHINE_ARGS) return -1;
+    context->machine.args[index] = (Data){.word.as_int = value, .type = INT_TYPE};
+    return 0;
+}
+
+Tim_Status tim_context_run(Tim_Context *context) {
+    if(context->ran) tim_context_reset(context);
+    context->ran = true;
+    Machine *machine = &context->machine;
+    Tim_Trap trap = {0};
+    Tim_Trap *prev = tim_trap;
+    tim_trap = &trap;
+    int trapped = sigsetjmp(trap.jump, 1);
+    if(trapped == 0) {
+        machine_init_stacks(machine);
+        run_code(machine, machine->code_offsets[machine->entrypoint], false);
+    }
+    tim_trap = prev;
+    if(trapped == TIM_TRAP_EXIT) {
+        context->exit_code = trap.exit_code;
+        return TIM_EXIT;
+    }
+    if(trapped == TIM_TRAP_ERROR) {
+        set_error(trap.message);
+        return TIM_FAILED;
+    }
+    return TIM_OK;
+}
+
+int tim_context_exit_code(const Tim_Context *context) {
+    return context->exit_code;
+}
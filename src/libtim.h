@@ -0,0 +1,57 @@
+#ifndef LIBTIM_H
+#define LIBTIM_H
+
+// embedding api for running compiled .tim programs inside another process, built into
+// build/libtim.a and build/libtim.so by `make libtim`
+//
+// a program is loaded and verified once and is never written to again. every context
+// running it shares its code and gets its own stacks, heap and arenas, so one program can
+// back any number of contexts on any number of threads. tim_context_reset drops a context's heap and arenas but keeps its stacks
+// mapped, which makes running the same context again much cheaper than a new one.
+// errors inside a program and its calls to exit come back as a Tim_Status instead of
+// ending the process
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TIM_API
+#define TIM_API __attribute__((visibility("default")))
+#endif
+
+// arguments a program reads with `arg n` or `arg_int n`
+#define TIM_CONTEXT_ARGS 8
+
+typedef struct Tim_Program Tim_Program;
+typedef struct Tim_Context Tim_Context;
+
+typedef enum {
+    TIM_OK,
+    // the program called exit, see tim_context_exit_code
+    TIM_EXIT,
+    // the program failed, see tim_last_error
+    TIM_FAILED,
+} Tim_Status;
+
+// returns NULL and sets tim_last_error when the file is not a valid program
+TIM_API Tim_Program *tim_program_load(const char *path);
+// every context of the program has to be freed first
+TIM_API void tim_program_free(Tim_Program *program);
+
+// stack_entries is the size of the data and return stacks, 0 for the default
+TIM_API Tim_Context *tim_context_new(Tim_Program *program, size_t stack_entries);
+TIM_API void tim_context_free(Tim_Context *context);
+// frees everything the last run allocated, the arguments stay set
+TIM_API void tim_context_reset(Tim_Context *context);
+
+// both return -1 when index is not below TIM_CONTEXT_ARGS
+TIM_API int tim_context_set_ptr(Tim_Context *context, size_t index, void *value);
+TIM_API int tim_context_set_int(Tim_Context *context, size_t index, int64_t value);
+
+// runs the program from its entrypoint, a context that already ran is reset first
+TIM_API Tim_Status tim_context_run(Tim_Context *context);
+TIM_API int tim_context_exit_code(const Tim_Context *context);
+
+// message of the last failure on the calling thread
+TIM_API const char *tim_last_error(void);
+
+#endif // LIBTIM_H
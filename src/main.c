@@ -5,9 +5,28 @@
 #define TIM_H
 #include "tim.h"
 
+#define JIT_IMPLEMENTATION
+#include "jit.h"
+
+#define CC_IMPLEMENTATION
+#include "cc.h"
+
+#define PROF_IMPLEMENTATION
+#include "prof.h"
+
+#define BATCH_IMPLEMENTATION
+#include "batch.h"
+
 void usage(char *file) {
-    fprintf(stderr, "usage: %s <option> <filename.cano>\n", file);
-	fprintf(stderr, "options: com, run\n");
+    fprintf(stderr, "usage: %s [--stack-size <entries>] [--count] [--jobs <n>] <option> <filename.cano>\n", file);
+	fprintf(stderr, "options: com, pack, run, jit, trace, prof, sample, batch (all of these also run a compiled .tim file), cc, db, dis\n");
+	fprintf(stderr, "pack: like com, but writes the smaller packed encoding\n");
+	fprintf(stderr, "prof: run and report the time per instruction and function, also written to <filename>.prof.json\n");
+	fprintf(stderr, "sample: run and report samples per source line, folded stacks are written to <filename>.folded\n");
+	fprintf(stderr, "batch: %s batch <filename> <inputs...>, run the program once per input on every core\n", file);
+	fprintf(stderr, "--stack-size: entries in the data and return stacks, default %d\n", DEFAULT_STACK_SIZE);
+	fprintf(stderr, "--count: with run, print the number of instructions executed to stderr\n");
+	fprintf(stderr, "--jobs: with batch, the number of threads, default one per core\n");
 	fprintf(stderr, "show this menu: --help\n");
     exit(1);
 }
@@ -33,12 +52,48 @@ void free_state(Program_State *state) {
 	free(state->scope_stack.data);
 	free(state->block_stack.data);
 	free(state->ret_stack.data);
+	free(state->frame_stack.data);
 	free(state->while_labels.data);
+	free(state->var_tags.data);
+	free(state->elem_tags.data);
+	free(state->ret_tags.data);
+	free(state->escapes.data);
+	free(state->writes.data);
+	free(state->shared.data);
+	free(state->locals.data);
+	free(state->region_stack.data);
+	free(state->func_regions.data);
 }
 	
 int main(int argc, char **argv) {
+	// errors and exit end up here, a fault the stack guards catch included
+	static Tim_Trap trap = {0};
+	int trapped = sigsetjmp(trap.jump, 1);
+	if(trapped != 0) tim_trap_exit(&trap, trapped);
+	tim_trap = &trap;
 	char *file = shift(&argc, &argv);
 	char *flag = shift(&argc, &argv);
+	size_t stack_size = 0;
+	if(flag != NULL && strcmp(flag, "--stack-size") == 0) {
+		char *size = shift(&argc, &argv);
+		if(size == NULL) usage(file);
+		stack_size = strtoull(size, NULL, 10);
+		if(stack_size == 0) usage(file);
+		flag = shift(&argc, &argv);
+	}
+	bool count = false;
+	if(flag != NULL && strcmp(flag, "--count") == 0) {
+		count = true;
+		flag = shift(&argc, &argv);
+	}
+	size_t jobs = 0;
+	if(flag != NULL && strcmp(flag, "--jobs") == 0) {
+		char *value = shift(&argc, &argv);
+		if(value == NULL) usage(file);
+		jobs = strtoull(value, NULL, 10);
+		if(jobs == 0) usage(file);
+		flag = shift(&argc, &argv);
+	}
 	char *filename = NULL;
 	if(flag == NULL) usage(file);
     int compile = 0;
@@ -54,6 +109,27 @@ int main(int argc, char **argv) {
     } else if(strncmp(flag, "dis", 3) == 0) {
         compile = 3;
 		filename = shift(&argc, &argv);		        
+    } else if(strncmp(flag, "jit", 3) == 0) {
+        compile = 4;
+		filename = shift(&argc, &argv);		
+    } else if(strncmp(flag, "prof", 4) == 0) {
+        compile = 8;
+		filename = shift(&argc, &argv);		
+    } else if(strncmp(flag, "sample", 6) == 0) {
+        compile = 9;
+		filename = shift(&argc, &argv);		
+    } else if(strncmp(flag, "batch", 5) == 0) {
+        compile = 10;
+		filename = shift(&argc, &argv);		
+    } else if(strncmp(flag, "pack", 4) == 0) {
+        compile = 7;
+		filename = shift(&argc, &argv);		
+    } else if(strncmp(flag, "trace", 5) == 0) {
+        compile = 6;
+		filename = shift(&argc, &argv);		
+    } else if(strncmp(flag, "cc", 2) == 0) {
+        compile = 5;
+		filename = shift(&argc, &argv);		
     } else if(strncmp(flag, "--help", 6) == 0) {
 		usage(file);
 	} else {
@@ -61,38 +137,83 @@ int main(int argc, char **argv) {
 		filename = flag;
 	}
 	if(filename == NULL) usage(file);
+	// batch takes the inputs that follow the program
+	size_t inputs_count = 0;
+	while(compile == 10 && argv[inputs_count] != NULL) inputs_count++;
+	if(compile == 10 && inputs_count == 0) usage(file);
+	size_t failed = 0;
+
+	// already compiled programs skip the frontend entirely
+	size_t filename_s = strlen(filename);
+	bool runs = compile == 0 || compile == 4 || compile == 5 || compile == 6 || compile == 8 || compile == 9 || compile == 10;
+	if(runs && filename_s > 4 && strcmp(filename + filename_s - 4, ".tim") == 0) {
+		Machine machine = {0};
+		machine.stack_capacity = stack_size;
+		read_program_from_file(&machine, filename);
+		machine.counting = count && compile == 0;
+		if(compile == 4) jit_run_instructions(&machine);
+		else if(compile == 5) cc_compile_program(&machine, filename);
+		else if(compile == 6) trace_run_instructions(&machine);
+		else if(compile == 10) failed = batch_run_instructions(&machine, argv, inputs_count, jobs);
+		else if(compile == 8) {
+			char *json_path = append_ext(filename, "prof.json");
+			prof_run_instructions(&machine, NULL, json_path);
+			free(json_path);
+		} else if(compile == 9) {
+			char *folded_path = append_ext(filename, "folded");
+			prof_sample_instructions(&machine, NULL, folded_path);
+			free(folded_path);
+		}
+		else run_instructions(&machine);
+		if(machine.counting) fprintf(stderr, "instructions: %" PRIu64 "\n", machine.executed);
+		machine_free(&machine);
+		return failed > 0;
+	}
 	
-	Arena token_arena = arena_init(sizeof(Token)*ARENA_INIT_SIZE);	
-    String_View view = read_file_to_view(&token_arena, filename);
-	Arena string_arena = arena_init(sizeof(char)*ARENA_INIT_SIZE);
-    Token_Arr tokens = lex(&token_arena, &string_arena, filename, view);
-    Blocks block_stack = {0};
-	Arena node_arena = arena_init(sizeof(Node)*ARENA_INIT_SIZE);
-    Program program = parse(&node_arena, tokens, &block_stack);
-	
-	arena_free(&token_arena);	
-	
+	Compiler compiler = {0};
     Program_State state = {0};
-	state.program = program;
-    state.structs = program.structs;
-	state.symbols = program.symbols;
-    generate(&state, &program);
+	state.machine.stack_capacity = stack_size;
+	if(!compile_file(&compiler, &state, filename)) {
+		fprintf(stderr, "%s", compiler.trap.message);
+		return 1;
+	}
 	
-	state.machine.program_size = state.machine.instructions.count;
-	if(compile == 1) {
+	if(compile == 1 || compile == 7) {
 		char *output_file = append_ext(filename, "tim");	
 		printf("Compiling %s...\n", output_file);
-		write_program_to_file(&state.machine, output_file);		
+		if(compile == 7) write_packed_program_to_file(&state.machine, output_file);
+		else write_program_to_file(&state.machine, output_file);		
 	} else if(compile == 3) {
         machine_disasm(&state.machine);        
     } else if(compile == 0) {
+		state.machine.counting = count;
 		run_instructions(&state.machine);
+		if(count) fprintf(stderr, "instructions: %" PRIu64 "\n", state.machine.executed);
+	} else if(compile == 4) {
+		jit_run_instructions(&state.machine);
+	} else if(compile == 5) {
+		cc_compile_program(&state.machine, filename);
+	} else if(compile == 6) {
+		trace_run_instructions(&state.machine);
+	} else if(compile == 10) {
+		failed = batch_run_instructions(&state.machine, argv, inputs_count, jobs);
+	} else if(compile == 8 || compile == 9) {
+		Prof_Names names = {0};
+		for(size_t i = 0; i < state.functions.count; i++) {
+			Function function = state.functions.data[i];
+			DA_APPEND(&names, ((Prof_Name){.label = function.label, .name = function.name}));
+		}
+		char *path = append_ext(filename, compile == 8 ? "prof.json" : "folded");
+		if(compile == 8) prof_run_instructions(&state.machine, &names, path);
+		else prof_sample_instructions(&state.machine, &names, path);
+		free(path);
+		free(names.data);
 	} else {
         machine_debug(&state.machine);
     }
 	
-	arena_free(&node_arena);
-	arena_free(&string_arena);
+	compiler_free(&compiler);
 	free_state(&state);
 	machine_free(&state.machine);
+	return failed > 0;
 }
@@ -5,4 +5,10 @@
 #define DEFS_H
 #include "backend.h"
 
+// lexes, parses and generates filename into state->machine. everything it allocates
+// belongs to compiler or state, so threads can each compile their own file. an error
+// returns false with the message in compiler->trap.message instead of ending the process,
+// compiler_free and free_state are needed either way
+bool compile_file(Compiler *compiler, Program_State *state, char *filename);
+
 #endif // MAIN_H
\ No newline at end of file
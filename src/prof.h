@@ -0,0 +1,303 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <sys/time.h>
+
+// expects tim.h to be included first, PROF_IMPLEMENTATION also needs TIM_IMPLEMENTATION
+
+// name of the function whose first instruction is at index label, from gen_func_label
+typedef struct {
+    size_t label;
+    String_View name;
+} Prof_Name;
+
+typedef struct {
+    Prof_Name *data;
+    size_t count;
+    size_t capacity;
+} Prof_Names;
+
+// runs the program with every instruction timed, then prints the opcodes and functions
+// sorted by time to stderr and writes the same numbers as JSON to json_path.
+// functions without a name are reported by the index of their first instruction
+void prof_run_instructions(Machine *machine, Prof_Names *names, char *json_path);
+
+// runs the program with a SIGPROF timer taking the current instruction and the call sites
+// above it every PROF_SAMPLE_USEC of cpu time, then prints the source lines sorted by
+// samples to stderr and writes the stacks to folded_path in the folded flame graph format
+void prof_sample_instructions(Machine *machine, Prof_Names *names, char *folded_path);
+
+#endif // PROF_H
+
+#ifdef PROF_IMPLEMENTATION
+
+static Profile *prof_sorting;
+
+static int prof_compare_ops(const void *a, const void *b) {
+    uint64_t x = prof_sorting->ticks[*(const uint8_t*)a];
+    uint64_t y = prof_sorting->ticks[*(const uint8_t*)b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int prof_compare_functions(const void *a, const void *b) {
+    uint64_t x = prof_sorting->functions.data[*(const size_t*)a].self;
+    uint64_t y = prof_sorting->functions.data[*(const size_t*)b].self;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void prof_function_name(Machine *machine, Prof_Names *names, size_t entry, size_t function, char *buffer, size_t size) {
+    if(function == 0) {
+        snprintf(buffer, size, "<top>");
+        return;
+    }
+    size_t index = code_offset_to_index(machine, entry);
+    for(size_t i = 0; names != NULL && i < names->count; i++) {
+        if(names->data[i].label == index) {
+            snprintf(buffer, size, "%.*s", (int)names->data[i].name.len, names->data[i].name.data);
+            return;
+        }
+    }
+    snprintf(buffer, size, "fn@%zu", index);
+}
+
+static void prof_report(Machine *machine, Profile *profile, Prof_Names *names, char *json_path) {
+    uint64_t total = 0;
+    uint8_t ops[INST_COUNT];
+    size_t op_count = 0;
+    for(size_t op = 0; op < INST_COUNT; op++) {
+        total += profile->ticks[op];
+        if(profile->counts[op] > 0) ops[op_count++] = op;
+    }
+    size_t *functions = malloc(sizeof(size_t)*(profile->functions.count + 1));
+    ASSERT(functions != NULL, "outta ram");
+    for(size_t i = 0; i < profile->functions.count; i++) functions[i] = i;
+    prof_sorting = profile;
+    qsort(ops, op_count, sizeof(*ops), prof_compare_ops);
+    qsort(functions, profile->functions.count, sizeof(*functions), prof_compare_functions);
+    double percent = total == 0 ? 0 : 100.0/total;
+
+    fprintf(stderr, "%-20s %14s %16s %7s %10s\n", "instruction", "count", "ticks", "%", "ticks/op");
+    for(size_t i = 0; i < op_count; i++) {
+        uint8_t op = ops[i];
+        fprintf(stderr, "%-20s %14" PRIu64 " %16" PRIu64 " %6.2f%% %10.1f\n", instructions[op], profile->counts[op],
+                profile->ticks[op], profile->ticks[op]*percent, (double)profile->ticks[op]/profile->counts[op]);
+    }
+    fprintf(stderr, "\n%-20s %14s %16s %7s %16s %7s\n", "function", "calls", "self", "%", "total", "%");
+    char name[128];
+    for(size_t i = 0; i < profile->functions.count; i++) {
+        Profile_Function *fn = &profile->functions.data[functions[i]];
+        prof_function_name(machine, names, fn->entry, functions[i], name, sizeof(name));
+        fprintf(stderr, "%-20s %14" PRIu64 " %16" PRIu64 " %6.2f%% %16" PRIu64 " %6.2f%%\n", name, fn->calls,
+                fn->self, fn->self*percent, fn->total, fn->total*percent);
+    }
+
+    FILE *file = fopen(json_path, "w");
+    if(file == NULL) TIM_ERROR("error: could not write to %s\n", json_path);
+#if defined(__x86_64__)
+    fprintf(file, "{\n  \"unit\": \"cycles\",\n");
+#else
+    fprintf(file, "{\n  \"unit\": \"ns\",\n");
+#endif
+    fprintf(file, "  \"total\": %" PRIu64 ",\n  \"instructions\": [\n", total);
+    for(size_t i = 0; i < op_count; i++) {
+        uint8_t op = ops[i];
+        fprintf(file, "    {\"name\": \"%s\", \"count\": %" PRIu64 ", \"ticks\": %" PRIu64 "}%s\n", instructions[op],
+                profile->counts[op], profile->ticks[op], i + 1 < op_count ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"functions\": [\n");
+    for(size_t i = 0; i < profile->functions.count; i++) {
+        Profile_Function *fn = &profile->functions.data[functions[i]];
+        prof_function_name(machine, names, fn->entry, functions[i], name, sizeof(name));
+        fprintf(file, "    {\"name\": \"");
+        // names come from the source, keep the JSON valid whatever they hold
+        for(char *c = name; *c != '\0'; c++) {
+            if(*c == '"' || *c == '\\') fputc('\\', file);
+            if((unsigned char)*c >= 0x20) fputc(*c, file);
+        }
+        fprintf(file, "\", \"calls\": %" PRIu64 ", \"self\": %" PRIu64 ", \"total\": %" PRIu64 "}%s\n",
+                fn->calls, fn->self, fn->total, i + 1 < profile->functions.count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    fprintf(stderr, "\nprofile written to %s\n", json_path);
+    free(functions);
+}
+
+#define PROF_SAMPLE_USEC 1000
+// frames kept per sample, deeper stacks lose their outermost callers
+#define PROF_SAMPLE_DEPTH 64
+// u32 words preallocated for samples, the handler can't allocate so samples past it are dropped
+#define PROF_SAMPLE_WORDS (1 << 22)
+
+// each sample is its frame count followed by the byte offsets of the frames, outermost first,
+// the call sites from the return stack and then the instruction that was running
+typedef struct {
+    Machine *machine;
+    uint32_t *data;
+    size_t count;
+    size_t dropped;
+} Prof_Samples;
+
+static Prof_Samples prof_samples;
+
+static void prof_sample_handler(int sig) {
+    (void)sig;
+    Machine *machine = prof_samples.machine;
+    uint64_t sample = machine->sample;
+    int rs = sample >> 32;
+    size_t depth = rs + 1 > PROF_SAMPLE_DEPTH ? PROF_SAMPLE_DEPTH : rs + 1;
+    if(prof_samples.count + depth + 1 > PROF_SAMPLE_WORDS) {
+        prof_samples.dropped++;
+        return;
+    }
+    uint32_t *out = prof_samples.data + prof_samples.count;
+    *out++ = depth;
+    // ret points past the call, a call is the opcode and a u32 target
+    for(int i = rs - (int)depth + 1; i < rs; i++) *out++ = machine->return_stack[i].ret - 5;
+    *out++ = (uint32_t)sample;
+    prof_samples.count = out - prof_samples.data;
+}
+
+typedef struct {
+    String_View file;
+    size_t line;
+    size_t function;
+    uint64_t samples;
+} Prof_Line;
+
+typedef struct {
+    Prof_Line *data;
+    size_t count;
+    size_t capacity;
+} Prof_Lines;
+
+static int prof_compare_lines(const void *a, const void *b) {
+    uint64_t x = ((const Prof_Line*)a)->samples;
+    uint64_t y = ((const Prof_Line*)b)->samples;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int prof_compare_stacks(const void *a, const void *b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// appends "function (file:line)" for the instruction at offset to the stack being built
+static void prof_frame(Machine *machine, Prof_Names *names, size_t function, size_t offset, Dynamic_Str *out) {
+    char frame[256];
+    prof_function_name(machine, names, function, function, frame, sizeof(frame));
+    String_View file;
+    size_t line;
+    size_t length = strlen(frame);
+    if(line_table_find(&machine->lines, code_offset_to_index(machine, offset), &file, &line)) {
+        snprintf(frame + length, sizeof(frame) - length, " ("View_Print":%zu)", View_Arg(file), line);
+    }
+    // ; separates frames and the count follows the last space
+    for(char *c = frame; *c != '\0'; c++) DA_APPEND(out, *c == ';' ? ':' : *c);
+}
+
+static void prof_sample_report(Machine *machine, Prof_Names *names, char *folded_path) {
+    Prof_Lines lines = {0};
+    size_t total = 0;
+    for(size_t i = 0; i < prof_samples.count; i += prof_samples.data[i] + 1) total++;
+    char **stacks = malloc(sizeof(char*)*(total + 1));
+    ASSERT(stacks != NULL, "outta ram");
+
+    size_t sample = 0;
+    for(size_t i = 0; i < prof_samples.count; i += prof_samples.data[i] + 1) {
+        uint32_t depth = prof_samples.data[i];
+        uint32_t *frames = prof_samples.data + i + 1;
+        Dynamic_Str stack = {0};
+        // the outermost frame is taken as the top level, which is only wrong for cut stacks
+        size_t function = 0;
+        for(uint32_t j = 0; j < depth; j++) {
+            if(j > 0) {
+                DA_APPEND(&stack, ';');
+                function = code_read_u32(machine->code + frames[j - 1] + 1);
+            }
+            prof_frame(machine, names, function, frames[j], &stack);
+        }
+        DA_APPEND(&stack, '\0');
+        stacks[sample++] = stack.data;
+
+        String_View file = {0};
+        size_t line = 0;
+        line_table_find(&machine->lines, code_offset_to_index(machine, frames[depth - 1]), &file, &line);
+        size_t j = 0;
+        while(j < lines.count && !(lines.data[j].line == line && view_cmp(lines.data[j].file, file))) j++;
+        if(j == lines.count) DA_APPEND(&lines, ((Prof_Line){.file = file, .line = line, .function = function}));
+        lines.data[j].samples++;
+    }
+
+    qsort(lines.data, lines.count, sizeof(*lines.data), prof_compare_lines);
+    double percent = total == 0 ? 0 : 100.0/total;
+    fprintf(stderr, "%-32s %-20s %10s %7s\n", "line", "function", "samples", "%");
+    char location[256];
+    char name[128];
+    for(size_t i = 0; i < lines.count; i++) {
+        Prof_Line *line = &lines.data[i];
+        if(line->file.data == NULL) snprintf(location, sizeof(location), "<unknown>");
+        else snprintf(location, sizeof(location), View_Print":%zu", View_Arg(line->file), line->line);
+        prof_function_name(machine, names, line->function, line->function, name, sizeof(name));
+        fprintf(stderr, "%-32s %-20s %10" PRIu64 " %6.2f%%\n", location, name, line->samples, line->samples*percent);
+    }
+    fprintf(stderr, "\n%zu samples every %dus of cpu time", total, PROF_SAMPLE_USEC);
+    if(prof_samples.dropped > 0) fprintf(stderr, ", %zu dropped", prof_samples.dropped);
+    fprintf(stderr, "\n");
+
+    FILE *file = fopen(folded_path, "w");
+    if(file == NULL) TIM_ERROR("error: could not write to %s\n", folded_path);
+    qsort(stacks, total, sizeof(*stacks), prof_compare_stacks);
+    for(size_t i = 0; i < total;) {
+        size_t j = i;
+        while(j < total && strcmp(stacks[i], stacks[j]) == 0) j++;
+        fprintf(file, "%s %zu\n", stacks[i], j - i);
+        i = j;
+    }
+    fclose(file);
+    fprintf(stderr, "folded stacks written to %s\n", folded_path);
+    for(size_t i = 0; i < total; i++) free(stacks[i]);
+    free(stacks);
+    free(lines.data);
+}
+
+void prof_sample_instructions(Machine *machine, Prof_Names *names, char *folded_path) {
+    prof_samples = (Prof_Samples){.machine = machine};
+    prof_samples.data = malloc(sizeof(uint32_t)*PROF_SAMPLE_WORDS);
+    ASSERT(prof_samples.data != NULL, "outta ram");
+    machine->sampling = true;
+    machine->sample = 0;
+
+    struct sigaction action = {0};
+    struct sigaction old_action;
+    action.sa_handler = prof_sample_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGPROF, &action, &old_action) != 0) TIM_ERROR("error: could not install the SIGPROF handler\n");
+    struct itimerval timer = {
+        .it_interval = {.tv_sec = 0, .tv_usec = PROF_SAMPLE_USEC},
+        .it_value = {.tv_sec = 0, .tv_usec = PROF_SAMPLE_USEC},
+    };
+    struct itimerval stop = {0};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    run_instructions(machine);
+    setitimer(ITIMER_PROF, &stop, NULL);
+    sigaction(SIGPROF, &old_action, NULL);
+    machine->sampling = false;
+
+    prof_sample_report(machine, names, folded_path);
+    free(prof_samples.data);
+    prof_samples = (Prof_Samples){0};
+}
+
+void prof_run_instructions(Machine *machine, Prof_Names *names, char *json_path) {
+    Profile profile = {0};
+    machine->profile = &profile;
+    run_instructions(machine);
+    profile_finish(&profile);
+    machine->profile = NULL;
+    prof_report(machine, &profile, names, json_path);
+    free(profile.functions.data);
+    free(profile.frames.data);
+}
+
+#endif // PROF_IMPLEMENTATION
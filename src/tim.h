@@ -13,12 +13,27 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <dlfcn.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "defs.h"
 
-#define MAX_STACK_SIZE 1024
+// entries in the data and return stacks unless Machine.stack_capacity says otherwise
+#define DEFAULT_STACK_SIZE (1024*1024)
+// entries each stack of a coroutine starts with, running past them grows it up to
+// Machine.stack_capacity entries
+#define COROUTINE_STACK_SIZE 256
 #define DATA_START_CAPACITY 16
 
+// the threaded engine needs labels as values, build with -DTIM_NO_THREADED
+// to get the portable switch loop instead
+#if defined(__GNUC__) && !defined(TIM_NO_THREADED)
+#define TIM_THREADED
+#endif
+
 typedef enum {
     INST_NOP = 0,
     INST_PUSH,
@@ -72,6 +87,157 @@ typedef enum {
 	INST_LOAD_LIBRARY,
     INST_SS,
     INST_HALT,
+    // typed arithmetic, the backend only emits these when both operand tags are known
+    INST_ADD_I64,
+    INST_ADD_U8,
+    INST_ADD_U16,
+    INST_ADD_U32,
+    INST_ADD_U64,
+    INST_ADD_F32,
+    INST_ADD_F64,
+    INST_SUB_I64,
+    INST_SUB_U8,
+    INST_SUB_U16,
+    INST_SUB_U32,
+    INST_SUB_U64,
+    INST_SUB_F32,
+    INST_SUB_F64,
+    INST_MUL_I64,
+    INST_MUL_U8,
+    INST_MUL_U16,
+    INST_MUL_U32,
+    INST_MUL_U64,
+    INST_MUL_F32,
+    INST_MUL_F64,
+    INST_DIV_I64,
+    INST_DIV_U8,
+    INST_DIV_U16,
+    INST_DIV_U32,
+    INST_DIV_U64,
+    INST_DIV_F32,
+    INST_DIV_F64,
+    INST_CMPE_I64,
+    INST_CMPE_U8,
+    INST_CMPE_U16,
+    INST_CMPE_U32,
+    INST_CMPE_U64,
+    INST_CMPE_F32,
+    INST_CMPE_F64,
+    INST_CMPNE_I64,
+    INST_CMPNE_U8,
+    INST_CMPNE_U16,
+    INST_CMPNE_U32,
+    INST_CMPNE_U64,
+    INST_CMPNE_F32,
+    INST_CMPNE_F64,
+    INST_CMPG_I64,
+    INST_CMPG_U8,
+    INST_CMPG_U16,
+    INST_CMPG_U32,
+    INST_CMPG_U64,
+    INST_CMPG_F32,
+    INST_CMPG_F64,
+    INST_CMPL_I64,
+    INST_CMPL_U8,
+    INST_CMPL_U16,
+    INST_CMPL_U32,
+    INST_CMPL_U64,
+    INST_CMPL_F32,
+    INST_CMPL_F64,
+    INST_CMPGE_I64,
+    INST_CMPGE_U8,
+    INST_CMPGE_U16,
+    INST_CMPGE_U32,
+    INST_CMPGE_U64,
+    INST_CMPGE_F32,
+    INST_CMPGE_F64,
+    INST_CMPLE_I64,
+    INST_CMPLE_U8,
+    INST_CMPLE_U16,
+    INST_CMPLE_U32,
+    INST_CMPLE_U64,
+    INST_CMPLE_F32,
+    INST_CMPLE_F64,
+    // guarded forms the VM rewrites generic ops into at runtime, see QUICKEN
+    INST_ADD_I64_Q,
+    INST_ADD_U64_Q,
+    INST_ADD_U8_Q,
+    INST_ADD_F32_Q,
+    INST_SUB_I64_Q,
+    INST_SUB_U64_Q,
+    INST_SUB_U8_Q,
+    INST_SUB_F32_Q,
+    INST_MUL_I64_Q,
+    INST_MUL_U64_Q,
+    INST_MUL_U8_Q,
+    INST_MUL_F32_Q,
+    INST_DIV_I64_Q,
+    INST_DIV_U64_Q,
+    INST_DIV_U8_Q,
+    INST_DIV_F32_Q,
+    INST_CMPE_I64_Q,
+    INST_CMPE_U64_Q,
+    INST_CMPE_U8_Q,
+    INST_CMPE_F32_Q,
+    INST_CMPNE_I64_Q,
+    INST_CMPNE_U64_Q,
+    INST_CMPNE_U8_Q,
+    INST_CMPNE_F32_Q,
+    INST_CMPG_I64_Q,
+    INST_CMPG_U64_Q,
+    INST_CMPG_U8_Q,
+    INST_CMPG_F32_Q,
+    INST_CMPL_I64_Q,
+    INST_CMPL_U64_Q,
+    INST_CMPL_U8_Q,
+    INST_CMPL_F32_Q,
+    INST_CMPGE_I64_Q,
+    INST_CMPGE_U64_Q,
+    INST_CMPGE_U8_Q,
+    INST_CMPGE_F32_Q,
+    INST_CMPLE_I64_Q,
+    INST_CMPLE_U64_Q,
+    INST_CMPLE_U8_Q,
+    INST_CMPLE_F32_Q,
+    // superinstructions for the sequences the backend emits most
+    INST_LOAD_LOCAL,        // push the frame slot k
+    INST_LOAD_GLOBAL,       // ss; push k; sub; indup
+    INST_PTR_ADD_IMM,       // push off; add; tovp
+    INST_INDEX_ADDR,        // push size; mul; add; tovp
+    INST_INDEXED_LOAD,      // push size; mul; add; tovp; push size; push type; read
+    INST_STORE_LOCAL,       // pop into the frame slot k
+    INST_STORE_GLOBAL,      // pop into stack position k
+    // backward jump closing a while loop (a jmp the backend marked with PTR_TYPE), counts
+    // how often the loop runs so a hot one can be handed to Machine.loop_hook
+    INST_LOOP,
+    INST_COPY,              // replace a pointer to a string with a fresh heap copy of it
+    // per frame region for aggregates the backend proved do not escape their scope
+    INST_REGION_MARK,       // push the current region top
+    INST_REGION_ALLOC,      // like alloc, but bumps the region
+    INST_REGION_RESET,      // drop everything allocated since the mark in frame slot k
+    // arenas scripts create themselves, a handle is an index into Machine.arenas
+    INST_ARENA_NEW,         // pop capacity, push handle
+    INST_ARENA_ALLOC,       // pop size, pop handle, push ptr
+    INST_ARENA_RESET,       // pop handle
+    INST_ARENA_FREE,        // pop handle
+    // unchecked forms machine_verify rewrites to once it has proven their checks can not fail
+    INST_LOAD_LOCAL_V,
+    INST_STORE_LOCAL_V,
+    INST_LOAD_GLOBAL_V,
+    INST_STORE_GLOBAL_V,
+    INST_ALLOC_V,
+    INST_WRITE_V,
+    INST_READ_V,
+    INST_INDUP_V,
+    INST_INSWAP_V,
+    // never emitted, the debugger patches it over the first byte of a breakpoint's instruction
+    INST_BREAK,
+    INST_ARG,               // pop n, push the embedder's argument n
+    // coroutines, a handle is an index into Machine.coroutines and 0 is the main program
+    INST_SPAWN,             // pop argc and argc args, push the handle of a suspended coroutine calling the target
+    INST_YIELD,             // hand control back to whoever resumed the running coroutine
+    INST_RESUME,            // pop handle, run it until it yields or finishes, push 1 if it can run again
+    INST_JOIN,              // pop handle, run coroutines round robin until it finishes, push its result
     INST_COUNT,
 } Inst_Set;
 
@@ -122,24 +288,37 @@ typedef struct {
         }                                       \
     } while(0)
 
+// first guarded quickened form for each generic op, the families follow in the order i64 u64 u8 f32
+extern Inst_Set quick_base[INST_COUNT];
+// checked form of every verified opcode, INST_NOP for the rest
+extern Inst_Set checked_base[INST_COUNT];
+
+// the engine keeps the stack pointer in a local, these work on sp/stack
+// there are no bounds checks, running off either end of the stack hits a guard page
+#define VM_PUSH(value, data_type) \
+    do { \
+        sp->word = (value); \
+        sp->type = (data_type); \
+        sp++; \
+    } while(0)
+
+#define VM_POP(dst) \
+    do { \
+        (dst) = *--sp; \
+    } while(0)
+
+// anything that goes through the Machine (natives) has to be bracketed by these
+#define VM_SAVE() (machine->stack_size = sp - stack)
+#define VM_LOAD() (sp = stack + machine->stack_size)
+
 #define MATH_OP(as_type, op, data_type) \
     do { \
-        b = pop(machine);   \
-        a = pop(machine);   \
+        VM_POP(b);   \
+        VM_POP(a);   \
         Word c = {.as_type = a.word.as_type op b.word.as_type}; \
-        push(machine, c, data_type); \
+        VM_PUSH(c, data_type); \
     } while(0)
 
-#define ASSERT(cond, ...) \
-    do { \
-        if (!(cond)) { \
-            fprintf(stderr, "%s:%d: ASSERTION FAILED: ", __FILE__, __LINE__); \
-            fprintf(stderr, __VA_ARGS__); \
-            fprintf(stderr, "\n"); \
-            exit(1); \
-        } \
-    } while (0)
-	
 #define GET_TYPE(var, val) \
 		do { \
 		switch((var).type) { \
@@ -169,40 +348,145 @@ typedef struct {
 						uint64_t b_val;		\
 						GET_TYPE(a, a_val);			\
 						GET_TYPE(b, b_val);\
-						push(machine, (Word){.as_type=(a_val op b_val)}, return_type);\
+						VM_PUSH((Word){.as_type=(a_val op b_val)}, return_type);\
 					} break;\
 					case INT_TYPE: {\
 						int64_t a_val;\
 						int64_t b_val;		\
 						GET_TYPE(a, a_val);			\
 						GET_TYPE(b, b_val);\
-						push(machine, (Word){.as_type=(a_val op b_val)}, return_type);\
+						VM_PUSH((Word){.as_type=(a_val op b_val)}, return_type);\
 					} break;\
 					case FLOAT_TYPE: {\
 						float a_val;\
 						float b_val;		\
 						GET_TYPE(a, a_val);			\
 						GET_TYPE(b, b_val);\
-						push(machine, (Word){.as_type=(a_val op b_val)}, return_type);\
+						VM_PUSH((Word){.as_type=(a_val op b_val)}, return_type);\
 					} break;\
 					case DOUBLE_TYPE: {\
 						double a_val;\
 						double b_val;		\
 						GET_TYPE(a, a_val);			\
 						GET_TYPE(b, b_val);\
-						push(machine, (Word){.as_type=(a_val op b_val)}, return_type);\
+						VM_PUSH((Word){.as_type=(a_val op b_val)}, return_type);\
 					} break;\
 					default:\
 						ASSERT(false, "Unknown type");\
                 } \
             } while(0)
 
+#define BIN_OP(op) \
+    do { \
+        if(sp - stack < 2) TIM_ERROR("error: stack underflow\n"); \
+        b = sp[-1]; \
+        a = sp[-2]; \
+        sp -= 2; \
+        switch(a.type) { \
+            case PTR_TYPE: \
+            case U64_TYPE: \
+                TYPE_OP(as_u64, U64_TYPE, op); \
+                break; \
+            case CHAR_TYPE: \
+            case U8_TYPE: \
+                TYPE_OP(as_u8, U8_TYPE, op); \
+                break; \
+            case U16_TYPE: \
+                TYPE_OP(as_u16, U16_TYPE, op); \
+                break; \
+            case U32_TYPE: \
+                TYPE_OP(as_u32, U32_TYPE, op); \
+                break; \
+            case INT_TYPE: \
+                TYPE_OP(as_int, INT_TYPE, op); \
+                break; \
+            case FLOAT_TYPE: \
+                TYPE_OP(as_float, FLOAT_TYPE, op); \
+                break; \
+            case DOUBLE_TYPE: \
+                TYPE_OP(as_double, DOUBLE_TYPE, op); \
+                break; \
+            default: \
+                TIM_ERROR("error: not right...\n"); \
+        } \
+    } while(0)
+
+// typed ops trust the tags the backend proved, so there is no dispatch on a.type
+#define TYPED_OP(as_type, data_type, op) \
+    do { \
+        if(sp - stack < 2) TIM_ERROR("error: stack underflow\n"); \
+        sp[-2].word = (Word){.as_type = (sp[-2].word.as_type op sp[-1].word.as_type)}; \
+        sp[-2].type = (data_type); \
+        sp--; \
+    } while(0)
+
+#define TYPED_DIV(as_type, data_type) \
+    do { \
+        if(sp > stack && sp[-1].word.as_type == 0) TIM_ERROR("error: cannot divide by 0\n"); \
+        TYPED_OP(as_type, data_type, /); \
+    } while(0)
+
+// rewrites the generic op at pc into the guarded form matching the tags it sees, read only code
+// stays generic, so the guarded forms below are only ever found in code the machine owns
+#define QUICKEN() \
+    do { \
+        if(quicken && sp - stack >= 2 && sp[-2].type == sp[-1].type) { \
+            switch(sp[-1].type) { \
+                case INT_TYPE: *pc = quick_base[*pc]; break; \
+                case U64_TYPE: *pc = quick_base[*pc] + 1; break; \
+                case U8_TYPE: *pc = quick_base[*pc] + 2; break; \
+                case FLOAT_TYPE: *pc = quick_base[*pc] + 3; break; \
+                default: break; \
+            } \
+        } \
+    } while(0)
+
+// when the guard fails the op is put back to its generic form, which runs it and quickens again
+#define QUICK_GUARD(data_type, generic) \
+    do { \
+        if(sp - stack < 2 || sp[-2].type != (data_type) || sp[-1].type != (data_type)) { \
+            *pc = (generic); \
+            REDISPATCH; \
+        } \
+    } while(0)
+
+#define QUICK_OP(as_type, data_type, op, generic) \
+    do { \
+        QUICK_GUARD(data_type, generic); \
+        TYPED_OP(as_type, data_type, op); \
+    } while(0)
+
+#define QUICK_DIV(as_type, data_type, generic) \
+    do { \
+        QUICK_GUARD(data_type, generic); \
+        TYPED_DIV(as_type, data_type); \
+    } while(0)
+
+// tags the generic ops treat as plain 64 bit integers
+#define IS_WIDE_TYPE(type) ((type) == INT_TYPE || (type) == U64_TYPE || (type) == PTR_TYPE)
+
+// base index -> base + index*size as a pointer, anything that is not a plain 64 bit
+// integer goes through the generic ops so narrow index types still wrap the same way
+#define INDEX_ADDR(size) \
+    do { \
+        if(sp - stack < 2) TIM_ERROR("error: stack underflow\n"); \
+        if(IS_WIDE_TYPE(sp[-2].type) && IS_WIDE_TYPE(sp[-1].type)) { \
+            sp[-2].word.as_u64 += sp[-1].word.as_u64 * (size); \
+            sp--; \
+        } else { \
+            VM_PUSH((Word){.as_int=(size)}, INT_TYPE); \
+            BIN_OP(*); \
+            BIN_OP(+); \
+        } \
+        sp[-1].type = PTR_TYPE; \
+    } while(0)
+
 #define TIM_ERROR(...) do {				\
-	fprintf(stderr, __VA_ARGS__); exit(1);   \
+	tim_fail(__VA_ARGS__);   \
 } while (0)
 
-
 #define AMOUNT_OF_REGISTERS 16 
+#define MACHINE_ARGS 8
 #define MAX_STRING_SIZE 256
 
 typedef struct {
@@ -210,16 +494,55 @@ typedef struct {
     DataType data_type;
 } Register;
     
+// the VM heap behind alloc, dealloc and copy. small blocks come from one free list per
+// power of two size class, carved out of HEAP_CHUNK sized mappings, anything bigger than
+// the largest class is mapped on its own. the header in front of every block makes
+// dealloc O(1). a freed large mapping keeps its header page so a second dealloc is still
+// caught, the rest is handed back to the kernel until an alloc reuses it
+#define HEAP_MIN_CLASS 16
+#define HEAP_CLASSES 9
+#define HEAP_MAX_CLASS (HEAP_MIN_CLASS << (HEAP_CLASSES - 1))
+#define HEAP_CHUNK (64*1024)
+#define HEAP_LARGE UINT32_MAX
+
+typedef struct Heap_Block {
+    // free list link, or the list of large blocks
+    struct Heap_Block *next;
+    struct Heap_Block *prev;
+    size_t size;
+    // bytes mapped for a large block
+    size_t mapped;
+    uint32_t size_class;
+    uint32_t magic;
+} Heap_Block;
+
+// payloads stay 16 byte aligned
+#define HEAP_HEADER ((sizeof(Heap_Block) + 15) & ~(size_t)15)
+
+// a chunk or large block mapping
 typedef struct {
-    int8_t *data;
-    size_t count;
-    size_t capacity;
-} Memory_Cell;
+    uintptr_t lo;
+    uintptr_t hi;
+} Heap_Range;
+
+typedef struct {
+    Heap_Block *free[HEAP_CLASSES];
+    Heap_Block *large;
+    // chunks are chained through their first word so they can be unmapped at the end
+    void *chunks;
+    uint8_t *bump;
+    uint8_t *bump_end;
+    // every mapping above sorted by address, dealloc only reads the header in front of
+    // a pointer that falls inside one of them
+    Heap_Range *ranges;
+    size_t range_count;
+    size_t range_capacity;
 
-typedef struct Memory {
-    struct Memory *next;
-    Memory_Cell cell;
-} Memory;
+    size_t allocs;
+    size_t frees;
+    size_t live_bytes;
+    size_t peak_bytes;
+} Heap;
 	
 typedef struct {
 	Inst *data;
@@ -232,30 +555,281 @@ typedef struct {
 	size_t count;
 	size_t capacity;
 } Str_Stack;
+
+typedef struct {
+    Arena *data;
+    size_t count;
+    size_t capacity;
+} Arenas;
 	
+// call pushes the return address and the caller's frame pointer, ret restores both
+typedef struct {
+    size_t ret;
+    size_t fp;
+} Call_Frame;
+
+typedef enum {
+    COROUTINE_SUSPENDED = 0,
+    // resumed and not back yet, the running one and every resumer waiting on it
+    COROUTINE_RUNNING,
+    COROUTINE_DONE,
+} Coroutine_State;
+
+// the engine state of a coroutine while another one runs, the running one keeps it in Machine
+typedef struct {
+    Data *stack;
+    int stack_size;
+    Call_Frame *return_stack;
+    int return_stack_size;
+    size_t frame_pointer;
+    uint8_t *region;
+    size_t region_top;
+    size_t region_capacity;
+    // byte offset to continue at
+    size_t pc;
+    // gets control back when this one yields or finishes
+    size_t resumer;
+    Coroutine_State state;
+    // resumed by resume, which pushes whether it can run again once control is back
+    bool status;
+    // in the run queue, join and halt pick the next coroutine from it
+    bool queued;
+    // what the function returned, handed out by join
+    Data result;
+} Coroutine;
+
+// the stacks of a finished coroutine, kept mapped for the next spawn
+typedef struct {
+    Data *stack;
+    Call_Frame *return_stack;
+    uint8_t *region;
+} Coroutine_Stacks;
+
+typedef struct {
+    Coroutine *data;
+    size_t count;
+    size_t capacity;
+    // index of the running one
+    size_t current;
+    struct {
+        size_t *data;
+        size_t count;
+        size_t capacity;
+        size_t head;
+    } queue;
+    struct {
+        Coroutine_Stacks *data;
+        size_t count;
+        size_t capacity;
+    } spare;
+} Coroutines;
+
+// iterations before a loop is handed to Machine.loop_hook
+#define HOT_LOOP 64
+
+typedef struct {
+    uint32_t count;
+    // owned by whoever set loop_hook, the tracing jit keeps the compiled trace here
+    void *trace;
+} Loop_State;
+
+// source position of every instruction, run length encoded: an entry covers the instructions
+// from its start up to the start of the next one
+typedef struct {
+    uint32_t start;
+    uint32_t file;
+    uint32_t line;
+} Line_Entry;
+
+typedef struct {
+    Line_Entry *data;
+    size_t count;
+    size_t capacity;
+    // interned, so the file ids stay the same across the @"file" line markers tipp.h leaves
+    struct {
+        String_View *data;
+        size_t count;
+        size_t capacity;
+    } files;
+} Line_Table;
+
+// per opcode and per function time, filled by run_code while Machine.profile is set.
+// ticks are cycles from rdtsc on x86-64 and nanoseconds elsewhere
+typedef struct {
+    // byte offset of the first instruction, the entrypoint for the top level
+    size_t entry;
+    uint64_t calls;
+    // ticks spent in the function itself, and including its callees (recursion counted once)
+    uint64_t self;
+    uint64_t total;
+    size_t active;
+} Profile_Function;
+
+typedef struct {
+    size_t function;
+    uint64_t start;
+} Profile_Frame;
+
+// a slot is numbered the way load_local and load_global number theirs
+typedef struct {
+    bool global;
+    int64_t index;
+} Debug_Slot;
+
+typedef enum {
+    DEBUG_ALWAYS = 0,
+    DEBUG_EQ,
+    DEBUG_NE,
+    DEBUG_LT,
+    DEBUG_GT,
+    DEBUG_LE,
+    DEBUG_GE,
+} Debug_Op;
+
+typedef struct {
+    size_t index;
+    // the opcode INST_BREAK replaced in the code
+    uint8_t opcode;
+    // only stops when the slot compares to value as an int
+    Debug_Op op;
+    Debug_Slot slot;
+    int64_t value;
+} Breakpoint;
+
+typedef struct {
+    Breakpoint *data;
+    size_t count;
+    size_t capacity;
+} Breakpoints;
+
+typedef struct {
+    // absolute stack position, frame slots are resolved when the watch is set
+    size_t position;
+    Word value;
+} Watch;
+
+typedef struct {
+    Watch *data;
+    size_t count;
+    size_t capacity;
+    // the watch that stopped run_code last
+    size_t hit;
+} Watches;
+
+typedef struct Profile {
+    uint64_t counts[INST_COUNT];
+    uint64_t ticks[INST_COUNT];
+    // instruction the running ticks belong to
+    uint8_t op;
+    uint64_t since;
+    // ticks charged so far, frames are timed on this so the probe's own cost stays out
+    uint64_t elapsed;
+    struct {
+        Profile_Function *data;
+        size_t count;
+        size_t capacity;
+    } functions;
+    struct {
+        Profile_Frame *data;
+        size_t count;
+        size_t capacity;
+    } frames;
+} Profile;
+
 struct Machine;
 
 typedef void (*native)(struct Machine*);
 
+// INST_NATIVE keeps the native_ptrs index in the low half of its operand. a call into a loaded
+// library also sets NATIVE_DECLARED with the number of arguments it pops and whether it
+// pushes a result, so the verifier can step over it
+#define NATIVE_INDEX(operand) ((operand) & 0xFFFF)
+#define NATIVE_ARGS(operand) (((operand) >> 16) & 0xFF)
+#define NATIVE_RETURNS 0x01000000u
+#define NATIVE_DECLARED 0x80000000u
+
 typedef struct Machine {
-    Data stack[MAX_STACK_SIZE];
+    // both stacks are mapped by machine_init_stacks with guard pages on either side. stack
+    // is the running coroutine's, globals the bottom of the main program's
+    Data *stack;
+    Data *globals;
     int stack_size;
+    // entries in each stack, 0 means DEFAULT_STACK_SIZE
+    size_t stack_capacity;
     Str_Stack str_stack;
-    size_t return_stack[MAX_STACK_SIZE];
+    Call_Frame *return_stack;
     int return_stack_size;
+    // stack index the current function's locals are addressed from, set by call
+    size_t frame_pointer;
+    // bump allocated memory for non-escaping arrays and structs, mapped next to the stacks
+    uint8_t *region;
+    size_t region_top;
+    size_t region_capacity;
     size_t program_size;
     
-    Memory *memory;
+    Heap heap;
+    // freed arenas keep their slot with data set to NULL so it can be handed out again
+    Arenas arenas;
 
     size_t entrypoint;
     bool has_entrypoint;
 
     Register registers[AMOUNT_OF_REGISTERS];
+    // values an embedder hands the program, pushed by INST_ARG and kept across machine_reset
+    Data args[MACHINE_ARGS];
+    // entry 0 is the main program, only there once something was spawned
+    Coroutines coroutines;
 		
 	native native_ptrs[100];
 	size_t native_ptrs_s;
 
     Insts instructions;
+    Line_Table lines;
+
+    // every str_stack entry, deduplicated and NUL terminated in one read-only mapping,
+    // push_str operands are offsets into it
+    char *str_pool;
+    size_t str_pool_size;
+
+    // a program read from a .tim file runs straight out of the mapped file, code, str_pool
+    // and code_offsets then point into it
+    uint8_t *image;
+    size_t image_size;
+
+    // compact encoding built from instructions by machine_load_code
+    uint8_t *code;
+    size_t code_size;
+    size_t *code_offsets;
+
+    // set by machine_verify when the code has been rewritten to the unchecked opcodes
+    bool verified;
+    // machine_verify has already run on this code and verified is its answer
+    bool verify_done;
+    // the code is a mapped image or the program machine_share took it from, nothing writes it:
+    // run_code does not quicken it and machine_own_code copies it before anything else changes it
+    bool code_readonly;
+    // every instruction run_code dispatches is timed into this when it is set
+    Profile *profile;
+    // while sampling run_code publishes the return stack size in the high half and the byte
+    // offset of the next instruction in the low half, one store so a signal never sees them torn
+    bool sampling;
+    volatile uint64_t sample;
+    // instructions run_code dispatched, only kept while counting is set
+    bool counting;
+    uint64_t executed;
+    // debugger state, run_code stops at INST_BREAK and, while there are watches, before
+    // any instruction that follows a change to a watched slot
+    Breakpoints breakpoints;
+    Watches watches;
+    // where writes to stdout go, NULL for stdout itself
+    FILE *out;
+
+    // one per INST_LOOP, indexed by its second operand
+    Loop_State *loops;
+    size_t loops_count;
+    // called with the engine state saved when a loop gets hot or already has a trace,
+    // returns the byte offset to continue at
+    size_t (*loop_hook)(struct Machine *machine, uint32_t loop, size_t target);
 } Machine;
 
 // helper functions
@@ -284,20 +858,154 @@ Data pop(Machine *machine);
 void index_swap(Machine *machine, int64_t index);
 void index_dup(Machine *machine, int64_t index);
 void print_stack(Machine *machine);
+// .tim container: a header, a section table and page aligned sections holding the compact
+// code, the string pool, the offset table, plus the Insts and literals the tools need.
+// everything is little endian host layout, the version changes whenever the encoding does
+#define TIM_FILE_MAGIC "TIMB"
+#define TIM_FILE_VERSION 2
+#define TIM_FILE_ALIGN 4096
+
+typedef enum {
+    TIM_SECTION_CODE = 0,
+    TIM_SECTION_POOL,
+    TIM_SECTION_OFFSETS,
+    TIM_SECTION_INSTS,
+    TIM_SECTION_STRINGS,
+    TIM_SECTION_LINES,
+    TIM_SECTION_COUNT,
+} Tim_Section_Kind;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    // FNV-1a over everything after the header
+    uint64_t checksum;
+    uint64_t entrypoint;
+    uint64_t program_size;
+    uint64_t loops;
+    uint32_t section_count;
+    uint32_t reserved;
+} Tim_File_Header;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+} Tim_Section;
+
+// Inst without padding or host sized fields
+typedef struct {
+    uint64_t value;
+    uint32_t type;
+    uint32_t data_type;
+    uint64_t register_index;
+} Tim_Inst_Record;
+
+// packed .tim: the same magic scheme with one byte opcodes and LEB128 operands, jump
+// targets stored relative to the jumping instruction. read_program_from_file accepts both
+#define TIM_PACKED_MAGIC "TIMZ"
+#define TIM_PACKED_VERSION 2
+
 void write_program_to_file(Machine *machine, char *file_path);
+void write_packed_program_to_file(Machine *machine, char *file_path);
 Machine *read_program_from_file(Machine *machine, char *file_path);
+void machine_load_insts(Machine *machine);
 void machine_disasm(Machine *machine);
 void machine_debug(Machine *machine);
+bool debug_watch_hit(Machine *machine);
+size_t debug_step(Machine *machine, size_t ip);
+size_t debug_continue(Machine *machine, size_t ip);
+void machine_init_stacks(Machine *machine);
 void machine_free(Machine *machine);
+void machine_reset(Machine *machine);
+void machine_share(Machine *machine, const Machine *program, size_t stack_capacity);
+void machine_free_shared(Machine *machine);
+void *heap_alloc(Machine *machine, size_t size, bool zero);
+void heap_free(Machine *machine, void *ptr);
+void heap_free_all(Machine *machine);
+void heap_reset(Machine *machine);
+Arena *machine_arena(Machine *machine, Data handle);
 void machine_load_native(Machine *machine, native ptr);
+void machine_load_code(Machine *machine);
+Inst_Set code_type(Inst inst);
+size_t code_offset_to_index(Machine *machine, size_t offset);
+bool machine_has_coroutines(Machine *machine);
+void machine_unverify(Machine *machine);
+void machine_own_code(Machine *machine);
+bool machine_verify(Machine *machine);
+size_t run_code(Machine *machine, size_t start, bool step);
+void line_table_add(Line_Table *table, size_t index, String_View file, size_t line);
+bool line_table_find(Line_Table *table, size_t index, String_View *file, size_t *line);
+uint64_t profile_now(void);
+void profile_tick(Profile *profile, uint8_t op, size_t offset);
+void profile_finish(Profile *profile);
 void run_instructions(Machine *machine);
-size_t run_instruction(Machine *machine, Inst instruction, size_t ip);
+size_t run_instruction(Machine *machine, size_t ip);
 
 
 #endif // TIM_H
 
 #ifdef TIM_IMPLEMENTATION
 
+_Thread_local Tim_Trap *tim_trap = NULL;
+
+// prefix and suffix go around the formatted message, the trap gets the same text stderr would
+static _Noreturn void tim_vfail(const char *prefix, const char *suffix, const char *format, va_list args) {
+    if(tim_trap != NULL) {
+        char *message = tim_trap->message;
+        size_t size = sizeof(tim_trap->message);
+        int len = snprintf(message, size, "%s", prefix);
+        if(len >= 0 && (size_t)len < size) len += vsnprintf(message + len, size - len, format, args);
+        if(len >= 0 && (size_t)len < size) snprintf(message + len, size - len, "%s", suffix);
+        siglongjmp(tim_trap->jump, TIM_TRAP_ERROR);
+    }
+    fputs(prefix, stderr);
+    vfprintf(stderr, format, args);
+    fputs(suffix, stderr);
+    exit(1);
+}
+
+void tim_fail(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    tim_vfail("", "", format, args);
+}
+
+void tim_fail_at(const char *file, size_t row, size_t col, const char *format, ...) {
+    char prefix[512];
+    snprintf(prefix, sizeof(prefix), "%s:%zu:%zu: error: ", file, row, col);
+    va_list args;
+    va_start(args, format);
+    tim_vfail(prefix, "\n", format, args);
+}
+
+void tim_assert_fail(const char *file, int line, const char *format, ...) {
+    char prefix[512];
+    snprintf(prefix, sizeof(prefix), "%s:%d: ASSERTION FAILED: ", file, line);
+    va_list args;
+    va_start(args, format);
+    tim_vfail(prefix, "\n", format, args);
+}
+
+void tim_exit(int code) {
+    if(tim_trap != NULL) {
+        tim_trap->exit_code = code;
+        siglongjmp(tim_trap->jump, TIM_TRAP_EXIT);
+    }
+    exit(code);
+}
+
+// ends the process the way an error or exit without a trap would, for the trap main sets.
+// the stack guard handler jumps to it instead of exiting on the signal frame, so the output
+// a program wrote before a fault is still flushed
+void tim_trap_exit(Tim_Trap *trap, int trapped) {
+    tim_trap = NULL;
+    if(trapped == TIM_TRAP_EXIT) exit(trap->exit_code);
+    fputs(trap->message, stderr);
+    exit(1);
+}
+
 char *str_types[] = {"int", "u8", "u16", "u32", "u64", "float", "double", "char", "ptr", "reg", "top"};
 
 char *instructions[INST_COUNT] = {
@@ -352,92 +1060,405 @@ char *instructions[INST_COUNT] = {
 	"load_lib",
     "ss",
     "halt",
+    "add_i64",
+    "add_u8",
+    "add_u16",
+    "add_u32",
+    "add_u64",
+    "add_f32",
+    "add_f64",
+    "sub_i64",
+    "sub_u8",
+    "sub_u16",
+    "sub_u32",
+    "sub_u64",
+    "sub_f32",
+    "sub_f64",
+    "mul_i64",
+    "mul_u8",
+    "mul_u16",
+    "mul_u32",
+    "mul_u64",
+    "mul_f32",
+    "mul_f64",
+    "div_i64",
+    "div_u8",
+    "div_u16",
+    "div_u32",
+    "div_u64",
+    "div_f32",
+    "div_f64",
+    "cmpe_i64",
+    "cmpe_u8",
+    "cmpe_u16",
+    "cmpe_u32",
+    "cmpe_u64",
+    "cmpe_f32",
+    "cmpe_f64",
+    "cmpne_i64",
+    "cmpne_u8",
+    "cmpne_u16",
+    "cmpne_u32",
+    "cmpne_u64",
+    "cmpne_f32",
+    "cmpne_f64",
+    "cmpg_i64",
+    "cmpg_u8",
+    "cmpg_u16",
+    "cmpg_u32",
+    "cmpg_u64",
+    "cmpg_f32",
+    "cmpg_f64",
+    "cmpl_i64",
+    "cmpl_u8",
+    "cmpl_u16",
+    "cmpl_u32",
+    "cmpl_u64",
+    "cmpl_f32",
+    "cmpl_f64",
+    "cmpge_i64",
+    "cmpge_u8",
+    "cmpge_u16",
+    "cmpge_u32",
+    "cmpge_u64",
+    "cmpge_f32",
+    "cmpge_f64",
+    "cmple_i64",
+    "cmple_u8",
+    "cmple_u16",
+    "cmple_u32",
+    "cmple_u64",
+    "cmple_f32",
+    "cmple_f64",
+    "add_i64_q",
+    "add_u64_q",
+    "add_u8_q",
+    "add_f32_q",
+    "sub_i64_q",
+    "sub_u64_q",
+    "sub_u8_q",
+    "sub_f32_q",
+    "mul_i64_q",
+    "mul_u64_q",
+    "mul_u8_q",
+    "mul_f32_q",
+    "div_i64_q",
+    "div_u64_q",
+    "div_u8_q",
+    "div_f32_q",
+    "cmpe_i64_q",
+    "cmpe_u64_q",
+    "cmpe_u8_q",
+    "cmpe_f32_q",
+    "cmpne_i64_q",
+    "cmpne_u64_q",
+    "cmpne_u8_q",
+    "cmpne_f32_q",
+    "cmpg_i64_q",
+    "cmpg_u64_q",
+    "cmpg_u8_q",
+    "cmpg_f32_q",
+    "cmpl_i64_q",
+    "cmpl_u64_q",
+    "cmpl_u8_q",
+    "cmpl_f32_q",
+    "cmpge_i64_q",
+    "cmpge_u64_q",
+    "cmpge_u8_q",
+    "cmpge_f32_q",
+    "cmple_i64_q",
+    "cmple_u64_q",
+    "cmple_u8_q",
+    "cmple_f32_q",
+    "load_local",
+    "load_global",
+    "ptr_add_imm",
+    "index_addr",
+    "indexed_load",
+    "store_local",
+    "store_global",
+    "loop",
+    "copy",
+    "region_mark",
+    "region_alloc",
+    "region_reset",
+    "arena",
+    "arena_alloc",
+    "arena_reset",
+    "arena_free",
+    "load_local_v",
+    "store_local_v",
+    "load_global_v",
+    "store_global_v",
+    "alloc_v",
+    "write_v",
+    "read_v",
+    "indup_v",
+    "inswap_v",
+    "break",
+    "arg",
+    "spawn",
+    "yield",
+    "resume",
+    "join",
 };
 
 bool has_operand[INST_COUNT] = {
-     false,       //    "nop",
-     true,        //    "push",
-     true,        //    "push_str",
-     true,        //    "mov",
-     false,       //    "ref",
-     false,       //    "deref",
-     false,       //    "alloc",
-     false,       //    "dealloc",
-     false,       //    "write",
-     false,       //    "read",
-     false,       //    "pop",
-     false,       //    "dup",
-     false,       //    "indup",
-     false,       //    "swap",
-     false,       //    "inswap",
-     false,       //    "add",
-     false,       //    "sub",
-     false,       //    "mul",
-     false,       //    "div",
-     false,       //    "mod",
-     false,       //    "add_f",
-     false,       //    "sub_f",
-     false,       //    "mul_f",
-     false,       //    "div_f",
-     false,       //    "mod_f",
-     false,       //    "cmpe",
-     false,       //    "cmpne",
-     false,       //    "cmpg",
-     false,       //    "cmpl",
-     false,       //    "cmpge",
-     false,       //    "cmple",
-     false,       //    "itof",
-     false,       //    "ftoi",
-     false,       //    "itoc",
-     false,       //    "toi",
-     false,       //    "tof",
-     false,       //    "toc",
-     false,       //    "tovp",
-     true,        //    "call",
-     false,       //    "ret",
-     true,        //    "jmp",
-     true,        //    "zjmp",
-     true,        //    "nzjmp",
-     false,       //    "print",
-     true,        //    "native",
-     true,        //    "entrypoint",
-     false,       //    "ss",
-     false,       //    "halt",
+    [INST_PUSH] = true,
+    [INST_PUSH_STR] = true,
+    [INST_MOV] = true,
+    [INST_CALL] = true,
+    [INST_JMP] = true,
+    [INST_ZJMP] = true,
+    [INST_NZJMP] = true,
+    [INST_NATIVE] = true,
+    [INST_ENTRYPOINT] = true,
+    [INST_LOAD_LOCAL] = true,
+    [INST_LOAD_GLOBAL] = true,
+    [INST_PTR_ADD_IMM] = true,
+    [INST_INDEX_ADDR] = true,
+    [INST_INDEXED_LOAD] = true,
+    [INST_STORE_LOCAL] = true,
+    [INST_STORE_GLOBAL] = true,
+    [INST_LOOP] = true,
+    [INST_REGION_RESET] = true,
+    [INST_LOAD_LOCAL_V] = true,
+    [INST_LOAD_GLOBAL_V] = true,
+    [INST_STORE_LOCAL_V] = true,
+    [INST_STORE_GLOBAL_V] = true,
+    [INST_SPAWN] = true,
+};
+
+Inst_Set quick_base[INST_COUNT] = {
+    [INST_ADD] = INST_ADD_I64_Q,
+    [INST_SUB] = INST_SUB_I64_Q,
+    [INST_MUL] = INST_MUL_I64_Q,
+    [INST_DIV] = INST_DIV_I64_Q,
+    [INST_CMPE] = INST_CMPE_I64_Q,
+    [INST_CMPNE] = INST_CMPNE_I64_Q,
+    [INST_CMPG] = INST_CMPG_I64_Q,
+    [INST_CMPL] = INST_CMPL_I64_Q,
+    [INST_CMPGE] = INST_CMPGE_I64_Q,
+    [INST_CMPLE] = INST_CMPLE_I64_Q,
+};
+
+Inst_Set checked_base[INST_COUNT] = {
+    [INST_LOAD_LOCAL_V] = INST_LOAD_LOCAL,
+    [INST_STORE_LOCAL_V] = INST_STORE_LOCAL,
+    [INST_LOAD_GLOBAL_V] = INST_LOAD_GLOBAL,
+    [INST_STORE_GLOBAL_V] = INST_STORE_GLOBAL,
+    [INST_ALLOC_V] = INST_ALLOC,
+    [INST_WRITE_V] = INST_WRITE,
+    [INST_READ_V] = INST_READ,
+    [INST_INDUP_V] = INST_INDUP,
+    [INST_INSWAP_V] = INST_INSWAP,
+};
+
+// bytes following the opcode in the compact encoding
+uint8_t operand_size[INST_COUNT] = {
+    [INST_PUSH] = 1 + sizeof(Word),         // type, value (register index for REGISTER_TYPE)
+    [INST_PUSH_STR] = sizeof(uint32_t),     // offset into str_pool
+    [INST_MOV] = 2 + sizeof(Word),          // register, type, value
+    [INST_CALL] = sizeof(uint32_t),         // byte offset
+    [INST_JMP] = sizeof(uint32_t),
+    [INST_ZJMP] = sizeof(uint32_t),
+    [INST_NZJMP] = sizeof(uint32_t),
+    [INST_NATIVE] = sizeof(uint32_t),       // native_ptrs index and stack effect, see NATIVE_DECLARED
+    [INST_ENTRYPOINT] = sizeof(uint32_t),
+    [INST_LOAD_LOCAL] = sizeof(int32_t),    // slot relative to the frame pointer, args are negative
+    [INST_LOAD_GLOBAL] = sizeof(uint32_t),  // stack position
+    [INST_PTR_ADD_IMM] = sizeof(uint32_t),  // offset
+    [INST_INDEX_ADDR] = sizeof(uint32_t),   // element size
+    [INST_INDEXED_LOAD] = 2,                // element size, type (Inst.register_index)
+    [INST_STORE_LOCAL] = sizeof(int32_t),
+    [INST_STORE_GLOBAL] = sizeof(uint32_t),
+    [INST_LOOP] = 2*sizeof(uint32_t),       // byte offset, loop index
+    [INST_REGION_RESET] = sizeof(int32_t),  // slot relative to the frame pointer
+    [INST_LOAD_LOCAL_V] = sizeof(int32_t),
+    [INST_STORE_LOCAL_V] = sizeof(int32_t),
+    [INST_LOAD_GLOBAL_V] = sizeof(uint32_t),
+    [INST_STORE_GLOBAL_V] = sizeof(uint32_t),
+    [INST_SPAWN] = sizeof(uint32_t),        // byte offset
 };
 
-void free_cell(Memory **cell) {
-    free((*cell)->cell.data);    
-    free(*cell);
+#define HEAP_LIVE 0x7469u
+#define HEAP_FREE 0xdeadu
+
+// index of the first range that ends past addr
+static size_t heap_range_find(Heap *heap, uintptr_t addr) {
+    size_t lo = 0;
+    size_t hi = heap->range_count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if(heap->ranges[mid].hi <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
 }
 
-void free_memory(Machine *machine, void *ptr) {
-    Memory *cur = machine->memory;
-    if(cur == NULL) goto defer;
-    if(cur->cell.data == ptr) {
-        machine->memory = cur->next;
-        free_cell(&cur);
-        return;
+static void heap_range_add(Heap *heap, void *ptr, size_t bytes) {
+    if(heap->range_count == heap->range_capacity) {
+        heap->range_capacity = heap->range_capacity == 0 ? 16 : heap->range_capacity*2;
+        heap->ranges = realloc(heap->ranges, sizeof(Heap_Range)*heap->range_capacity);
+        ASSERT(heap->ranges != NULL, "outta ram");
     }
-    while(cur->next != NULL) {
-        if(cur->next->cell.data == ptr) {
-            Memory *cell = cur->next;
-            cur->next = cur->next->next;
-            free_cell(&cell);
-            return;
+    size_t index = heap_range_find(heap, (uintptr_t)ptr);
+    memmove(&heap->ranges[index + 1], &heap->ranges[index], sizeof(Heap_Range)*(heap->range_count - index));
+    heap->ranges[index] = (Heap_Range){.lo = (uintptr_t)ptr, .hi = (uintptr_t)ptr + bytes};
+    heap->range_count++;
+}
+
+// true if a block header in front of ptr would lie inside a heap mapping
+static bool heap_owns(Heap *heap, void *ptr) {
+    uintptr_t header = (uintptr_t)ptr - HEAP_HEADER;
+    if((uintptr_t)ptr < HEAP_HEADER) return false;
+    size_t index = heap_range_find(heap, header);
+    return index < heap->range_count && heap->ranges[index].lo <= header;
+}
+
+static void *heap_map(Heap *heap, size_t bytes) {
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) TIM_ERROR("error: could not map %zu bytes for the heap\n", bytes);
+    heap_range_add(heap, ptr, bytes);
+    return ptr;
+}
+
+static uint32_t heap_size_class(size_t size) {
+    uint32_t size_class = 0;
+    while(((size_t)HEAP_MIN_CLASS << size_class) < size) size_class++;
+    return size_class;
+}
+
+// fresh mappings are already zero, only recycled blocks have to be cleared when zero is set
+static Heap_Block *heap_alloc_large(Heap *heap, size_t size, bool zero) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t bytes = (HEAP_HEADER + size + page - 1) / page * page;
+    for(Heap_Block *block = heap->large; block != NULL; block = block->next) {
+        if(block->magic != HEAP_FREE || block->mapped < bytes) continue;
+        // everything past the header page was dropped on free and reads back as zero
+        size_t first = page - HEAP_HEADER;
+        if(zero) memset((uint8_t*)block + HEAP_HEADER, 0, size < first ? size : first);
+        return block;
+    }
+    Heap_Block *block = heap_map(heap, bytes);
+    block->mapped = bytes;
+    block->size_class = HEAP_LARGE;
+    block->prev = NULL;
+    block->next = heap->large;
+    if(heap->large != NULL) heap->large->prev = block;
+    heap->large = block;
+    return block;
+}
+
+void *heap_alloc(Machine *machine, size_t size, bool zero) {
+    Heap *heap = &machine->heap;
+    Heap_Block *block;
+    if(size > HEAP_MAX_CLASS) {
+        block = heap_alloc_large(heap, size, zero);
+    } else {
+        uint32_t size_class = heap_size_class(size);
+        size_t bytes = HEAP_HEADER + ((size_t)HEAP_MIN_CLASS << size_class);
+        block = heap->free[size_class];
+        if(block != NULL) {
+            heap->free[size_class] = block->next;
+            if(zero) memset((uint8_t*)block + HEAP_HEADER, 0, size);
+        } else {
+            if(heap->bump == NULL || (size_t)(heap->bump_end - heap->bump) < bytes) {
+                uint8_t *chunk = heap_map(heap, HEAP_CHUNK);
+                *(void**)chunk = heap->chunks;
+                heap->chunks = chunk;
+                heap->bump = chunk + HEAP_HEADER;
+                heap->bump_end = chunk + HEAP_CHUNK;
+            }
+            block = (Heap_Block*)heap->bump;
+            heap->bump += bytes;
         }
-        cur = cur->next;
+        block->size_class = size_class;
     }
-defer:
-    TIM_ERROR("could not free pointer\n");
+    block->size = size;
+    block->magic = HEAP_LIVE;
+    heap->allocs++;
+    heap->live_bytes += size;
+    if(heap->live_bytes > heap->peak_bytes) heap->peak_bytes = heap->live_bytes;
+    return (uint8_t*)block + HEAP_HEADER;
 }
-    
-void insert_memory(Machine *machine, size_t size) {
-    Memory *new = malloc(sizeof(Memory));    
-    memset(new, 0, sizeof(Memory));
-    new->cell.data = malloc(sizeof(*new->cell.data)*size);
-    memset(new->cell.data, 0, sizeof(*new->cell.data)*size);
-    new->next = machine->memory;
-    machine->memory = new;
+
+void heap_free(Machine *machine, void *ptr) {
+    Heap *heap = &machine->heap;
+    // a string that was never copied out of the constants has nothing to free
+    if(machine->str_pool != NULL && (char*)ptr >= machine->str_pool &&
+       (char*)ptr < machine->str_pool + machine->str_pool_size) {
+        return;
+    }
+    if(ptr == NULL || (uintptr_t)ptr % 16 != 0 || !heap_owns(heap, ptr)) TIM_ERROR("could not free pointer\n");
+    Heap_Block *block = (Heap_Block*)((uint8_t*)ptr - HEAP_HEADER);
+    if(block->magic != HEAP_LIVE) TIM_ERROR("could not free pointer\n");
+    block->magic = HEAP_FREE;
+    heap->frees++;
+    heap->live_bytes -= block->size;
+    if(block->size_class == HEAP_LARGE) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        madvise((uint8_t*)block + page, block->mapped - page, MADV_DONTNEED);
+        return;
+    }
+    block->next = heap->free[block->size_class];
+    heap->free[block->size_class] = block;
+}
+
+Arena *machine_arena(Machine *machine, Data handle) {
+    Arenas *arenas = &machine->arenas;
+    if(handle.type != INT_TYPE || handle.word.as_u64 >= arenas->count || arenas->data[handle.word.as_u64].data == NULL) {
+        TIM_ERROR("error: not an arena: %ld\n", handle.word.as_int);
+    }
+    return &arenas->data[handle.word.as_u64];
+}
+
+void heap_free_all(Machine *machine) {
+    Heap *heap = &machine->heap;
+    while(heap->large != NULL) {
+        Heap_Block *block = heap->large;
+        heap->large = block->next;
+        munmap(block, block->mapped);
+    }
+    while(heap->chunks != NULL) {
+        void *chunk = heap->chunks;
+        heap->chunks = *(void**)chunk;
+        munmap(chunk, HEAP_CHUNK);
+    }
+    free(heap->ranges);
+    *heap = (Heap){0};
+}
+
+// frees every block but keeps one chunk mapped, so a machine that is run again does not
+// go back to the kernel for its first allocations
+void heap_reset(Machine *machine) {
+    Heap *heap = &machine->heap;
+    while(heap->large != NULL) {
+        Heap_Block *block = heap->large;
+        heap->large = block->next;
+        munmap(block, block->mapped);
+    }
+    void *keep = heap->chunks;
+    if(keep != NULL) {
+        heap->chunks = *(void**)keep;
+        while(heap->chunks != NULL) {
+            void *chunk = heap->chunks;
+            heap->chunks = *(void**)chunk;
+            munmap(chunk, HEAP_CHUNK);
+        }
+        *(void**)keep = NULL;
+    }
+    Heap_Range *ranges = heap->ranges;
+    size_t range_capacity = heap->range_capacity;
+    *heap = (Heap){0};
+    heap->ranges = ranges;
+    heap->range_capacity = range_capacity;
+    if(keep != NULL) {
+        heap_range_add(heap, keep, HEAP_CHUNK);
+        heap->chunks = keep;
+        heap->bump = (uint8_t*)keep + HEAP_HEADER;
+        heap->bump_end = (uint8_t*)keep + HEAP_CHUNK;
+    }
 }
 
 int64_t my_trunc(double num){
@@ -530,9 +1551,8 @@ char *open_modes[MODES_LENGTH] = {"r", "w", "wr", "a", "rb", "wb", "ab"};
 
 void native_open(Machine *machine){
     Word flag_mode = pop(machine).word;
-    if(flag_mode.as_int > MODES_LENGTH - 1){
-        fprintf(stderr, "error: mode %ld out of bounds\n", flag_mode.as_int);
-        exit(1);
+    if(flag_mode.as_int < 0 || flag_mode.as_int > MODES_LENGTH - 1){
+        TIM_ERROR("error: mode %ld out of bounds\n", flag_mode.as_int);
     }
     Word path = pop(machine).word;
     char *mode = open_modes[flag_mode.as_int];
@@ -544,7 +1564,7 @@ void native_open(Machine *machine){
 void native_write(Machine *machine){
     Word stream = pop(machine).word;
     char *str = (char*)pop(machine).word.as_pointer;    
-    stream.as_pointer = get_stream(stream);
+    stream.as_pointer = stream.as_int == 1 && machine->out != NULL ? machine->out : get_stream(stream);
     int length = strlen(str);
     fwrite(str, 1, length, stream.as_pointer);
 }
@@ -605,15 +1625,12 @@ void native_time(Machine *machine){
 
 void native_exit(Machine *machine){
     int64_t code = pop(machine).word.as_int;
-    exit(code);
+    tim_exit(code);
 }
 
 // end native functions
 
 void push(Machine *machine, Word value, DataType type){
-    if(machine->stack_size >= MAX_STACK_SIZE){
-        TIM_ERROR("error: stack overflow\n");
-    }
     Data data;
     data.word = value;
     data.type = type;
@@ -621,17 +1638,11 @@ void push(Machine *machine, Word value, DataType type){
 }
 
 void push_ptr(Machine *machine, Word *value){
-    if(machine->stack_size >= MAX_STACK_SIZE){
-        TIM_ERROR("error: stack overflow\n");
-    }
     machine->stack[machine->stack_size].type = PTR_TYPE;
     machine->stack[machine->stack_size++].word.as_pointer = value;
 }
 
 Data pop(Machine *machine){
-    if(machine->stack_size <= 0){
-        TIM_ERROR("error: stack underflow\n");
-    }
     machine->stack_size--;
     return machine->stack[machine->stack_size];
 }
@@ -681,56 +1692,329 @@ int cmp_types(Data a){
     }
 }
 
+uint64_t tim_checksum(const uint8_t *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+typedef struct {
+    uint8_t *data;
+    size_t count;
+    size_t capacity;
+} Tim_Bytes;
+
+static void tim_bytes_append(Tim_Bytes *bytes, const void *data, size_t size) {
+    for(size_t i = 0; i < size; i++) DA_APPEND(bytes, ((const uint8_t*)data)[i]);
+}
+
 void write_program_to_file(Machine *machine, char *file_path){
+    if(machine->code == NULL) machine_load_code(machine);
+    // written verified, a process that proves the same forms runs the mapped code as it is
+    machine_verify(machine);
+    machine_load_insts(machine);
+
+    Tim_Bytes sections[TIM_SECTION_COUNT] = {0};
+    tim_bytes_append(&sections[TIM_SECTION_CODE], machine->code, machine->code_size);
+    tim_bytes_append(&sections[TIM_SECTION_POOL], machine->str_pool, machine->str_pool_size);
+    for(size_t i = 0; i <= machine->program_size; i++) {
+        uint64_t offset = machine->code_offsets[i];
+        tim_bytes_append(&sections[TIM_SECTION_OFFSETS], &offset, sizeof(offset));
+    }
+    for(size_t i = 0; i < machine->program_size; i++) {
+        Inst inst = machine->instructions.data[i];
+        Tim_Inst_Record record = {
+            .value = inst.value.as_u64,
+            .type = inst.type,
+            .data_type = inst.data_type,
+            .register_index = inst.register_index,
+        };
+        tim_bytes_append(&sections[TIM_SECTION_INSTS], &record, sizeof(record));
+    }
+    for(size_t i = 0; i < machine->str_stack.count; i++) {
+        String_View str = machine->str_stack.data[i];
+        uint64_t len = str.len;
+        tim_bytes_append(&sections[TIM_SECTION_STRINGS], &len, sizeof(len));
+        tim_bytes_append(&sections[TIM_SECTION_STRINGS], str.data, str.len);
+    }
+    // u32 file count, each file as u32 length and bytes, u32 entry count, then the entries
+    Tim_Bytes *lines = &sections[TIM_SECTION_LINES];
+    uint32_t files = machine->lines.files.count;
+    tim_bytes_append(lines, &files, sizeof(files));
+    for(size_t i = 0; i < files; i++) {
+        String_View file = machine->lines.files.data[i];
+        uint32_t len = file.len;
+        tim_bytes_append(lines, &len, sizeof(len));
+        tim_bytes_append(lines, file.data, file.len);
+    }
+    uint32_t entries = machine->lines.count;
+    tim_bytes_append(lines, &entries, sizeof(entries));
+    tim_bytes_append(lines, machine->lines.data, sizeof(Line_Entry)*entries);
+
+    Tim_Bytes image = {0};
+    Tim_File_Header header = {
+        .magic = TIM_FILE_MAGIC,
+        .version = TIM_FILE_VERSION,
+        .entrypoint = machine->entrypoint,
+        .program_size = machine->program_size,
+        .loops = machine->loops_count,
+        .section_count = TIM_SECTION_COUNT,
+    };
+    tim_bytes_append(&image, &header, sizeof(header));
+    Tim_Section table[TIM_SECTION_COUNT] = {0};
+    size_t offset = sizeof(header) + sizeof(table);
+    for(size_t i = 0; i < TIM_SECTION_COUNT; i++) {
+        offset = (offset + TIM_FILE_ALIGN - 1) / TIM_FILE_ALIGN * TIM_FILE_ALIGN;
+        table[i] = (Tim_Section){.kind = i, .offset = offset, .size = sections[i].count};
+        offset += sections[i].count;
+    }
+    tim_bytes_append(&image, table, sizeof(table));
+    for(size_t i = 0; i < TIM_SECTION_COUNT; i++) {
+        while(image.count < table[i].offset) DA_APPEND(&image, 0);
+        tim_bytes_append(&image, sections[i].data, sections[i].count);
+        free(sections[i].data);
+    }
+    header.checksum = tim_checksum(image.data + sizeof(header), image.count - sizeof(header));
+    memcpy(image.data, &header, sizeof(header));
+
     FILE *file = fopen(file_path, "wb");
     if(file == NULL){
         TIM_ERROR("error: could not write to file\n");
     }
-    fwrite(&machine->str_stack.count, sizeof(size_t), 1, file);
-    for(int i = 0; i < (int)machine->str_stack.count; i++){
-        String_View str = machine->str_stack.data[i];
-        fwrite(&str.len, sizeof(size_t), 1, file);        
-        fwrite(str.data, sizeof(char), str.len, file);
+    if(fwrite(image.data, 1, image.count, file) != image.count) TIM_ERROR("error: could not write to %s\n", file_path);
+    fclose(file);
+    free(image.data);
+}
+
+static void tim_write_uleb(Tim_Bytes *bytes, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if(value != 0) byte |= 0x80;
+        DA_APPEND(bytes, byte);
+    } while(value != 0);
+}
+
+static void tim_write_sleb(Tim_Bytes *bytes, int64_t value) {
+    bool more = true;
+    while(more) {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        more = !((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)));
+        if(more) byte |= 0x80;
+        DA_APPEND(bytes, byte);
     }
+}
 
-    fwrite(&machine->entrypoint, sizeof(size_t), 1, file);
-    fwrite(machine->instructions.data, sizeof(machine->instructions.data[0]), machine->program_size, file);
+static bool tim_is_jump(Inst_Set type) {
+    return type == INST_JMP || type == INST_ZJMP || type == INST_NZJMP || type == INST_CALL || type == INST_LOOP || type == INST_SPAWN;
+}
 
-    fclose(file);
+static bool tim_has_register(Inst_Set type) {
+    return type == INST_PUSH || type == INST_MOV || type == INST_INDEXED_LOAD;
 }
 
-Machine *read_program_from_file(Machine *machine, char *file_path){
-    FILE *file = fopen(file_path, "rb");
+void write_packed_program_to_file(Machine *machine, char *file_path) {
+    machine_load_insts(machine);
+    Tim_Bytes out = {0};
+    tim_bytes_append(&out, TIM_PACKED_MAGIC, 4);
+    tim_write_uleb(&out, TIM_PACKED_VERSION);
+    tim_write_uleb(&out, machine->entrypoint);
+    tim_write_uleb(&out, machine->str_stack.count);
+    for(size_t i = 0; i < machine->str_stack.count; i++) {
+        String_View str = machine->str_stack.data[i];
+        tim_write_uleb(&out, str.len);
+        tim_bytes_append(&out, str.data, str.len);
+    }
+    tim_write_uleb(&out, machine->program_size);
+    for(size_t i = 0; i < machine->program_size; i++) {
+        Inst inst = machine->instructions.data[i];
+        DA_APPEND(&out, (uint8_t)inst.type);
+        if(!has_operand[inst.type]) continue;
+        DA_APPEND(&out, (uint8_t)inst.data_type);
+        if(tim_is_jump(inst.type)) {
+            tim_write_sleb(&out, inst.value.as_int - (int64_t)i);
+        } else if(inst.data_type == FLOAT_TYPE || inst.data_type == DOUBLE_TYPE) {
+            tim_bytes_append(&out, &inst.value.as_u64, sizeof(uint64_t));
+        } else {
+            tim_write_sleb(&out, inst.value.as_int);
+        }
+        if(tim_has_register(inst.type)) tim_write_uleb(&out, inst.register_index);
+    }
+    tim_write_uleb(&out, machine->lines.files.count);
+    for(size_t i = 0; i < machine->lines.files.count; i++) {
+        String_View file = machine->lines.files.data[i];
+        tim_write_uleb(&out, file.len);
+        tim_bytes_append(&out, file.data, file.len);
+    }
+    // starts and lines are relative to the previous entry
+    tim_write_uleb(&out, machine->lines.count);
+    Line_Entry last = {0};
+    for(size_t i = 0; i < machine->lines.count; i++) {
+        Line_Entry entry = machine->lines.data[i];
+        tim_write_uleb(&out, entry.start - last.start);
+        tim_write_uleb(&out, entry.file);
+        tim_write_sleb(&out, (int64_t)entry.line - last.line);
+        last = entry;
+    }
 
+    FILE *file = fopen(file_path, "wb");
     if(file == NULL){
-        TIM_ERROR("error: could not read from file\n");
+        TIM_ERROR("error: could not write to file\n");
     }
+    if(fwrite(out.data, 1, out.count, file) != out.count) TIM_ERROR("error: could not write to %s\n", file_path);
+    fclose(file);
+    free(out.data);
+}
 
-    int index = 0;
-    size_t length;
-    fread(&machine->str_stack.count, 1, sizeof(size_t), file);    
-    for(size_t i = 0; i < machine->str_stack.count; i++) {
-        size_t len = 0;
-        fread(&len, 1, sizeof(size_t), file);        
-        char *str = malloc(sizeof(char)*len);
-        fread(str, sizeof(char), len, file);
-        machine->str_stack.data[i] = view_create(str, len);
+typedef struct {
+    const uint8_t *ptr;
+    const uint8_t *end;
+    char *file_path;
+} Tim_Reader;
+
+static inline uint64_t tim_read_uleb(Tim_Reader *reader) {
+    uint64_t value = 0;
+    for(size_t shift = 0; shift < 64; shift += 7) {
+        if(reader->ptr == reader->end) break;
+        uint8_t byte = *reader->ptr++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return value;
+    }
+    TIM_ERROR("error: %s is not a valid program\n", reader->file_path);
+}
+
+static inline int64_t tim_read_sleb(Tim_Reader *reader) {
+    uint64_t value = 0;
+    for(size_t shift = 0; shift < 64; shift += 7) {
+        if(reader->ptr == reader->end) break;
+        uint8_t byte = *reader->ptr++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            if(shift + 7 < 64 && (byte & 0x40)) value |= ~0ULL << (shift + 7);
+            return (int64_t)value;
+        }
+    }
+    TIM_ERROR("error: %s is not a valid program\n", reader->file_path);
+}
+
+// expands a packed program back into Insts, the strings stay views into the mapping
+static void read_packed_program(Machine *machine, uint8_t *image, size_t size, char *file_path) {
+    Tim_Reader reader = {.ptr = image + 4, .end = image + size, .file_path = file_path};
+    uint64_t version = tim_read_uleb(&reader);
+    if(version != TIM_PACKED_VERSION) {
+        TIM_ERROR("error: %s was compiled for version %lu of the format, recompile it\n", file_path, version);
+    }
+    machine->image = image;
+    machine->image_size = size;
+    machine->entrypoint = tim_read_uleb(&reader);
+    uint64_t str_count = tim_read_uleb(&reader);
+    for(uint64_t i = 0; i < str_count; i++) {
+        uint64_t len = tim_read_uleb(&reader);
+        if(len > (size_t)(reader.end - reader.ptr)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        DA_APPEND(&machine->str_stack, view_create((char*)reader.ptr, len));
+        reader.ptr += len;
+    }
+    uint64_t count = tim_read_uleb(&reader);
+    // every instruction takes at least its opcode byte
+    if(count > (size_t)(reader.end - reader.ptr)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+    Inst *insts = calloc(count, sizeof(Inst));
+    ASSERT(count == 0 || insts != NULL, "outta ram");
+    for(uint64_t i = 0; i < count; i++) {
+        if(reader.ptr == reader.end) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        Inst *inst = &insts[i];
+        inst->type = *reader.ptr++;
+        if(inst->type >= INST_COUNT) TIM_ERROR("error: unknown instruction %d at %lu\n", inst->type, i);
+        if(!has_operand[inst->type]) continue;
+        if(reader.ptr == reader.end) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        inst->data_type = *reader.ptr++;
+        if(tim_is_jump(inst->type)) {
+            inst->value.as_int = (int64_t)i + tim_read_sleb(&reader);
+        } else if(inst->data_type == FLOAT_TYPE || inst->data_type == DOUBLE_TYPE) {
+            if((size_t)(reader.end - reader.ptr) < sizeof(uint64_t)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+            memcpy(&inst->value.as_u64, reader.ptr, sizeof(uint64_t));
+            reader.ptr += sizeof(uint64_t);
+        } else {
+            inst->value.as_int = tim_read_sleb(&reader);
+        }
+        if(tim_has_register(inst->type)) inst->register_index = tim_read_uleb(&reader);
     }
-    index = ftell(file);
+    uint64_t files = tim_read_uleb(&reader);
+    for(uint64_t i = 0; i < files; i++) {
+        uint64_t len = tim_read_uleb(&reader);
+        if(len > (size_t)(reader.end - reader.ptr)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        DA_APPEND(&machine->lines.files, view_create((char*)reader.ptr, len));
+        reader.ptr += len;
+    }
+    uint64_t entries = tim_read_uleb(&reader);
+    Line_Entry last = {0};
+    for(uint64_t i = 0; i < entries; i++) {
+        Line_Entry entry = {0};
+        entry.start = last.start + tim_read_uleb(&reader);
+        entry.file = tim_read_uleb(&reader);
+        entry.line = last.line + tim_read_sleb(&reader);
+        if(entry.file >= files) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        DA_APPEND(&machine->lines, entry);
+        last = entry;
+    }
+    if(machine->entrypoint > count) TIM_ERROR("error: %s is not a valid program\n", file_path);
+    machine->instructions.data = insts;
+    machine->instructions.count = count;
+    machine->instructions.capacity = count;
+    machine->program_size = count;
+    machine_load_code(machine);
+}
 
+static const Tim_Section *tim_section(Machine *machine, Tim_Section_Kind kind) {
+    const Tim_File_Header *header = (const Tim_File_Header*)machine->image;
+    const Tim_Section *table = (const Tim_Section*)(machine->image + sizeof(*header));
+    for(size_t i = 0; i < header->section_count; i++) {
+        if(table[i].kind == kind) return &table[i];
+    }
+    TIM_ERROR("error: program is missing section %d\n", kind);
+}
 
-    fseek(file, 0, SEEK_END);
-    length = ftell(file);
-    fseek(file, index, SEEK_SET);
-    length = length - ftell(file);
-    fread(&machine->entrypoint, sizeof(size_t), 1, file);
-    Inst *instructions = malloc(sizeof(Inst) * length);		
-    length = fread(instructions, sizeof(*instructions), length, file);
+static void machine_map_image(Machine *machine, uint8_t *image, size_t size, char *file_path);
+static bool machine_image_owns(Machine *machine, const void *ptr);
 
-    machine->program_size = length;	
-    machine->instructions.data = instructions;
+// maps the file instead of reading it, the VM runs from the page cache and processes
+// running the same program share it, the mapping stays read only
+Machine *read_program_from_file(Machine *machine, char *file_path){
+    int fd = open(file_path, O_RDONLY);
+    if(fd < 0){
+        TIM_ERROR("error: could not read from file\n");
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0) TIM_ERROR("error: could not read from file\n");
+    size_t size = info.st_size;
+    if(size < 4) TIM_ERROR("error: %s is not a valid program\n", file_path);
+    uint8_t *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED) TIM_ERROR("error: could not map %s\n", file_path);
+    if(memcmp(image, TIM_PACKED_MAGIC, 4) == 0) {
+        read_packed_program(machine, image, size, file_path);
+        return machine;
+    }
+    if(size < sizeof(Tim_File_Header)) TIM_ERROR("error: %s is not a valid program\n", file_path);
 
-	fclose(file);
+    Tim_File_Header header;
+    memcpy(&header, image, sizeof(header));
+    if(memcmp(header.magic, TIM_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        TIM_ERROR("error: %s is not a valid program\n", file_path);
+    }
+    if(header.version != TIM_FILE_VERSION) {
+        TIM_ERROR("error: %s was compiled for version %u of the format, recompile it\n", file_path, header.version);
+    }
+    if(header.section_count > (size - sizeof(header)) / sizeof(Tim_Section)) {
+        TIM_ERROR("error: %s is not a valid program\n", file_path);
+    }
+    if(tim_checksum(image + sizeof(header), size - sizeof(header)) != header.checksum) {
+        TIM_ERROR("error: %s is corrupted, checksum mismatch\n", file_path);
+    }
+    machine_map_image(machine, image, size, file_path);
     return machine;
 }
 
@@ -806,6 +2090,10 @@ void print_operand(Machine *machine, size_t i) {
         		putc('"', stdout);
         		break;
         	}
+        	if(machine->instructions.data[i].type == INST_NATIVE && (value & NATIVE_DECLARED)) {
+        		fprintf(stdout, "%ld (%ld args%s)", NATIVE_INDEX(value), NATIVE_ARGS(value), (value & NATIVE_RETURNS) ? ", returns" : "");
+        		break;
+        	}
         	fprintf(stdout, "%ld", value);				
         } break;
         case FLOAT_TYPE: {
@@ -824,8 +2112,42 @@ void print_operand(Machine *machine, size_t i) {
     }
 }
 	
+void line_table_add(Line_Table *table, size_t index, String_View file, size_t line) {
+    uint32_t id = 0;
+    while(id < table->files.count && !view_cmp(table->files.data[id], file)) id++;
+    if(id == table->files.count) DA_APPEND(&table->files, file);
+    // nothing was emitted at the previous position, so it is replaced
+    if(table->count > 0 && table->data[table->count - 1].start == index) table->count--;
+    if(table->count > 0 && table->data[table->count - 1].file == id && table->data[table->count - 1].line == line) return;
+    DA_APPEND(table, ((Line_Entry){.start = index, .file = id, .line = line}));
+}
+
+bool line_table_find(Line_Table *table, size_t index, String_View *file, size_t *line) {
+    size_t lo = 0;
+    size_t hi = table->count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if(table->data[mid].start <= index) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == 0) return false;
+    Line_Entry entry = table->data[lo - 1];
+    *file = table->files.data[entry.file];
+    *line = entry.line;
+    return true;
+}
+
 void machine_disasm(Machine *machine) {
+	String_View last_file = {0};
+	size_t last_line = 0;
 	for(size_t i = machine->entrypoint; i < machine->program_size; i++) {
+		String_View file;
+		size_t line;
+		if(line_table_find(&machine->lines, i, &file, &line) && (line != last_line || !view_cmp(file, last_file))) {
+			printf("; "View_Print":%zu\n", View_Arg(file), line);
+			last_file = file;
+			last_line = line;
+		}
 		printf("%zu: %s", i, instructions[machine->instructions.data[i].type]);
 		if(has_operand[machine->instructions.data[i].type]) {
 			putc(' ', stdout);
@@ -835,9 +2157,131 @@ void machine_disasm(Machine *machine) {
 	}
 }
 
-int handle_debug_commands(Machine *machine, size_t *i, char *old_command) {
-    int printed = true;
-    char command = fgetc(stdin);
+static Data *debug_slot(Machine *machine, Debug_Slot slot) {
+    if(slot.global) {
+        // a running coroutine has its own stack, the globals stay on the main program's
+        int64_t size = machine->stack == machine->globals ? machine->stack_size : machine->coroutines.data[0].stack_size;
+        if(slot.index < 1 || slot.index > size) return NULL;
+        return &machine->globals[slot.index - 1];
+    }
+    int64_t position = (int64_t)machine->frame_pointer + slot.index;
+    if(position < 0 || position >= machine->stack_size) return NULL;
+    return &machine->stack[position];
+}
+
+// l<k> is frame slot k, g<k> global k, as the operands of load_local and load_global
+static bool debug_parse_slot(char **str, Debug_Slot *slot) {
+    while(**str == ' ') (*str)++;
+    if(**str != 'l' && **str != 'g') return false;
+    slot->global = **str == 'g';
+    char *end;
+    slot->index = strtoll(*str + 1, &end, 10);
+    if(end == *str + 1) return false;
+    *str = end;
+    return true;
+}
+
+static bool debug_parse_op(char **str, Debug_Op *op) {
+    static const struct {
+        const char *text;
+        Debug_Op op;
+    } ops[] = {{"==", DEBUG_EQ}, {"!=", DEBUG_NE}, {"<=", DEBUG_LE}, {">=", DEBUG_GE}, {"<", DEBUG_LT}, {">", DEBUG_GT}};
+    while(**str == ' ') (*str)++;
+    for(size_t i = 0; i < sizeof(ops)/sizeof(*ops); i++) {
+        size_t len = strlen(ops[i].text);
+        if(strncmp(*str, ops[i].text, len) == 0) {
+            *op = ops[i].op;
+            *str += len;
+            return true;
+        }
+    }
+    return false;
+}
+
+static Breakpoint *debug_breakpoint(Machine *machine, size_t ip) {
+    for(size_t i = 0; i < machine->breakpoints.count; i++) {
+        if(machine->breakpoints.data[i].index == ip) return &machine->breakpoints.data[i];
+    }
+    return NULL;
+}
+
+// the opcode is read again on every patch, quickening may have rewritten it meanwhile
+static void debug_patch(Machine *machine, Breakpoint *breakpoint) {
+    uint8_t *op = &machine->code[machine->code_offsets[breakpoint->index]];
+    breakpoint->opcode = *op;
+    *op = INST_BREAK;
+}
+
+static void debug_unpatch(Machine *machine, Breakpoint *breakpoint) {
+    machine->code[machine->code_offsets[breakpoint->index]] = breakpoint->opcode;
+}
+
+static bool debug_condition(Machine *machine, Breakpoint *breakpoint) {
+    if(breakpoint->op == DEBUG_ALWAYS) return true;
+    Data *data = debug_slot(machine, breakpoint->slot);
+    if(data == NULL) return false;
+    int64_t x = data->word.as_int;
+    int64_t y = breakpoint->value;
+    switch(breakpoint->op) {
+        case DEBUG_EQ: return x == y;
+        case DEBUG_NE: return x != y;
+        case DEBUG_LT: return x < y;
+        case DEBUG_GT: return x > y;
+        case DEBUG_LE: return x <= y;
+        case DEBUG_GE: return x >= y;
+        default: return true;
+    }
+}
+
+bool debug_watch_hit(Machine *machine) {
+    for(size_t i = 0; i < machine->watches.count; i++) {
+        Watch *watch = &machine->watches.data[i];
+        if(machine->stack[watch->position].word.as_u64 != watch->value.as_u64) {
+            machine->watches.hit = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// executes the instruction at ip with its own opcode, even when a breakpoint is patched over it
+size_t debug_step(Machine *machine, size_t ip) {
+    Breakpoint *breakpoint = debug_breakpoint(machine, ip);
+    if(breakpoint != NULL) debug_unpatch(machine, breakpoint);
+    size_t next = run_instruction(machine, ip);
+    if(breakpoint != NULL) debug_patch(machine, breakpoint);
+    return next;
+}
+
+// runs at full speed from ip until a breakpoint whose condition holds or a watched slot changes,
+// returns the index it stopped at, program_size once the program halted
+size_t debug_continue(Machine *machine, size_t ip) {
+    ip = debug_step(machine, ip);
+    while(ip < machine->program_size) {
+        if(machine->watches.count > 0 && debug_watch_hit(machine)) {
+            Watch *watch = &machine->watches.data[machine->watches.hit];
+            Word value = machine->stack[watch->position].word;
+            printf("watch %zu: %" PRId64 " -> %" PRId64 "\n", watch->position, watch->value.as_int, value.as_int);
+            watch->value = value;
+            return ip;
+        }
+        Breakpoint *breakpoint = debug_breakpoint(machine, ip);
+        if(breakpoint != NULL && machine->code[machine->code_offsets[ip]] == INST_BREAK) {
+            if(debug_condition(machine, breakpoint)) {
+                printf("breakpoint %zu\n", ip);
+                return ip;
+            }
+            ip = debug_step(machine, ip);
+            continue;
+        }
+        ip = code_offset_to_index(machine, run_code(machine, machine->code_offsets[ip], false));
+    }
+    return ip;
+}
+
+int handle_debug_commands(Machine *machine, size_t *i, char *old_command) {
+    int printed = true;
+    char command = fgetc(stdin);
     if(command == EOF) {
         TIM_ERROR("could not read stdin");
     }
@@ -846,20 +2290,75 @@ int handle_debug_commands(Machine *machine, size_t *i, char *old_command) {
 
     switch(command) {
         case 'n':
-            *i = run_instruction(machine, machine->instructions.data[*i], *i);        
-            *i += 1;
+            *i = debug_step(machine, *i);
             printed = false;
             break;
+        case 'c': {
+            char line[128];
+            if(fgets(line, 128, stdin) == NULL) {
+                TIM_ERROR("could not read stdin");
+            }
+            *i = debug_continue(machine, *i);
+            printed = false;
+        } break;
         case 'b': {
-            char index_str[128] = {0};
-            if(fgets(index_str, 128, stdin) == NULL) {
+            // b <index> [l<slot>|g<slot> <op> <value>]
+            char line[128] = {0};
+            if(fgets(line, 128, stdin) == NULL) {
                 TIM_ERROR("could not read stdin");
             }
-            int index = atoi(index_str);   
-            while(*i < machine->instructions.count && *i <= (size_t)index) {
-                *i = run_instruction(machine, machine->instructions.data[*i], *i);            
-                *i += 1;
+            char *str = line;
+            Breakpoint breakpoint = {.index = strtoull(str, &str, 10)};
+            while(*str == ' ') str++;
+            if(*str != '\n' && *str != '\0' &&
+               (!debug_parse_slot(&str, &breakpoint.slot) || !debug_parse_op(&str, &breakpoint.op))) {
+                fprintf(stdout, "usage: b <index> [l<slot>|g<slot> <op> <value>]\n> ");
+                break;
+            }
+            if(breakpoint.op != DEBUG_ALWAYS) breakpoint.value = strtoll(str, NULL, 0);
+            if(breakpoint.index >= machine->program_size) {
+                fprintf(stdout, "no instruction %zu\n> ", breakpoint.index);
+                break;
+            }
+            Breakpoint *existing = debug_breakpoint(machine, breakpoint.index);
+            if(existing != NULL) {
+                breakpoint.opcode = existing->opcode;
+                *existing = breakpoint;
+            } else {
+                DA_APPEND(&machine->breakpoints, breakpoint);
+                debug_patch(machine, &machine->breakpoints.data[machine->breakpoints.count - 1]);
             }
+            fprintf(stdout, "breakpoint at %zu\n> ", breakpoint.index);
+        } break;
+        case 'd': {
+            char line[128] = {0};
+            if(fgets(line, 128, stdin) == NULL) {
+                TIM_ERROR("could not read stdin");
+            }
+            Breakpoint *breakpoint = debug_breakpoint(machine, strtoull(line, NULL, 10));
+            if(breakpoint == NULL) {
+                fprintf(stdout, "no breakpoint there\n> ");
+                break;
+            }
+            debug_unpatch(machine, breakpoint);
+            *breakpoint = machine->breakpoints.data[--machine->breakpoints.count];
+            fprintf(stdout, "> ");
+        } break;
+        case 'w': {
+            // w l<slot>|g<slot>, a frame slot is watched in the frame that is current now
+            char line[128] = {0};
+            if(fgets(line, 128, stdin) == NULL) {
+                TIM_ERROR("could not read stdin");
+            }
+            char *str = line;
+            Debug_Slot slot;
+            Data *data = debug_parse_slot(&str, &slot) ? debug_slot(machine, slot) : NULL;
+            if(data == NULL) {
+                fprintf(stdout, "usage: w l<slot>|g<slot>, the slot has to be on the stack\n> ");
+                break;
+            }
+            DA_APPEND(&machine->watches, ((Watch){.position = data - machine->stack, .value = data->word}));
+            fprintf(stdout, "watching stack position %zu\n> ", (size_t)(data - machine->stack));
         } break;
         case 'p': {
             char size_str[128] = {0};
@@ -901,6 +2400,11 @@ int handle_debug_commands(Machine *machine, size_t *i, char *old_command) {
         case 's':
             fprintf(stdout, "ss: %d\n>", machine->stack_size);
             break;
+        case 'h': {
+            Heap heap = machine->heap;
+            fprintf(stdout, "allocs: %zu, frees: %zu, live bytes: %zu, peak bytes: %zu\n>",
+                    heap.allocs, heap.frees, heap.live_bytes, heap.peak_bytes);
+        } break;
         case 'q':
             printed = -1;
             break;
@@ -911,6 +2415,10 @@ int handle_debug_commands(Machine *machine, size_t *i, char *old_command) {
 void machine_debug(Machine *machine) {
 	machine_load_native(machine, native_write);
 	machine_load_native(machine, native_exit);
+    if(machine->code == NULL) machine_load_code(machine);
+    // breakpoints are patched into the code
+    machine_own_code(machine);
+    machine_init_stacks(machine);
     size_t i = machine->entrypoint;
     fprintf(stdout, "%zu: ", i);
     //fprintf(stdout, "> ");
@@ -924,6 +2432,9 @@ void machine_debug(Machine *machine) {
     			putc(' ', stdout);
                 print_operand(machine, i);
     		}
+    		String_View file;
+    		size_t line;
+    		if(line_table_find(&machine->lines, i, &file, &line)) fprintf(stdout, " ("View_Print":%zu)", View_Arg(file), line);
     		fprintf(stdout, "\n%zu: ", i);                
         }
         printed = handle_debug_commands(machine, &i, &command);
@@ -931,631 +2442,2884 @@ void machine_debug(Machine *machine) {
 	}
 }
 
+// every stack mapping registers its usable range so the SIGSEGV handler can tell a guard
+// page hit apart from any other fault
+typedef struct {
+    uintptr_t lo;
+    uintptr_t hi;
+    // end of the reserved range, a growable stack is made usable up to a fault below it
+    uintptr_t limit;
+    const char *name;
+    // read-only data rather than a stack, any write into [lo, hi) is the error
+    bool constant;
+} Stack_Guard;
+
+// three per machine and three per live coroutine. an entry sits at the hash of its lo or the
+// first free slot after it, a removed one leaves a tombstone so the entries past it can still
+// be found. a full table is copied into one twice the size, the old one stays allocated
+// until no handler can be scanning it, see stack_guard_reclaim
+#define STACK_GUARDS_INITIAL 1024
+#define STACK_GUARD_TOMBSTONE 1
+typedef struct Stack_Guard_Table {
+    size_t capacity;
+    size_t count;
+    // the tables this one replaced that are not freed yet
+    struct Stack_Guard_Table *retired;
+    Stack_Guard entries[];
+} Stack_Guard_Table;
+static Stack_Guard_Table *stack_guards;
+// handlers between counting themselves in and leaving, one that counted itself in after a
+// table was replaced is sure to load the new one
+static size_t stack_guard_readers;
+static size_t stack_guard_page;
+// machines on other threads map and unmap their stacks at the same time, the handler
+// only reads the table and does not take it
+static pthread_mutex_t stack_guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stack_guard_once = PTHREAD_ONCE_INIT;
+// whatever handled SIGSEGV before, the faults that are not ours are passed on to it
+static struct sigaction stack_guard_prev;
+
+static void stack_guard_write(const char *str) {
+    if(write(STDERR_FILENO, str, strlen(str)) < 0) return;
+}
+
+// the fault happened inside the engine, so the trap can be jumped to like TIM_ERROR does. only
+// a thread that never set one exits here, where stdio can not be flushed safely
+static void stack_guard_fail(const char *prefix, const char *name, const char *suffix) {
+    if(tim_trap != NULL) {
+        char *message = tim_trap->message;
+        size_t size = sizeof(tim_trap->message);
+        message[0] = '\0';
+        strncat(message, prefix, size - 1);
+        strncat(message, name, size - 1 - strlen(message));
+        strncat(message, suffix, size - 1 - strlen(message));
+        siglongjmp(tim_trap->jump, TIM_TRAP_ERROR);
+    }
+    stack_guard_write(prefix);
+    stack_guard_write(name);
+    stack_guard_write(suffix);
+    _exit(1);
+}
+
+static void stack_guard_handler(int sig, siginfo_t *info, void *context) {
+    uintptr_t addr = (uintptr_t)info->si_addr;
+    __atomic_fetch_add(&stack_guard_readers, 1, __ATOMIC_SEQ_CST);
+    Stack_Guard_Table *table = __atomic_load_n(&stack_guards, __ATOMIC_SEQ_CST);
+    for(size_t i = 0; table != NULL && i < table->capacity; i++) {
+        Stack_Guard *guard = &table->entries[i];
+        if(guard->lo <= STACK_GUARD_TOMBSTONE) continue;
+        const char *what = NULL;
+        if(guard->constant) {
+            if(addr < guard->lo || addr >= guard->hi) continue;
+            __atomic_fetch_sub(&stack_guard_readers, 1, __ATOMIC_SEQ_CST);
+            stack_guard_fail("error: cannot write to a ", guard->name, ", copy it first\n");
+        }
+        if(addr >= guard->hi && addr < guard->limit) {
+            // at least doubles, so a deep recursion only faults a few times. mprotect is a
+            // plain system call here, returning runs the faulting access again
+            uintptr_t hi = guard->lo + 2*(guard->hi - guard->lo);
+            uintptr_t need = guard->lo + ((addr - guard->lo)/stack_guard_page + 1)*stack_guard_page;
+            if(hi < need) hi = need;
+            if(hi > guard->limit) hi = guard->limit;
+            if(mprotect((void*)guard->hi, hi - guard->hi, PROT_READ | PROT_WRITE) == 0) {
+                __atomic_store_n(&guard->hi, hi, __ATOMIC_RELAXED);
+                __atomic_fetch_sub(&stack_guard_readers, 1, __ATOMIC_SEQ_CST);
+                return;
+            }
+            what = " overflow\n";
+        } else if(addr >= guard->limit && addr < guard->limit + stack_guard_page) what = " overflow\n";
+        else if(addr < guard->lo && addr >= guard->lo - stack_guard_page) what = " underflow\n";
+        if(what == NULL) continue;
+        __atomic_fetch_sub(&stack_guard_readers, 1, __ATOMIC_SEQ_CST);
+        stack_guard_fail("error: ", guard->name, what);
+    }
+    __atomic_fetch_sub(&stack_guard_readers, 1, __ATOMIC_SEQ_CST);
+    // not one of ours, an embedder's handler gets it as if the engine had never installed one
+    if(stack_guard_prev.sa_flags & SA_SIGINFO) {
+        stack_guard_prev.sa_sigaction(sig, info, context);
+        return;
+    }
+    if(stack_guard_prev.sa_handler != SIG_DFL && stack_guard_prev.sa_handler != SIG_IGN) {
+        stack_guard_prev.sa_handler(sig);
+        return;
+    }
+    // returning re-runs the fault with the default action
+    signal(sig, SIG_DFL);
+}
+
+static void stack_guard_install(void) {
+    stack_guard_page = sysconf(_SC_PAGESIZE);
+    struct sigaction action = {0};
+    action.sa_sigaction = stack_guard_handler;
+    // a host that gave its handler an alternate stack keeps getting it there
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &stack_guard_prev);
+}
+
+static void stack_guard_init(void) {
+    pthread_once(&stack_guard_once, stack_guard_install);
+}
+
+static size_t stack_guard_hash(uintptr_t lo, size_t capacity) {
+    return (size_t)(((uint64_t)(lo >> 12) * 0x9e3779b97f4a7c15ull) >> 32) % capacity;
+}
+
+static void stack_guard_insert(Stack_Guard_Table *table, Stack_Guard guard) {
+    size_t slot = stack_guard_hash(guard.lo, table->capacity);
+    while(table->entries[slot].lo > STACK_GUARD_TOMBSTONE) slot = (slot + 1) % table->capacity;
+    table->entries[slot] = guard;
+    table->count++;
+}
+
+// frees the replaced tables once no handler is scanning one, stack_guard_lock has to be held
+static void stack_guard_reclaim(Stack_Guard_Table *table) {
+    if(table == NULL || table->retired == NULL) return;
+    if(__atomic_load_n(&stack_guard_readers, __ATOMIC_SEQ_CST) != 0) return;
+    while(table->retired != NULL) {
+        Stack_Guard_Table *old = table->retired;
+        table->retired = old->retired;
+        free(old);
+    }
+}
+
+// false when a bigger table could not be allocated
+static bool stack_guard_register(Stack_Guard guard) {
+    pthread_mutex_lock(&stack_guard_lock);
+    Stack_Guard_Table *table = stack_guards;
+    if(table == NULL || (table->count + 1)*4 > table->capacity*3) {
+        size_t capacity = table == NULL ? STACK_GUARDS_INITIAL : table->capacity*2;
+        Stack_Guard_Table *grown = calloc(1, sizeof(Stack_Guard_Table) + capacity*sizeof(Stack_Guard));
+        if(grown == NULL) {
+            pthread_mutex_unlock(&stack_guard_lock);
+            return false;
+        }
+        grown->capacity = capacity;
+        grown->retired = table;
+        for(size_t i = 0; table != NULL && i < table->capacity; i++) {
+            if(table->entries[i].lo > STACK_GUARD_TOMBSTONE) stack_guard_insert(grown, table->entries[i]);
+        }
+        __atomic_store_n(&stack_guards, grown, __ATOMIC_SEQ_CST);
+        table = grown;
+    }
+    stack_guard_insert(table, guard);
+    stack_guard_reclaim(table);
+    pthread_mutex_unlock(&stack_guard_lock);
+    return true;
+}
+
+// the entry registered at lo or NULL, stack_guard_lock has to be held
+static Stack_Guard *stack_guard_find(uintptr_t lo) {
+    Stack_Guard_Table *table = stack_guards;
+    if(table == NULL) return NULL;
+    size_t slot = stack_guard_hash(lo, table->capacity);
+    for(size_t i = 0; i < table->capacity && table->entries[slot].lo != 0; i++, slot = (slot + 1) % table->capacity) {
+        if(table->entries[slot].lo == lo) return &table->entries[slot];
+    }
+    return NULL;
+}
+
+// reserves limit bytes between two guard pages and makes the first bytes of them usable, the
+// rest is only backed once the stack grows into it
+static void *map_growable_stack(size_t bytes, size_t limit, const char *name) {
+    stack_guard_init();
+    size_t page = stack_guard_page;
+    bytes = (bytes + page - 1) / page * page;
+    limit = (limit + page - 1) / page * page;
+    if(limit < bytes) limit = bytes;
+    uint8_t *base = mmap(NULL, limit + 2*page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == MAP_FAILED) TIM_ERROR("error: could not map %zu bytes for the %s\n", limit, name);
+    if(mprotect(base + page, bytes, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, limit + 2*page);
+        TIM_ERROR("error: could not map %zu bytes for the %s\n", bytes, name);
+    }
+    Stack_Guard guard = {.lo = (uintptr_t)(base + page), .hi = (uintptr_t)(base + page + bytes), .limit = (uintptr_t)(base + page + limit), .name = name};
+    if(!stack_guard_register(guard)) {
+        munmap(base, limit + 2*page);
+        TIM_ERROR("error: could not register the guard pages of the %s\n", name);
+    }
+    return base + page;
+}
+
+static void *map_stack(size_t bytes, const char *name) {
+    return map_growable_stack(bytes, bytes, name);
+}
+
+// copies bytes into a fresh mapping and makes it read-only
+static void *map_constants(const void *data, size_t bytes, const char *name) {
+    stack_guard_init();
+    uint8_t *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) TIM_ERROR("error: could not map %zu bytes for the %s\n", bytes, name);
+    memcpy(base, data, bytes);
+    if(mprotect(base, bytes, PROT_READ) != 0) TIM_ERROR("error: could not protect the %s\n", name);
+    if(!stack_guard_register((Stack_Guard){.lo = (uintptr_t)base, .hi = (uintptr_t)(base + bytes), .limit = (uintptr_t)(base + bytes), .name = name, .constant = true})) {
+        munmap(base, bytes);
+        TIM_ERROR("error: could not register the %s\n", name);
+    }
+    return base;
+}
+
+static void stack_guard_forget(void *ptr) {
+    pthread_mutex_lock(&stack_guard_lock);
+    Stack_Guard *guard = stack_guard_find((uintptr_t)ptr);
+    if(guard != NULL) {
+        *guard = (Stack_Guard){.lo = STACK_GUARD_TOMBSTONE};
+        stack_guards->count--;
+    }
+    stack_guard_reclaim(stack_guards);
+    pthread_mutex_unlock(&stack_guard_lock);
+}
+
+static void unmap_stack(void *ptr) {
+    pthread_mutex_lock(&stack_guard_lock);
+    Stack_Guard *guard = stack_guard_find((uintptr_t)ptr);
+    if(guard != NULL) {
+        if(guard->constant) munmap(ptr, guard->hi - guard->lo);
+        else munmap((uint8_t*)ptr - stack_guard_page, guard->limit - guard->lo + 2*stack_guard_page);
+        *guard = (Stack_Guard){.lo = STACK_GUARD_TOMBSTONE};
+        stack_guards->count--;
+    }
+    stack_guard_reclaim(stack_guards);
+    pthread_mutex_unlock(&stack_guard_lock);
+}
+
+void machine_init_stacks(Machine *machine) {
+    if(machine->stack != NULL) return;
+    if(machine->stack_capacity == 0) machine->stack_capacity = DEFAULT_STACK_SIZE;
+    machine->stack = map_stack(machine->stack_capacity*sizeof(Data), "stack");
+    machine->return_stack = map_stack(machine->stack_capacity*sizeof(Call_Frame), "return stack");
+    machine->region_capacity = machine->stack_capacity*sizeof(Data);
+    machine->region = map_stack(machine->region_capacity, "frame region");
+    machine->globals = machine->stack;
+}
+
+// finished coroutines keep this many stack sets mapped for the next spawn
+#define COROUTINE_SPARE 64
+
+static Coroutine *coroutine_get(Machine *machine, Data handle) {
+    if(handle.type != INT_TYPE || handle.word.as_int <= 0 || handle.word.as_u64 >= machine->coroutines.count) {
+        TIM_ERROR("error: no coroutine %" PRId64 "\n", handle.word.as_int);
+    }
+    return &machine->coroutines.data[handle.word.as_u64];
+}
+
+static void coroutine_queue(Coroutines *coroutines, size_t index) {
+    if(coroutines->data[index].queued) return;
+    coroutines->data[index].queued = true;
+    DA_APPEND(&coroutines->queue, index);
+}
+
+// the suspended coroutine that waited longest, 0 when there is none
+static size_t coroutine_next(Coroutines *coroutines) {
+    size_t next = 0;
+    while(next == 0 && coroutines->queue.head < coroutines->queue.count) {
+        size_t index = coroutines->queue.data[coroutines->queue.head++];
+        coroutines->data[index].queued = false;
+        // a resume may have run it in the meantime
+        if(coroutines->data[index].state == COROUTINE_SUSPENDED) next = index;
+    }
+    size_t head = coroutines->queue.head;
+    if(head >= 64 && head*2 >= coroutines->queue.count) {
+        memmove(coroutines->queue.data, coroutines->queue.data + head, (coroutines->queue.count - head)*sizeof(size_t));
+        coroutines->queue.count -= head;
+        coroutines->queue.head = 0;
+    }
+    return next;
+}
+
+static void coroutine_release(Coroutines *coroutines, Coroutine *co) {
+    if(coroutines->spare.count < COROUTINE_SPARE) {
+        DA_APPEND(&coroutines->spare, ((Coroutine_Stacks){co->stack, co->return_stack, co->region}));
+    } else {
+        unmap_stack(co->stack);
+        unmap_stack(co->return_stack);
+        unmap_stack(co->region);
+    }
+    co->stack = NULL;
+    co->return_stack = NULL;
+    co->region = NULL;
+}
+
+// the new coroutine gets the arguments as if they had been pushed for a call to entry, and
+// returns into the halt closing the code, which finishes it
+static size_t coroutine_spawn(Machine *machine, size_t entry, Data *args, size_t argc) {
+    Coroutines *coroutines = &machine->coroutines;
+    if(argc >= machine->stack_capacity) TIM_ERROR("error: cannot spawn with %zu arguments\n", argc);
+    if(coroutines->count == 0) DA_APPEND(coroutines, ((Coroutine){.state = COROUTINE_RUNNING}));
+    Coroutine co = {.state = COROUTINE_SUSPENDED};
+    if(coroutines->spare.count > 0) {
+        Coroutine_Stacks stacks = coroutines->spare.data[--coroutines->spare.count];
+        co.stack = stacks.stack;
+        co.return_stack = stacks.return_stack;
+        co.region = stacks.region;
+    } else {
+        size_t limit = machine->stack_capacity;
+        co.stack = map_growable_stack(COROUTINE_STACK_SIZE*sizeof(Data), limit*sizeof(Data), "coroutine stack");
+        co.return_stack = map_growable_stack(COROUTINE_STACK_SIZE*sizeof(Call_Frame), limit*sizeof(Call_Frame), "coroutine return stack");
+        co.region = map_growable_stack(COROUTINE_STACK_SIZE*sizeof(Data), limit*sizeof(Data), "coroutine frame region");
+    }
+    co.region_capacity = machine->stack_capacity*sizeof(Data);
+    memcpy(co.stack, args, argc*sizeof(Data));
+    co.stack_size = argc;
+    co.frame_pointer = argc;
+    co.return_stack[0] = (Call_Frame){.ret = machine->code_size - 1, .fp = 0};
+    co.return_stack_size = 1;
+    co.pc = entry;
+    DA_APPEND(coroutines, co);
+    coroutine_queue(coroutines, coroutines->count - 1);
+    return coroutines->count - 1;
+}
+
+// stores the running coroutine, which continues at pc, and puts coroutine to in its place,
+// returns the offset to continue at
+static size_t coroutine_switch(Machine *machine, size_t to, size_t pc) {
+    Coroutines *coroutines = &machine->coroutines;
+    Coroutine *from = &coroutines->data[coroutines->current];
+    from->stack = machine->stack;
+    from->stack_size = machine->stack_size;
+    from->return_stack = machine->return_stack;
+    from->return_stack_size = machine->return_stack_size;
+    from->frame_pointer = machine->frame_pointer;
+    from->region = machine->region;
+    from->region_top = machine->region_top;
+    from->region_capacity = machine->region_capacity;
+    from->pc = pc;
+    Coroutine *co = &coroutines->data[to];
+    machine->stack = co->stack;
+    machine->stack_size = co->stack_size;
+    machine->return_stack = co->return_stack;
+    machine->return_stack_size = co->return_stack_size;
+    machine->frame_pointer = co->frame_pointer;
+    machine->region = co->region;
+    machine->region_top = co->region_top;
+    machine->region_capacity = co->region_capacity;
+    coroutines->current = to;
+    return co->pc;
+}
+
+// runs a suspended coroutine until it yields or finishes, with status set the running one
+// gets pushed whether it can run again once it is back
+static size_t coroutine_run(Machine *machine, size_t to, size_t pc, bool status) {
+    Coroutine *co = &machine->coroutines.data[to];
+    co->state = COROUTINE_RUNNING;
+    co->resumer = machine->coroutines.current;
+    co->status = status;
+    return coroutine_switch(machine, to, pc);
+}
+
+// hands control back to whoever ran the running coroutine, when it finished its function
+// returned the value on top of its stack
+static size_t coroutine_leave(Machine *machine, size_t pc, bool done) {
+    Coroutines *coroutines = &machine->coroutines;
+    size_t index = coroutines->current;
+    Coroutine *co = &coroutines->data[index];
+    if(done && machine->stack_size > 0) co->result = machine->stack[machine->stack_size - 1];
+    co->state = done ? COROUTINE_DONE : COROUTINE_SUSPENDED;
+    size_t offset = coroutine_switch(machine, co->resumer, pc);
+    if(done) coroutine_release(coroutines, co);
+    else coroutine_queue(coroutines, index);
+    if(co->status) machine->stack[machine->stack_size++] = (Data){.word.as_int = !done, .type = INT_TYPE};
+    return offset;
+}
+
+// puts the main program's stacks back in the machine and forgets every coroutine
+static void coroutines_reset(Machine *machine) {
+    Coroutines *coroutines = &machine->coroutines;
+    if(coroutines->count == 0) return;
+    if(coroutines->current != 0) coroutine_switch(machine, 0, 0);
+    for(size_t i = 1; i < coroutines->count; i++) {
+        if(coroutines->data[i].stack != NULL) coroutine_release(coroutines, &coroutines->data[i]);
+    }
+    coroutines->count = 0;
+    coroutines->current = 0;
+    coroutines->queue.count = 0;
+    coroutines->queue.head = 0;
+}
+
+static void coroutines_free(Machine *machine) {
+    coroutines_reset(machine);
+    Coroutines *coroutines = &machine->coroutines;
+    for(size_t i = 0; i < coroutines->spare.count; i++) {
+        unmap_stack(coroutines->spare.data[i].stack);
+        unmap_stack(coroutines->spare.data[i].return_stack);
+        unmap_stack(coroutines->spare.data[i].region);
+    }
+    free(coroutines->data);
+    free(coroutines->queue.data);
+    free(coroutines->spare.data);
+    *coroutines = (Coroutines){0};
+}
+
 void machine_free(Machine *machine) {
-	Memory *cur = machine->memory;
-	while(cur != NULL) {
-		Memory *old = cur;
-		cur = cur->next;
-		free_cell(&old);
+	heap_free_all(machine);
+	for(size_t i = 0; i < machine->arenas.count; i++) {
+		if(machine->arenas.data[i].data != NULL) arena_free(&machine->arenas.data[i]);
 	}
+	free(machine->arenas.data);
 	free(machine->instructions.data);
 	free(machine->str_stack.data);
+	free(machine->lines.data);
+	free(machine->lines.files.data);
+	free(machine->breakpoints.data);
+	free(machine->watches.data);
+	if(!machine_image_owns(machine, machine->code)) free(machine->code);
+	if(!machine_image_owns(machine, machine->code_offsets)) free(machine->code_offsets);
+	free(machine->loops);
+	if(machine_image_owns(machine, machine->str_pool)) stack_guard_forget(machine->str_pool);
+	else if(machine->str_pool != NULL) unmap_stack(machine->str_pool);
+	if(machine->image != NULL) munmap(machine->image, machine->image_size);
+	coroutines_free(machine);
+	if(machine->stack != NULL) unmap_stack(machine->stack);
+	if(machine->return_stack != NULL) unmap_stack(machine->return_stack);
+	if(machine->region != NULL) unmap_stack(machine->region);
 } 
 
+// puts a machine back to where it was before run_code so the same program can run again,
+// the stacks, code and args stay as they are
+void machine_reset(Machine *machine) {
+	coroutines_reset(machine);
+	machine->stack_size = 0;
+	machine->return_stack_size = 0;
+	machine->frame_pointer = 0;
+	machine->region_top = 0;
+	heap_reset(machine);
+	for(size_t i = 0; i < machine->arenas.count; i++) {
+		if(machine->arenas.data[i].data != NULL) arena_free(&machine->arenas.data[i]);
+	}
+	machine->arenas.count = 0;
+	memset(machine->registers, 0, sizeof(machine->registers));
+	for(size_t i = 0; i < machine->loops_count; i++) machine->loops[i].count = 0;
+	machine->executed = 0;
+}
+
+// makes machine a second machine running program's code. it shares the code, offsets, strings
+// and line table, which run_code only reads once the code is marked read only, so program has to
+// be verified and must not have run. with its own stacks, heap, arenas and loop counters,
+// machines sharing a program can run on different threads
+void machine_share(Machine *machine, const Machine *program, size_t stack_capacity) {
+	*machine = *program;
+	machine->code_readonly = true;
+	machine->stack = NULL;
+	machine->globals = NULL;
+	machine->return_stack = NULL;
+	machine->region = NULL;
+	machine->stack_size = 0;
+	machine->return_stack_size = 0;
+	machine->frame_pointer = 0;
+	machine->region_top = 0;
+	machine->stack_capacity = stack_capacity;
+	machine->heap = (Heap){0};
+	machine->arenas = (Arenas){0};
+	machine->coroutines = (Coroutines){0};
+	machine->breakpoints = (Breakpoints){0};
+	machine->watches = (Watches){0};
+	machine->profile = NULL;
+	machine->out = NULL;
+	machine->loop_hook = NULL;
+	machine->loops = calloc(program->loops_count + 1, sizeof(Loop_State));
+	ASSERT(machine->loops != NULL, "outta ram");
+	memset(machine->registers, 0, sizeof(machine->registers));
+	memset(machine->args, 0, sizeof(machine->args));
+}
+
+// gives machine a private copy of read only code before something writes it
+void machine_own_code(Machine *machine) {
+	if(!machine->code_readonly) return;
+	uint8_t *code = malloc(machine->code_size);
+	ASSERT(code != NULL, "outta ram");
+	memcpy(code, machine->code, machine->code_size);
+	machine->code = code;
+	machine->code_readonly = false;
+}
+
+// frees what machine_share gave machine, the program it shares stays loaded
+void machine_free_shared(Machine *machine) {
+	machine_reset(machine);
+	coroutines_free(machine);
+	heap_free_all(machine);
+	free(machine->arenas.data);
+	free(machine->loops);
+	if(machine->stack != NULL) unmap_stack(machine->stack);
+	if(machine->return_stack != NULL) unmap_stack(machine->return_stack);
+	if(machine->region != NULL) unmap_stack(machine->region);
+}
+
 void machine_load_native(Machine *machine, native ptr) {
 	ASSERT(ptr != NULL, "function pointer cannot be null: %s", dlerror());
+	if(machine->native_ptrs_s >= sizeof(machine->native_ptrs)/sizeof(*machine->native_ptrs)) {
+		TIM_ERROR("error: too many native functions loaded\n");
+	}
 	machine->native_ptrs[machine->native_ptrs_s++] = ptr;	
 }
 
-size_t run_instruction(Machine *machine, Inst instruction, size_t ip) {
-    Data a, b;
-    switch(instruction.type){
+uint32_t code_read_u32(const uint8_t *ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+Word code_read_word(const uint8_t *ptr) {
+    Word value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+void code_write_u32(uint8_t *ptr, uint32_t value) {
+    memcpy(ptr, &value, sizeof(value));
+}
+
+void code_write_word(uint8_t *ptr, Word value) {
+    memcpy(ptr, &value, sizeof(value));
+}
+
+// opcode an Inst is encoded as, the backend marks the jmp closing a while loop with PTR_TYPE
+Inst_Set code_type(Inst inst) {
+    if(inst.type == INST_JMP && inst.data_type == PTR_TYPE) return INST_LOOP;
+    return inst.type;
+}
+
+// the line table is small and wanted by the samplers while running, so it is decoded up front
+static void machine_map_lines(Machine *machine, char *file_path) {
+    const Tim_Section *lines = tim_section(machine, TIM_SECTION_LINES);
+    const uint8_t *ptr = machine->image + lines->offset;
+    const uint8_t *end = ptr + lines->size;
+    uint32_t files, entries, len;
+    if((size_t)(end - ptr) < sizeof(files)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+    memcpy(&files, ptr, sizeof(files));
+    ptr += sizeof(files);
+    for(uint32_t i = 0; i < files; i++) {
+        if((size_t)(end - ptr) < sizeof(len)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        memcpy(&len, ptr, sizeof(len));
+        ptr += sizeof(len);
+        if(len > (size_t)(end - ptr)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        DA_APPEND(&machine->lines.files, view_create((char*)ptr, len));
+        ptr += len;
+    }
+    if((size_t)(end - ptr) < sizeof(entries)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+    memcpy(&entries, ptr, sizeof(entries));
+    ptr += sizeof(entries);
+    if(entries > (size_t)(end - ptr)/sizeof(Line_Entry)) TIM_ERROR("error: %s is not a valid program\n", file_path);
+    for(uint32_t i = 0; i < entries; i++) {
+        Line_Entry entry;
+        memcpy(&entry, ptr + i*sizeof(entry), sizeof(entry));
+        if(entry.file >= files) TIM_ERROR("error: %s is not a valid program\n", file_path);
+        DA_APPEND(&machine->lines, entry);
+    }
+}
+
+// mapped code never goes through machine_load_code, so it gets the same checks here: every
+// instruction has to decode, push a real type and jump to the start of an instruction
+static void machine_check_code(Machine *machine, char *file_path) {
+    size_t count = machine->program_size;
+    if(machine->code_offsets[0] != 0 || machine->code_offsets[count] + 1 != machine->code_size) {
+        TIM_ERROR("error: %s is not a valid program\n", file_path);
+    }
+    for(size_t i = 0; i < count; i++) {
+        size_t offset = machine->code_offsets[i];
+        uint8_t *pc = machine->code + offset;
+        // quickened and patched opcodes only exist at runtime, they would need the code written
+        if(*pc >= INST_COUNT || (*pc >= INST_ADD_I64_Q && *pc <= INST_CMPLE_F32_Q) || *pc == INST_BREAK ||
+           machine->code_offsets[i + 1] <= offset ||
+           machine->code_offsets[i + 1] != offset + 1 + operand_size[*pc]) {
+            TIM_ERROR("error: %s is not a valid program\n", file_path);
+        }
+        if(*pc == INST_PUSH && pc[1] >= TOP_TYPE) TIM_ERROR("error: unknown data type %d at %zu\n", pc[1], i);
+        if(*pc == INST_MOV && pc[2] > TOP_TYPE) TIM_ERROR("error: unknown data type %d at %zu\n", pc[2], i);
+        if(!tim_is_jump(*pc)) continue;
+        size_t target = code_read_u32(pc + 1);
+        size_t index = code_offset_to_index(machine, target);
+        if(index >= count || machine->code_offsets[index] != target) {
+            TIM_ERROR("error: cannot %s out of bounds to: %zu\n", instructions[*pc], target);
+        }
+        if(*pc == INST_LOOP && code_read_u32(pc + 1 + sizeof(uint32_t)) >= machine->loops_count) {
+            TIM_ERROR("error: %s is not a valid program\n", file_path);
+        }
+    }
+}
+
+static void machine_map_image(Machine *machine, uint8_t *image, size_t size, char *file_path) {
+    machine->image = image;
+    machine->image_size = size;
+    Tim_File_Header header;
+    memcpy(&header, image, sizeof(header));
+    for(size_t kind = 0; kind < TIM_SECTION_COUNT; kind++) {
+        const Tim_Section *section = tim_section(machine, kind);
+        if(section->offset > size || section->size > size - section->offset) {
+            TIM_ERROR("error: %s is not a valid program\n", file_path);
+        }
+    }
+    const Tim_Section *code = tim_section(machine, TIM_SECTION_CODE);
+    const Tim_Section *pool = tim_section(machine, TIM_SECTION_POOL);
+    const Tim_Section *offsets = tim_section(machine, TIM_SECTION_OFFSETS);
+    if(code->size == 0 || image[code->offset + code->size - 1] != INST_HALT ||
+       offsets->size != (header.program_size + 1)*sizeof(uint64_t) || offsets->offset % sizeof(uint64_t) != 0 ||
+       header.entrypoint >= header.program_size + 1) {
+        TIM_ERROR("error: %s is not a valid program\n", file_path);
+    }
+
+    // the code runs straight from the read only mapping, see machine_own_code
+    machine->code = image + code->offset;
+    machine->code_readonly = true;
+    machine->code_size = code->size;
+    // the offsets are stored as 64 bit values
+    if(sizeof(size_t) == sizeof(uint64_t)) {
+        machine->code_offsets = (size_t*)(image + offsets->offset);
+    } else {
+        machine->code_offsets = malloc(sizeof(size_t)*(header.program_size + 1));
+        ASSERT(machine->code_offsets != NULL, "outta ram");
+        for(size_t i = 0; i <= header.program_size; i++) {
+            uint64_t offset;
+            memcpy(&offset, image + offsets->offset + i*sizeof(offset), sizeof(offset));
+            machine->code_offsets[i] = offset;
+        }
+    }
+    machine->str_pool = pool->size == 0 ? NULL : (char*)image + pool->offset;
+    machine->str_pool_size = pool->size;
+    if(machine->str_pool != NULL) {
+        stack_guard_init();
+        uintptr_t end = (uintptr_t)(machine->str_pool + pool->size);
+        if(!stack_guard_register((Stack_Guard){.lo = (uintptr_t)machine->str_pool, .hi = end, .limit = end,
+                                               .name = "string constant", .constant = true})) {
+            TIM_ERROR("error: could not register the string constants of `%s`\n", file_path);
+        }
+    }
+    machine->program_size = header.program_size;
+    machine->entrypoint = header.entrypoint;
+    machine->loops = calloc(header.loops, sizeof(Loop_State));
+    machine->loops_count = header.loops;
+    machine_map_lines(machine, file_path);
+    machine_check_code(machine, file_path);
+    // the unchecked opcodes are only trusted after this process verified the code itself, which
+    // every engine relies on, so it happens here. it only copies the code if the forms it
+    // proves differ from the ones the file was written with
+    machine_verify(machine);
+}
+
+static bool machine_image_owns(Machine *machine, const void *ptr) {
+    return machine->image != NULL && (const uint8_t*)ptr >= machine->image &&
+           (const uint8_t*)ptr < machine->image + machine->image_size;
+}
+
+// the Insts and literals of a mapped program are only decoded for the tools that need them
+void machine_load_insts(Machine *machine) {
+    if(machine->image == NULL || machine->instructions.data != NULL) return;
+    const Tim_Section *insts = tim_section(machine, TIM_SECTION_INSTS);
+    const Tim_Section *strings = tim_section(machine, TIM_SECTION_STRINGS);
+    if(insts->size != machine->program_size*sizeof(Tim_Inst_Record)) TIM_ERROR("error: program is not valid\n");
+    for(size_t i = 0; i < machine->program_size; i++) {
+        Tim_Inst_Record record;
+        memcpy(&record, machine->image + insts->offset + i*sizeof(record), sizeof(record));
+        Inst inst = {
+            .type = record.type,
+            .value = {.as_u64 = record.value},
+            .data_type = record.data_type,
+            .register_index = record.register_index,
+        };
+        DA_APPEND(&machine->instructions, inst);
+    }
+    for(size_t offset = 0; offset < strings->size;) {
+        uint64_t len;
+        if(strings->size - offset < sizeof(len)) TIM_ERROR("error: program is not valid\n");
+        memcpy(&len, machine->image + strings->offset + offset, sizeof(len));
+        offset += sizeof(len);
+        if(len > strings->size - offset) TIM_ERROR("error: program is not valid\n");
+        DA_APPEND(&machine->str_stack, view_create((char*)machine->image + strings->offset + offset, len));
+        offset += len;
+    }
+}
+
+// lays the string literals out back to back, identical ones share an entry, and returns
+// where each str_stack entry ended up
+static size_t *machine_load_strings(Machine *machine) {
+    size_t count = machine->str_stack.count;
+    size_t *pool_offsets = malloc(sizeof(size_t)*(count + 1));
+    ASSERT(pool_offsets != NULL, "outta ram");
+    struct {
+        char *data;
+        size_t count;
+        size_t capacity;
+    } pool = {0};
+    for(size_t i = 0; i < count; i++) {
+        String_View str = machine->str_stack.data[i];
+        pool_offsets[i] = pool.count;
+        for(size_t j = 0; j < i; j++) {
+            String_View other = machine->str_stack.data[j];
+            if(other.len != str.len || memcmp(other.data, str.data, str.len) != 0) continue;
+            pool_offsets[i] = pool_offsets[j];
+            break;
+        }
+        if(pool_offsets[i] != pool.count) continue;
+        for(size_t c = 0; c < str.len; c++) DA_APPEND(&pool, str.data[c]);
+        DA_APPEND(&pool, '\0');
+    }
+
+    if(machine->str_pool != NULL) unmap_stack(machine->str_pool);
+    machine->str_pool = NULL;
+    machine->str_pool_size = pool.count;
+    if(pool.count > 0) machine->str_pool = map_constants(pool.data, pool.count, "string constant");
+    free(pool.data);
+    return pool_offsets;
+}
+
+// translates the Insts array into the compact encoding, jump and call operands
+// become byte offsets so they can be resolved without the offset table
+void machine_load_code(Machine *machine) {
+    size_t count = machine->program_size;
+    size_t *offsets = malloc(sizeof(size_t)*(count + 1));
+    ASSERT(offsets != NULL, "outta ram");
+    size_t size = 0;
+    size_t loops = 0;
+    for(size_t i = 0; i < count; i++) {
+        Inst_Set type = machine->instructions.data[i].type;
+        if(type >= INST_COUNT) TIM_ERROR("error: unknown instruction %d at %zu\n", type, i);
+        type = code_type(machine->instructions.data[i]);
+        if(type == INST_LOOP) loops++;
+        offsets[i] = size;
+        size += 1 + operand_size[type];
+    }
+    offsets[count] = size;
+    if(size >= UINT32_MAX) TIM_ERROR("error: program is too large\n");
+
+    // the trailing halt lets the engine run off the end without a bounds check
+    uint8_t *code = malloc(size + 1);
+    ASSERT(code != NULL, "outta ram");
+    size_t *pool_offsets = machine_load_strings(machine);
+    loops = 0;
+    for(size_t i = 0; i < count; i++) {
+        Inst inst = machine->instructions.data[i];
+        Inst_Set type = code_type(inst);
+        uint8_t *ptr = code + offsets[i];
+        *ptr++ = type;
+        switch(type) {
+            case INST_PUSH:
+                if(inst.data_type >= TOP_TYPE) TIM_ERROR("error: unknown data type %d at %zu\n", inst.data_type, i);
+                *ptr++ = inst.data_type;
+                if(inst.data_type == REGISTER_TYPE) inst.value.as_u64 = inst.register_index;
+                code_write_word(ptr, inst.value);
+                break;
+            case INST_MOV:
+                // top means the value comes off the stack
+                if(inst.data_type > TOP_TYPE) TIM_ERROR("error: unknown data type %d at %zu\n", inst.data_type, i);
+                *ptr++ = inst.register_index;
+                *ptr++ = inst.data_type;
+                code_write_word(ptr, inst.value);
+                break;
+            case INST_PUSH_STR:
+                if(inst.value.as_u64 >= machine->str_stack.count) {
+                    TIM_ERROR("error: string constant %ld does not exist\n", inst.value.as_int);
+                }
+                code_write_u32(ptr, pool_offsets[inst.value.as_u64]);
+                break;
+            case INST_NATIVE:
+            case INST_ENTRYPOINT:
+            case INST_LOAD_LOCAL:
+            case INST_LOAD_GLOBAL:
+            case INST_REGION_RESET:
+            case INST_STORE_LOCAL:
+            case INST_STORE_GLOBAL:
+            case INST_PTR_ADD_IMM:
+            case INST_INDEX_ADDR:
+                code_write_u32(ptr, inst.value.as_int);
+                break;
+            case INST_INDEXED_LOAD:
+                if(inst.value.as_int > (int64_t)sizeof(Word)) TIM_ERROR("error: cannot load %ld bytes\n", inst.value.as_int);
+                *ptr++ = inst.value.as_int;
+                *ptr++ = inst.register_index;
+                break;
+            case INST_LOOP:
+            case INST_JMP:
+            case INST_ZJMP:
+            case INST_NZJMP:
+                if(inst.value.as_int == 0) TIM_ERROR("error: cannot jump to 0\n");
+                // fallthrough
+            case INST_CALL:
+            case INST_SPAWN:
+                if((uint64_t)inst.value.as_int >= count) {
+                    TIM_ERROR("error: cannot %s out of bounds to: %ld\n", instructions[inst.type], inst.value.as_int);
+                }
+                code_write_u32(ptr, offsets[inst.value.as_int]);
+                if(type == INST_LOOP) code_write_u32(ptr + sizeof(uint32_t), loops++);
+                break;
+            default:
+                break;
+        }
+    }
+    code[size] = INST_HALT;
+    free(pool_offsets);
+
+    if(!machine->code_readonly) free(machine->code);
+    free(machine->code_offsets);
+    free(machine->loops);
+    machine->code = code;
+    machine->code_readonly = false;
+    machine->code_size = size + 1;
+    machine->code_offsets = offsets;
+    machine->loops = calloc(loops, sizeof(Loop_State));
+    machine->loops_count = loops;
+    machine->verify_done = false;
+}
+
+// maps a byte offset back to the instruction index, used by the debugger
+size_t code_offset_to_index(Machine *machine, size_t offset) {
+    size_t lo = 0;
+    size_t hi = machine->program_size;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if(machine->code_offsets[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// the jit and cc only follow one stack, programs that spawn coroutines stay interpreted
+bool machine_has_coroutines(Machine *machine) {
+    for(size_t i = 0; i < machine->program_size; i++) {
+        uint8_t op = machine->code[machine->code_offsets[i]];
+        if(op == INST_SPAWN || op == INST_YIELD || op == INST_RESUME || op == INST_JOIN) return true;
+    }
+    return false;
+}
+
+// puts every unchecked opcode back to its checked form
+void machine_unverify(Machine *machine) {
+    for(size_t i = 0; i < machine->program_size; i++) {
+        uint8_t op = machine->code[machine->code_offsets[i]];
+        if(op >= INST_COUNT || checked_base[op] == INST_NOP) continue;
+        machine_own_code(machine);
+        machine->code[machine->code_offsets[i]] = checked_base[op];
+    }
+    machine->verified = false;
+    machine->verify_done = false;
+}
+
+// the verifier interprets the code once with abstract values: every stack slot of a frame
+// gets a tag (or VERIFY_UNKNOWN) and possibly a constant, every ip the depth above the frame
+// pointer. depths have to agree wherever paths meet and every ret of a function has to leave
+// the same depth, that is what call uses as the callee's effect. the lowest position a frame
+// pointer can have is only known once all call sites are, so checks against it are recorded
+// as a depth the ip needs below its frame and settled at the end
+#define VERIFY_UNKNOWN 0xff
+
+typedef struct {
+    uint8_t type;
+    bool constant;
+    int64_t value;
+} Verify_Slot;
+
+typedef struct {
+    bool reached;
+    uint32_t function;
+    int64_t depth;
+    // tags of the slots in [0, depth), nothing is tracked for the caller's slots below
+    Verify_Slot *slots;
+    // lowest depth any frame must allow for the ip to be safe
+    int64_t need;
+    // the same for the checks the unchecked form would drop, fast is false when that form
+    // can not be used at all
+    bool fast;
+    int64_t fast_need;
+} Verify_State;
+
+typedef struct {
+    size_t entry;
+    int64_t base;
+    bool has_ret;
+    int64_t ret;
+} Verify_Function;
+
+typedef struct {
+    Machine *machine;
+    Verify_State *states;
+    struct {
+        Verify_Function *data;
+        size_t count;
+        size_t capacity;
+    } functions;
+    struct {
+        size_t *data;
+        size_t count;
+        size_t capacity;
+    } work;
+    bool *queued;
+    // scratch state of the instruction being interpreted
+    int64_t depth;
+    struct {
+        Verify_Slot *data;
+        size_t count;
+        size_t capacity;
+    } slots;
+    bool ok;
+} Verify;
+
+static Verify_Slot verify_pop(Verify *v) {
+    v->depth--;
+    if(v->depth < 0) return (Verify_Slot){.type = VERIFY_UNKNOWN};
+    v->slots.count--;
+    return v->slots.data[v->slots.count];
+}
+
+static void verify_push(Verify *v, Verify_Slot slot) {
+    if(v->depth >= 0) DA_APPEND(&v->slots, slot);
+    v->depth++;
+}
+
+static void verify_push_type(Verify *v, uint8_t type) {
+    verify_push(v, (Verify_Slot){.type = type});
+}
+
+// the slot k positions below the top, NULL when it belongs to the caller
+static Verify_Slot *verify_peek(Verify *v, int64_t k) {
+    int64_t index = v->depth - k - 1;
+    if(index < 0 || index >= (int64_t)v->slots.count) return NULL;
+    return &v->slots.data[index];
+}
+
+static void verify_forget(Verify *v) {
+    for(size_t i = 0; i < v->slots.count; i++) v->slots.data[i] = (Verify_Slot){.type = VERIFY_UNKNOWN};
+}
+
+static bool verify_constant(Verify_Slot slot, uint8_t type) {
+    return slot.type == type && slot.constant && slot.value >= 0;
+}
+
+// tag the generic ops produce from the tag of their left operand
+static uint8_t verify_bin_type(uint8_t type) {
+    switch(type) {
+        case PTR_TYPE:
+        case U64_TYPE: return U64_TYPE;
+        case CHAR_TYPE:
+        case U8_TYPE: return U8_TYPE;
+        case U16_TYPE:
+        case U32_TYPE:
+        case INT_TYPE:
+        case FLOAT_TYPE:
+        case DOUBLE_TYPE: return type;
+        default: return VERIFY_UNKNOWN;
+    }
+}
+
+static bool verify_target(Verify *v, size_t offset, size_t *index) {
+    Machine *machine = v->machine;
+    *index = code_offset_to_index(machine, offset);
+    return *index < machine->program_size && machine->code_offsets[*index] == offset;
+}
+
+static void verify_flow(Verify *v, uint32_t function, size_t ip) {
+    // running off the end reaches the trailing halt
+    if(ip == v->machine->program_size) return;
+    Verify_State *state = &v->states[ip];
+    if(!state->reached) {
+        state->reached = true;
+        state->function = function;
+        state->depth = v->depth;
+        state->slots = malloc(sizeof(Verify_Slot)*(v->slots.count + 1));
+        ASSERT(state->slots != NULL, "outta ram");
+        memcpy(state->slots, v->slots.data, sizeof(Verify_Slot)*v->slots.count);
+    } else {
+        if(state->function != function || state->depth != v->depth) {
+            v->ok = false;
+            return;
+        }
+        bool changed = false;
+        for(size_t i = 0; i < v->slots.count; i++) {
+            Verify_Slot *slot = &state->slots[i];
+            Verify_Slot other = v->slots.data[i];
+            if(slot->type != other.type && slot->type != VERIFY_UNKNOWN) {
+                slot->type = VERIFY_UNKNOWN;
+                changed = true;
+            }
+            if(slot->constant && (!other.constant || slot->value != other.value)) {
+                slot->constant = false;
+                changed = true;
+            }
+        }
+        if(!changed) return;
+    }
+    if(!v->queued[ip]) {
+        v->queued[ip] = true;
+        DA_APPEND(&v->work, ip);
+    }
+}
+
+static uint32_t verify_function(Verify *v, size_t entry) {
+    for(size_t i = 0; i < v->functions.count; i++) {
+        if(v->functions.data[i].entry == entry) return i;
+    }
+    DA_APPEND(&v->functions, ((Verify_Function){.entry = entry, .base = INT64_MAX}));
+    return v->functions.count - 1;
+}
+
+// interprets the instruction at ip on its recorded state and passes the result on
+static void verify_step(Verify *v, size_t ip) {
+    Machine *machine = v->machine;
+    Verify_State *state = &v->states[ip];
+    uint32_t function = state->function;
+    v->depth = state->depth;
+    v->slots.count = 0;
+    for(int64_t i = 0; i < state->depth; i++) DA_APPEND(&v->slots, state->slots[i]);
+
+    uint8_t *pc = machine->code + machine->code_offsets[ip];
+    Inst_Set op = *pc;
+    if(op >= INST_COUNT || machine->code_offsets[ip] + 1 + operand_size[op] != machine->code_offsets[ip + 1]) {
+        v->ok = false;
+        return;
+    }
+    // code written verified is proven again from its checked forms
+    if(checked_base[op] != INST_NOP) op = checked_base[op];
+    int64_t depth = v->depth;
+    state->need = depth;
+    state->fast = false;
+    state->fast_need = depth;
+    bool falls = true;
+    size_t target;
+    Verify_Slot a, b, c;
+    if(op >= INST_ADD_I64 && op <= INST_CMPLE_F64) {
+        static const uint8_t typed[] = {INT_TYPE, U8_TYPE, U16_TYPE, U32_TYPE, U64_TYPE, FLOAT_TYPE, DOUBLE_TYPE};
+        verify_pop(v);
+        verify_pop(v);
+        verify_push_type(v, typed[(op - INST_ADD_I64) % 7]);
+        state->need = depth - 2;
+        op = INST_NOP;
+    } else if(op >= INST_ADD_I64_Q && op <= INST_CMPLE_F32_Q) {
+        op = INST_ADD;
+    }
+    switch(op) {
         case INST_NOP:
             break;
         case INST_PUSH:
-            if(machine->instructions.data[ip].data_type == REGISTER_TYPE){
-                push(machine, machine->registers[machine->instructions.data[ip].register_index].data, 
-                     machine->registers[machine->instructions.data[ip].register_index].data_type);
+            if(pc[1] == REGISTER_TYPE) {
+                if(code_read_word(pc + 2).as_u64 >= AMOUNT_OF_REGISTERS) v->ok = false;
+                verify_push_type(v, VERIFY_UNKNOWN);
             } else {
-                push(machine, machine->instructions.data[ip].value, machine->instructions.data[ip].data_type);
+                verify_push(v, (Verify_Slot){.type = pc[1], .constant = true, .value = code_read_word(pc + 2).as_int});
             }
             break;
-        case INST_PUSH_STR: {
-            size_t index = machine->instructions.data[ip].value.as_int;
-            String_View str = machine->str_stack.data[index];
-            insert_memory(machine, str.len+1);
-            for(size_t i = 0; i < str.len; i++) {
-                machine->memory->cell.data[i] = str.data[i];
-            }
-machine->memory->cell.data[str.len] = '\0';
-            Word word;
-            word.as_pointer = machine->memory->cell.data;
-            push(machine, word, PTR_TYPE);
-        } break;
+        case INST_PUSH_STR:
+            if(code_read_u32(pc + 1) >= machine->str_pool_size) v->ok = false;
+            verify_push_type(v, PTR_TYPE);
+            break;
         case INST_MOV:
-            if(machine->instructions.data[ip].data_type == TOP_TYPE){
-                machine->registers[machine->instructions.data[ip].register_index].data = machine->stack[machine->stack_size - 1].word;
-                machine->registers[machine->instructions.data[ip].register_index].data_type = machine->stack[machine->stack_size - 1].type;
-            } else {
-                machine->registers[machine->instructions.data[ip].register_index].data = machine->instructions.data[ip].value;
-                machine->registers[machine->instructions.data[ip].register_index].data_type = machine->instructions.data[ip].data_type;
-            }
+            if(pc[1] >= AMOUNT_OF_REGISTERS) v->ok = false;
+            if(pc[2] == TOP_TYPE) state->need = depth - 1;
             break;
-        case INST_REF: {
-            Word *ptr = &machine->stack[machine->stack_size - 1].word;
-            push_ptr(machine, ptr);
-        } break;
-        case INST_DEREF: {
-            Word *ptr = machine->stack[machine->stack_size - 1].word.as_pointer;
-            Data *ref = (Data*)ptr;
-            push(machine, ref->word, ref->type);
+        case INST_SS:
+        case INST_ARENA_NEW:
+            if(op == INST_ARENA_NEW) verify_pop(v);
+            verify_push_type(v, INT_TYPE);
+            break;
+        case INST_REF:
+            verify_push_type(v, PTR_TYPE);
+            state->need = depth - 1;
+            break;
+        case INST_ARG:
+            verify_pop(v);
+            verify_push(v, (Verify_Slot){.type = VERIFY_UNKNOWN});
+            state->need = depth - 1;
+            break;
+        case INST_COPY:
+        case INST_REGION_ALLOC:
+        case INST_INDEX_ADDR:
+            if(op == INST_INDEX_ADDR) verify_pop(v);
+            verify_pop(v);
+            verify_push_type(v, PTR_TYPE);
+            state->need = v->depth - 1;
+            break;
+        case INST_ALLOC:
+            a = verify_pop(v);
+            verify_push_type(v, PTR_TYPE);
+            state->need = depth - 1;
+            state->fast = a.type == INT_TYPE;
+            break;
+        case INST_DEREF:
+            verify_push_type(v, VERIFY_UNKNOWN);
+            state->need = depth - 1;
+            break;
+        case INST_REGION_MARK:
+            verify_push_type(v, U64_TYPE);
+            break;
+        case INST_REGION_RESET: {
+            int64_t slot = (int32_t)code_read_u32(pc + 1);
+            if(slot >= depth) v->ok = false;
+            state->need = slot < depth ? slot : depth;
             break;
         }
-        case INST_ALLOC: {
-            a = pop(machine);
-            if(a.type != INT_TYPE) {
-                TIM_ERROR("error: alloc expected int");
-            }
-uint64_t val = a.word.as_int;
-            insert_memory(machine, val);
-            Word word;
-            word.as_pointer = machine->memory->cell.data;
-            push(machine, word, PTR_TYPE);
-        } break;
-        case INST_DEALLOC: {
-            Data ptr = pop(machine);
-            if(ptr.type != PTR_TYPE) {
-                TIM_ERROR("error: expected ptr");
-            }
-            free_memory(machine, ptr.word.as_pointer);
-        } break;
-        case INST_WRITE: {
-            Data size = pop(machine);                
-            Data data = pop(machine);
-            if(size.type != INT_TYPE) {
-                TIM_ERROR("error: write expected int");                    
-            }
-            if(size.word.as_int < 0) {
-                TIM_ERROR("error: size cannot be negative");                    
-            }
-            Data ptr_data = pop(machine);
-            if(ptr_data.type != PTR_TYPE) {
-                TIM_ERROR("error: expected ptr");                    
-            }
-			uint64_t index = size.word.as_int;
-            void *ptr = ptr_data.word.as_pointer;
-            memcpy(ptr, &data.word, index);                
-        } break;
-        case INST_READ: {
-            Data type = pop(machine);
-            if(type.type != INT_TYPE) {
-                TIM_ERROR("error: expected u8");
-            }
-            Data size = pop(machine);
-            if(size.type != INT_TYPE && size.type != U8_TYPE) {
-                TIM_ERROR("error: read expected int but found %s", str_types[size.type]);
-            }
-            if(size.word.as_int < 0) {
-                TIM_ERROR("error: size cannot be negative");                    
-            }
-            Data ptr_data = pop(machine);
-            if(ptr_data.type != PTR_TYPE) {
-                TIM_ERROR("error: expected pointer");
-            }
-            uint64_t index = size.word.as_int;		
-            GET_TYPE(size, index);
-            void *ptr = ptr_data.word.as_pointer;
-            Data data = {0};                
-            data.type = type.word.as_int;
-            memcpy(&data.word, ptr, index);                
-            push(machine, data.word, data.type);                
-        } break;
+        case INST_ARENA_ALLOC:
+            verify_pop(v);
+            verify_pop(v);
+            verify_push_type(v, PTR_TYPE);
+            state->need = depth - 2;
+            break;
+        case INST_ARENA_RESET:
+        case INST_ARENA_FREE:
+        case INST_DEALLOC:
         case INST_POP:
-            pop(machine);
+        case INST_PRINT:
+            verify_pop(v);
+            state->need = depth - 1;
+            break;
+        case INST_WRITE:
+            a = verify_pop(v);
+            verify_pop(v);
+            b = verify_pop(v);
+            state->need = depth - 3;
+            state->fast = verify_constant(a, INT_TYPE) && b.type == PTR_TYPE;
+            break;
+        case INST_READ:
+            a = verify_pop(v);
+            b = verify_pop(v);
+            c = verify_pop(v);
+            verify_push_type(v, a.constant && a.type == INT_TYPE && a.value >= 0 && a.value < TOP_TYPE ? a.value : VERIFY_UNKNOWN);
+            state->need = depth - 3;
+            state->fast = verify_constant(a, INT_TYPE) && verify_constant(b, INT_TYPE) && c.type == PTR_TYPE;
             break;
         case INST_DUP:
-            a = machine->stack[machine->stack_size - 1];
-            push(machine, a.word, a.type);
+            a = *(verify_peek(v, 0) ? verify_peek(v, 0) : &(Verify_Slot){.type = VERIFY_UNKNOWN});
+            verify_push(v, a);
+            state->need = depth - 1;
             break;
-        case INST_INDUP: {
-Data index = pop(machine);
-if(index.type != INT_TYPE) {
-	TIM_ERROR("error: expected int");
-}
-            index_dup(machine, machine->stack_size-index.word.as_int-1);
-        } break;
         case INST_SWAP: {
-            Data temp = machine->stack[machine->stack_size - 1];
-            machine->stack[machine->stack_size - 1] = machine->stack[machine->stack_size - 2];
-            machine->stack[machine->stack_size - 2] = temp;
-        } break;
+            Verify_Slot *top = verify_peek(v, 0);
+            Verify_Slot *below = verify_peek(v, 1);
+            if(top != NULL && below != NULL) {
+                a = *top;
+                *top = *below;
+                *below = a;
+            } else {
+                verify_forget(v);
+            }
+            state->need = depth - 2;
+            break;
+        }
+        case INST_INDUP:
         case INST_INSWAP: {
-Data index = pop(machine);
-if(index.type != INT_TYPE) {
-	TIM_ERROR("error: expected int");
-}
-            index_swap(machine, machine->stack_size-index.word.as_int-1);
-        } break;
-        case INST_ADD:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, +);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, +);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, +);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, +);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, +);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, +);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, +);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
+            a = verify_pop(v);
+            int64_t k = a.value;
+            bool known = a.constant && a.type == INT_TYPE && k >= 0;
+            Verify_Slot *slot = known ? verify_peek(v, k) : NULL;
+            Verify_Slot *top = verify_peek(v, 0);
+            if(op == INST_INDUP) {
+                verify_push(v, slot != NULL ? *slot : (Verify_Slot){.type = VERIFY_UNKNOWN});
+                state->need = depth - 1;
+            } else {
+                if(slot != NULL && top != NULL) {
+                    b = *slot;
+                    *slot = *top;
+                    *top = b;
+                } else {
+                    verify_forget(v);
+                }
+                state->need = depth - 2;
+            }
+            state->fast = known;
+            state->fast_need = depth - 1 - k - 1;
             break;
+        }
+        case INST_ADD:
         case INST_SUB:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, -);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, -);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, -);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, -);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, -);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, -);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, -);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-            break;
         case INST_MUL:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, *);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, *);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, *);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, *);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, *);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, *);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, *);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-            break;
         case INST_DIV:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            if(machine->stack[machine->stack_size - 1].word.as_int == 0) TIM_ERROR("error: cannot divide by 0\n");
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, /);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, /);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, /);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, /);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, /);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, /);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, /);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
+        case INST_CMPE:
+        case INST_CMPNE:
+        case INST_CMPG:
+        case INST_CMPL:
+        case INST_CMPGE:
+        case INST_CMPLE:
+            verify_pop(v);
+            a = verify_pop(v);
+            verify_push_type(v, verify_bin_type(a.type));
+            state->need = depth - 2;
             break;
         case INST_MOD:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            if(machine->stack[machine->stack_size - 1].word.as_int == 0) TIM_ERROR("error: cannot divide by 0\n");
-            MATH_OP(as_int, %, INT_TYPE);
-            break;
         case INST_AND:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            MATH_OP(as_int, &&, INT_TYPE);
-            break;
         case INST_OR:
-if(machine->stack_size < 1) TIM_ERROR("error: stack underflow\n");
-            MATH_OP(as_int, ||, INT_TYPE);
+            verify_pop(v);
+            verify_pop(v);
+            verify_push_type(v, INT_TYPE);
+            state->need = depth - 2;
             break;
         case INST_ADD_F:
-            MATH_OP(as_float, +, FLOAT_TYPE);
-            break;
         case INST_SUB_F:
-            MATH_OP(as_float, -, FLOAT_TYPE);
-            break;
         case INST_MUL_F:
-            MATH_OP(as_float, *, FLOAT_TYPE);
-            break;
         case INST_DIV_F:
-            if(machine->stack[machine->stack_size - 1].word.as_float == 0.0){
-                TIM_ERROR("error: cannot divide by 0\n");
-            }
-            MATH_OP(as_float, /, FLOAT_TYPE);
-            break;
         case INST_MOD_F:
-            if(machine->stack[machine->stack_size - 1].word.as_float == 0.0){
-                TIM_ERROR("error: cannot divide by 0\n");
-            }
-            b = pop(machine);
-            a = pop(machine);
-            Word c = {.as_float=my_fmod(a.word.as_float, b.word.as_float)};
-            push(machine, c, FLOAT_TYPE);
+            verify_pop(v);
+            verify_pop(v);
+            verify_push_type(v, FLOAT_TYPE);
+            state->need = depth - 2;
             break;
-        case INST_CMPE: {
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, ==);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, ==);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, ==);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, ==);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, ==);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, ==);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, ==);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-        } break;
-        case INST_CMPNE: {
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, !=);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, !=);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, !=);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, !=);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, !=);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, !=);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, !=);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-        } break;
-        case INST_CMPG: {
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, >);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, >);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, >);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, >);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, >);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, >);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, >);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-        } break;
-        case INST_CMPL: {
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, <);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, <);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, <);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, <);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, <);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, <);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, <);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-        } break;
-        case INST_CMPGE: {
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, >=);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, >=);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, >=);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, >=);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, >=);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, >=);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, >=);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-        } break;
-        case INST_CMPLE: {
-            b = machine->stack[machine->stack_size - 1];
-            a = machine->stack[machine->stack_size - 2];
-            machine->stack_size -= 2;
-switch(a.type) {
-	case PTR_TYPE:
-                case U64_TYPE:
-                    TYPE_OP(as_u64, U64_TYPE, <=);
-                    break;
-	case CHAR_TYPE:
-                case U8_TYPE:
-                    TYPE_OP(as_u8, U8_TYPE, <=);
-                    break;
-                case U16_TYPE:
-                    TYPE_OP(as_u16, U16_TYPE, <=);
-                    break;
-                case U32_TYPE:
-                    TYPE_OP(as_u32, U32_TYPE, <=);
-                    break;
-	case INT_TYPE:
-                    TYPE_OP(as_int, INT_TYPE, <=);
-		break;
-	case FLOAT_TYPE:
-                    TYPE_OP(as_float, FLOAT_TYPE, <=);
-		break;
-	case DOUBLE_TYPE:
-                    TYPE_OP(as_double, DOUBLE_TYPE, <=);
-		break;
-	default:
-		TIM_ERROR("error: not right...\n");
-}
-        } break;
         case INST_ITOF:
-            a = pop(machine);
-            a.word.as_float = (double)a.word.as_int; 
-            push(machine, a.word, FLOAT_TYPE);
-            break;
         case INST_FTOI:
-            a = pop(machine);
-            a.word.as_int = (int64_t)a.word.as_float;
-            push(machine, a.word, INT_TYPE);
-            break;
         case INST_ITOC:
-            a = pop(machine);
-            a.word.as_char = (char)a.word.as_int;
-            push(machine, a.word, CHAR_TYPE);
-            break;
         case INST_TOI:
-            machine->stack[machine->stack_size-1].type = INT_TYPE;
-            break;
         case INST_TOF:
-            machine->stack[machine->stack_size-1].type = FLOAT_TYPE;            
-            break;
         case INST_TOC:
-            machine->stack[machine->stack_size-1].type = CHAR_TYPE;            
-            break;
         case INST_TOVP:
-            machine->stack[machine->stack_size-1].type = PTR_TYPE;            
+        case INST_PTR_ADD_IMM: {
+            static const uint8_t converts[INST_COUNT] = {
+                [INST_ITOF] = FLOAT_TYPE, [INST_FTOI] = INT_TYPE, [INST_ITOC] = CHAR_TYPE,
+                [INST_TOI] = INT_TYPE, [INST_TOF] = FLOAT_TYPE, [INST_TOC] = CHAR_TYPE,
+                [INST_TOVP] = PTR_TYPE, [INST_PTR_ADD_IMM] = PTR_TYPE,
+            };
+            verify_pop(v);
+            verify_push_type(v, converts[op]);
+            state->need = depth - 1;
             break;
-        case INST_CALL:
-            machine->return_stack[machine->return_stack_size++] = ip;
-            ip = machine->instructions.data[ip].value.as_int - 1;
+        }
+        case INST_INDEXED_LOAD:
+            verify_pop(v);
+            verify_pop(v);
+            verify_push_type(v, pc[2] < TOP_TYPE ? pc[2] : VERIFY_UNKNOWN);
+            state->need = depth - 2;
             break;
-        case INST_RET:
-            ip = machine->return_stack[--machine->return_stack_size];
+        case INST_LOAD_LOCAL:
+        case INST_STORE_LOCAL: {
+            int64_t slot = (int32_t)code_read_u32(pc + 1);
+            if(op == INST_STORE_LOCAL) a = verify_pop(v);
+            if(slot >= v->depth) v->ok = false;
+            Verify_Slot *local = slot >= 0 && slot < (int64_t)v->slots.count ? &v->slots.data[slot] : NULL;
+            if(op == INST_LOAD_LOCAL) verify_push(v, local != NULL ? *local : (Verify_Slot){.type = VERIFY_UNKNOWN});
+            else if(local != NULL) *local = a;
+            state->need = op == INST_STORE_LOCAL && depth - 1 < slot ? depth - 1 : slot;
+            state->fast = true;
+            state->fast_need = state->need;
             break;
-        case INST_JMP:
-if(machine->instructions.data[ip].value.as_int == 0) TIM_ERROR("error: cannot jump to 0\n");
-            ip = machine->instructions.data[ip].value.as_int - 1;
-            if(ip + 1 >= machine->program_size){
-                TIM_ERROR("error: cannot jmp out of bounds to: %ld\n", machine->instructions.data[ip].value.as_int);
-            }
+        }
+        case INST_LOAD_GLOBAL:
+        case INST_STORE_GLOBAL: {
+            int64_t index = (int64_t)code_read_u32(pc + 1) - 1;
+            if(index < 0) v->ok = false;
+            if(op == INST_STORE_GLOBAL) a = verify_pop(v);
+            // only the entry frame is known to start at the bottom of the stack
+            Verify_Slot *global = function == 0 && index >= 0 && index < (int64_t)v->slots.count ? &v->slots.data[index] : NULL;
+            if(op == INST_LOAD_GLOBAL) verify_push(v, global != NULL ? *global : (Verify_Slot){.type = VERIFY_UNKNOWN});
+            else if(global != NULL) *global = a;
+            else if(function != 0) verify_forget(v);
+            int64_t depth_at = op == INST_LOAD_GLOBAL ? depth : depth - 1;
+            state->need = depth_at - index - 1;
+            if(op == INST_STORE_GLOBAL && depth - 1 < state->need) state->need = depth - 1;
+            state->fast = true;
+            state->fast_need = state->need;
             break;
+        }
+        case INST_JMP:
+        case INST_LOOP:
         case INST_ZJMP:
-if(machine->instructions.data[ip].value.as_int == 0) TIM_ERROR("error: cannot jump to 0\n");					
-            if(pop(machine).word.as_int == 0){
-                ip = machine->instructions.data[ip].value.as_int - 1;
-                if(ip + 1 >= machine->program_size){
-                 TIM_ERROR("error: cannot zjmp out of bounds to: %ld\n", machine->instructions.data[ip].value.as_int);							
-                }
+        case INST_NZJMP:
+            if(op == INST_LOOP && code_read_u32(pc + 5) >= machine->loops_count) v->ok = false;
+            if(op == INST_ZJMP || op == INST_NZJMP) {
+                verify_pop(v);
+                state->need = depth - 1;
             } else {
+                falls = false;
+            }
+            if(!verify_target(v, code_read_u32(pc + 1), &target)) v->ok = false;
+            else verify_flow(v, function, target);
+            break;
+        case INST_CALL: {
+            if(!verify_target(v, code_read_u32(pc + 1), &target)) {
+                v->ok = false;
                 break;
             }
+            uint32_t callee = verify_function(v, target);
+            if(v->states[target].reached && v->states[target].function != callee) {
+                v->ok = false;
+                break;
+            }
+            if(!v->states[target].reached) {
+                Verify_Slot *slots = v->slots.data;
+                size_t count = v->slots.count;
+                int64_t caller_depth = v->depth;
+                v->slots.data = NULL;
+                v->slots.count = 0;
+                v->depth = 0;
+                verify_flow(v, callee, target);
+                v->slots.data = slots;
+                v->slots.count = count;
+                v->depth = caller_depth;
+            }
+            Verify_Function *fn = &v->functions.data[callee];
+            // the callee can write anywhere below it, so nothing known about the frame survives
+            if(!fn->has_ret) {
+                falls = false;
+                break;
+            }
+            verify_forget(v);
+            if(fn->ret < 0) {
+                for(int64_t i = 0; i < -fn->ret; i++) verify_pop(v);
+            } else {
+                for(int64_t i = 0; i < fn->ret; i++) verify_push_type(v, VERIFY_UNKNOWN);
+            }
             break;
-        case INST_NZJMP:
-if(machine->instructions.data[ip].value.as_int == 0) TIM_ERROR("error: cannot jump to 0\n");					
-            if(pop(machine).word.as_int != 0){
-                ip = machine->instructions.data[ip].value.as_int - 1;
-                if(ip + 1 >= machine->program_size){
-                 TIM_ERROR("error: cannot nzjmp out of bounds to: %ld\n", machine->instructions.data[ip].value.as_int);														
+        }
+        case INST_RET: {
+            Verify_Function *fn = &v->functions.data[function];
+            if(function == 0 || (fn->has_ret && fn->ret != depth)) v->ok = false;
+            if(!fn->has_ret) {
+                fn->has_ret = true;
+                fn->ret = depth;
+                // call sites waiting on the callee's effect can continue now
+                for(size_t i = 0; i < machine->program_size; i++) {
+                    if(v->states[i].reached && machine->code[machine->code_offsets[i]] == INST_CALL &&
+                       code_read_u32(machine->code + machine->code_offsets[i] + 1) == machine->code_offsets[fn->entry] &&
+                       !v->queued[i]) {
+                        v->queued[i] = true;
+                        DA_APPEND(&v->work, i);
+                    }
                 }
+            }
+            falls = false;
+            break;
+        }
+        case INST_NATIVE: {
+            uint32_t operand = code_read_u32(pc + 1);
+            uint32_t index = NATIVE_INDEX(operand);
+            native fn = index < machine->native_ptrs_s ? machine->native_ptrs[index] : NULL;
+            if(index >= sizeof(machine->native_ptrs)/sizeof(*machine->native_ptrs)) {
+                v->ok = false;
+            } else if(operand & NATIVE_DECLARED) {
+                // a library call is opaque, but its declaration says what it does to the stack
+                for(uint32_t i = 0; i < NATIVE_ARGS(operand); i++) verify_pop(v);
+                state->need = depth - NATIVE_ARGS(operand);
+                if(operand & NATIVE_RETURNS) verify_push_type(v, VERIFY_UNKNOWN);
+            } else if(fn == native_write) {
+                verify_pop(v);
+                verify_pop(v);
+                state->need = depth - 2;
+            } else if(fn == native_exit) {
+                state->need = depth - 1;
+                falls = false;
             } else {
-                break;
+                // whatever an undeclared native does to the stack is unknown
+                v->ok = false;
             }
             break;
-        case INST_PRINT:
-            a = pop(machine);
-            printf("as float: %f, as int: %ld, as char: %c, as pointer: %p, type: %s\n",
-                    a.word.as_float, a.word.as_int, a.word.as_char, a.word.as_pointer, str_types[a.type]);
+        }
+        case INST_LOAD_LIBRARY:
+            verify_pop(v);
+            verify_pop(v);
+            state->need = depth - 2;
             break;
-        case INST_SS:
-            push(machine, (Word){.as_int=machine->stack_size}, INT_TYPE);
-            break;
-        case INST_NATIVE: {
-            machine->native_ptrs[machine->instructions.data[ip].value.as_int](machine);
-        } break;
-        case INST_ENTRYPOINT:
-            assert(false);
+        case INST_SPAWN:
+        case INST_YIELD:
+        case INST_RESUME:
+        case INST_JOIN:
+            // a coroutine reaches the globals from its own stack, that stays with the checked code
+            v->ok = false;
             break;
         case INST_HALT:
-            ip = machine->program_size;
+            falls = false;
+            break;
+        default:
+            v->ok = false;
             break;
-    case INST_LOAD_LIBRARY: {
-    char *lib_name = (char*)pop(machine).word.as_pointer;			
-    char *func_name = (char*)pop(machine).word.as_pointer;		
-    void *lib = dlopen(lib_name, RTLD_LAZY);		
-    if(!lib) {
-    	fprintf(stderr, "error loading lib: %s\n", dlerror());
-    	exit(1);
-    }
-    native func;
-    *(void**)(&func) = dlsym(lib, func_name);				
-    machine_load_native(machine, func);
-    // WIP FIX THIS
-    /*
-    while(func_name[0] != '\0') {
-    	native func;				
-    	*(void**)(&func) = dlsym(lib, func_name);							
-    	if(!func) {
-    		fprintf(stderr, "error loading function: %s\n", dlerror());
-    		exit(1);
-    	}
-    	machine_load_native(machine, func);
-    	func_name = (char*)pop(machine).word.as_pointer;						
-    }
-    */
-    } break;
-        case INST_COUNT:
-            assert(false);
     }
-    return ip;
+    if(falls && v->ok) verify_flow(v, function, ip + 1);
+}
+
+// proves the depth, targets, frame slots and operand tags for the whole program and rewrites
+// the instructions whose checks that settles, anything it can not follow keeps the checked code
+bool machine_verify(Machine *machine) {
+    // the code only changes when it is loaded again, which starts over
+    if(machine->verify_done) return machine->verified;
+    size_t count = machine->program_size;
+    if(count == 0 || machine->entrypoint >= count) {
+        machine_unverify(machine);
+        machine->verify_done = true;
+        return false;
+    }
+    machine->verify_done = true;
+    Verify v = {
+        .machine = machine,
+        .states = calloc(count + 1, sizeof(Verify_State)),
+        .queued = calloc(count + 1, sizeof(bool)),
+        .ok = true,
+    };
+    ASSERT(v.states != NULL && v.queued != NULL, "outta ram");
+    verify_function(&v, machine->entrypoint);
+    v.functions.data[0].base = 0;
+    verify_flow(&v, 0, machine->entrypoint);
+    while(v.ok && v.work.count > 0) {
+        size_t ip = v.work.data[--v.work.count];
+        v.queued[ip] = false;
+        if(ip >= count) v.ok = false;
+        else verify_step(&v, ip);
+    }
+
+    // lowest frame pointer of every function, relaxed over the call sites until it settles,
+    // a recursion that keeps lowering it has no bound and fails
+    bool changed = true;
+    for(size_t round = 0; v.ok && changed; round++) {
+        if(round > v.functions.count) v.ok = false;
+        changed = false;
+        for(size_t i = 0; v.ok && i < count; i++) {
+            Verify_State *state = &v.states[i];
+            uint8_t *pc = machine->code + machine->code_offsets[i];
+            if(!state->reached || *pc != INST_CALL) continue;
+            int64_t base = v.functions.data[state->function].base;
+            if(base == INT64_MAX) continue;
+            size_t target;
+            verify_target(&v, code_read_u32(pc + 1), &target);
+            Verify_Function *callee = &v.functions.data[verify_function(&v, target)];
+            if(base + state->depth < callee->base) {
+                callee->base = base + state->depth;
+                changed = true;
+            }
+        }
+    }
+    for(size_t i = 0; v.ok && i < count; i++) {
+        Verify_State *state = &v.states[i];
+        if(!state->reached) continue;
+        int64_t base = v.functions.data[state->function].base;
+        if(base + state->need < 0) v.ok = false;
+    }
+    if(v.ok) {
+        static const Inst_Set unchecked[INST_COUNT] = {
+            [INST_LOAD_LOCAL] = INST_LOAD_LOCAL_V,
+            [INST_STORE_LOCAL] = INST_STORE_LOCAL_V,
+            [INST_LOAD_GLOBAL] = INST_LOAD_GLOBAL_V,
+            [INST_STORE_GLOBAL] = INST_STORE_GLOBAL_V,
+            [INST_ALLOC] = INST_ALLOC_V,
+            [INST_WRITE] = INST_WRITE_V,
+            [INST_READ] = INST_READ_V,
+            [INST_INDUP] = INST_INDUP_V,
+            [INST_INSWAP] = INST_INSWAP_V,
+        };
+        // only the opcodes whose form changes are written, code that already has the proven
+        // forms stays read only
+        for(size_t i = 0; i < count; i++) {
+            Verify_State *state = &v.states[i];
+            uint8_t op = machine->code[machine->code_offsets[i]];
+            Inst_Set form = checked_base[op] != INST_NOP ? checked_base[op] : op;
+            int64_t base = state->reached ? v.functions.data[state->function].base : 0;
+            if(state->reached && state->fast && base + state->fast_need >= 0 && unchecked[form] != INST_NOP) {
+                form = unchecked[form];
+            }
+            if(form == op) continue;
+            machine_own_code(machine);
+            machine->code[machine->code_offsets[i]] = form;
+        }
+        machine->verified = true;
+    } else {
+        machine_unverify(machine);
+        machine->verify_done = true;
+    }
+
+    for(size_t i = 0; i <= count; i++) free(v.states[i].slots);
+    free(v.states);
+    free(v.queued);
+    free(v.functions.data);
+    free(v.work.data);
+    free(v.slots.data);
+    return v.ok;
+}
+
+uint64_t profile_now(void) {
+#if defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+#endif
+}
+
+static void profile_enter(Profile *profile, size_t offset) {
+    size_t function = 0;
+    while(function < profile->functions.count && profile->functions.data[function].entry != offset) function++;
+    if(function == profile->functions.count) DA_APPEND(&profile->functions, ((Profile_Function){.entry = offset}));
+    Profile_Function *fn = &profile->functions.data[function];
+    fn->calls++;
+    fn->active++;
+    DA_APPEND(&profile->frames, ((Profile_Frame){.function = function, .start = profile->elapsed}));
+}
+
+static void profile_leave(Profile *profile) {
+    if(profile->frames.count == 0) return;
+    Profile_Frame frame = profile->frames.data[--profile->frames.count];
+    Profile_Function *fn = &profile->functions.data[frame.function];
+    if(--fn->active == 0) fn->total += profile->elapsed - frame.start;
+}
+
+static void profile_charge(Profile *profile, uint64_t now) {
+    uint64_t spent = now - profile->since;
+    profile->ticks[profile->op] += spent;
+    profile->elapsed += spent;
+    profile->functions.data[profile->frames.data[profile->frames.count - 1].function].self += spent;
+}
+
+// charges the time since the last call to the instruction that was running, follows calls
+// and rets to keep the function stack, then starts timing op at offset. its own cost is left out
+void profile_tick(Profile *profile, uint8_t op, size_t offset) {
+    uint64_t now = profile_now();
+    if(profile->frames.count == 0) {
+        profile_enter(profile, offset);
+    } else {
+        profile_charge(profile, now);
+        if(profile->op == INST_CALL) profile_enter(profile, offset);
+        else if(profile->op == INST_RET) profile_leave(profile);
+    }
+    profile->counts[op]++;
+    profile->op = op;
+    profile->since = profile_now();
+}
+
+// charges the last instruction and closes every frame still open
+void profile_finish(Profile *profile) {
+    if(profile->frames.count == 0) return;
+    profile_charge(profile, profile_now());
+    while(profile->frames.count > 0) profile_leave(profile);
 }
 
+#ifdef TIM_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define CASE(inst) L_##inst:
+#define NEXT goto *dispatch[*pc]
+#define REDISPATCH goto *labels[*pc]
+#else
+#define CASE(inst) case inst:
+#define NEXT goto next
+#define REDISPATCH goto redispatch
+#endif
+
+// switching coroutines goes through Machine, the engine state is stored before offset is
+// computed and the next coroutine's loaded after
+#define VM_SWITCH(offset) \
+    do { \
+        machine->stack_size = sp - stack; \
+        machine->return_stack_size = rs; \
+        machine->frame_pointer = fp - stack; \
+        pc = code + (offset); \
+        stack = machine->stack; \
+        sp = stack + machine->stack_size; \
+        fp = stack + machine->frame_pointer; \
+        rs = machine->return_stack_size; \
+    } while(0)
+
+// globals are the bottom of the main program's stack, while a coroutine runs they end where
+// the main program's stack did when it switched away
+#define VM_GLOBALS() (stack == machine->globals ? sp - stack : machine->coroutines.data[0].stack_size)
+
+// runs the compact code starting at byte offset start and returns the offset it stopped at,
+// with step set only a single instruction is executed
+size_t run_code(Machine *machine, size_t start, bool step) {
+#ifdef TIM_THREADED
+    static const void *labels[INST_COUNT] = {
+        [INST_NOP] = &&L_INST_NOP,
+        [INST_PUSH] = &&L_INST_PUSH,
+        [INST_PUSH_STR] = &&L_INST_PUSH_STR,
+        [INST_MOV] = &&L_INST_MOV,
+        [INST_REF] = &&L_INST_REF,
+        [INST_DEREF] = &&L_INST_DEREF,
+        [INST_ALLOC] = &&L_INST_ALLOC,
+        [INST_DEALLOC] = &&L_INST_DEALLOC,
+        [INST_WRITE] = &&L_INST_WRITE,
+        [INST_READ] = &&L_INST_READ,
+        [INST_POP] = &&L_INST_POP,
+        [INST_DUP] = &&L_INST_DUP,
+        [INST_INDUP] = &&L_INST_INDUP,
+        [INST_SWAP] = &&L_INST_SWAP,
+        [INST_INSWAP] = &&L_INST_INSWAP,
+        [INST_ADD] = &&L_INST_ADD,
+        [INST_SUB] = &&L_INST_SUB,
+        [INST_MUL] = &&L_INST_MUL,
+        [INST_DIV] = &&L_INST_DIV,
+        [INST_MOD] = &&L_INST_MOD,
+        [INST_AND] = &&L_INST_AND,
+        [INST_OR] = &&L_INST_OR,
+        [INST_ADD_F] = &&L_INST_ADD_F,
+        [INST_SUB_F] = &&L_INST_SUB_F,
+        [INST_MUL_F] = &&L_INST_MUL_F,
+        [INST_DIV_F] = &&L_INST_DIV_F,
+        [INST_MOD_F] = &&L_INST_MOD_F,
+        [INST_CMPE] = &&L_INST_CMPE,
+        [INST_CMPNE] = &&L_INST_CMPNE,
+        [INST_CMPG] = &&L_INST_CMPG,
+        [INST_CMPL] = &&L_INST_CMPL,
+        [INST_CMPGE] = &&L_INST_CMPGE,
+        [INST_CMPLE] = &&L_INST_CMPLE,
+        [INST_ITOF] = &&L_INST_ITOF,
+        [INST_FTOI] = &&L_INST_FTOI,
+        [INST_ITOC] = &&L_INST_ITOC,
+        [INST_TOI] = &&L_INST_TOI,
+        [INST_TOF] = &&L_INST_TOF,
+        [INST_TOC] = &&L_INST_TOC,
+        [INST_TOVP] = &&L_INST_TOVP,
+        [INST_CALL] = &&L_INST_CALL,
+        [INST_RET] = &&L_INST_RET,
+        [INST_JMP] = &&L_INST_JMP,
+        [INST_ZJMP] = &&L_INST_ZJMP,
+        [INST_NZJMP] = &&L_INST_NZJMP,
+        [INST_PRINT] = &&L_INST_PRINT,
+        [INST_NATIVE] = &&L_INST_NATIVE,
+        [INST_ENTRYPOINT] = &&L_INST_ENTRYPOINT,
+        [INST_LOAD_LIBRARY] = &&L_INST_LOAD_LIBRARY,
+        [INST_SS] = &&L_INST_SS,
+        [INST_HALT] = &&L_INST_HALT,
+        [INST_ADD_I64] = &&L_INST_ADD_I64,
+        [INST_ADD_U8] = &&L_INST_ADD_U8,
+        [INST_ADD_U16] = &&L_INST_ADD_U16,
+        [INST_ADD_U32] = &&L_INST_ADD_U32,
+        [INST_ADD_U64] = &&L_INST_ADD_U64,
+        [INST_ADD_F32] = &&L_INST_ADD_F32,
+        [INST_ADD_F64] = &&L_INST_ADD_F64,
+        [INST_SUB_I64] = &&L_INST_SUB_I64,
+        [INST_SUB_U8] = &&L_INST_SUB_U8,
+        [INST_SUB_U16] = &&L_INST_SUB_U16,
+        [INST_SUB_U32] = &&L_INST_SUB_U32,
+        [INST_SUB_U64] = &&L_INST_SUB_U64,
+        [INST_SUB_F32] = &&L_INST_SUB_F32,
+        [INST_SUB_F64] = &&L_INST_SUB_F64,
+        [INST_MUL_I64] = &&L_INST_MUL_I64,
+        [INST_MUL_U8] = &&L_INST_MUL_U8,
+        [INST_MUL_U16] = &&L_INST_MUL_U16,
+        [INST_MUL_U32] = &&L_INST_MUL_U32,
+        [INST_MUL_U64] = &&L_INST_MUL_U64,
+        [INST_MUL_F32] = &&L_INST_MUL_F32,
+        [INST_MUL_F64] = &&L_INST_MUL_F64,
+        [INST_DIV_I64] = &&L_INST_DIV_I64,
+        [INST_DIV_U8] = &&L_INST_DIV_U8,
+        [INST_DIV_U16] = &&L_INST_DIV_U16,
+        [INST_DIV_U32] = &&L_INST_DIV_U32,
+        [INST_DIV_U64] = &&L_INST_DIV_U64,
+        [INST_DIV_F32] = &&L_INST_DIV_F32,
+        [INST_DIV_F64] = &&L_INST_DIV_F64,
+        [INST_CMPE_I64] = &&L_INST_CMPE_I64,
+        [INST_CMPE_U8] = &&L_INST_CMPE_U8,
+        [INST_CMPE_U16] = &&L_INST_CMPE_U16,
+        [INST_CMPE_U32] = &&L_INST_CMPE_U32,
+        [INST_CMPE_U64] = &&L_INST_CMPE_U64,
+        [INST_CMPE_F32] = &&L_INST_CMPE_F32,
+        [INST_CMPE_F64] = &&L_INST_CMPE_F64,
+        [INST_CMPNE_I64] = &&L_INST_CMPNE_I64,
+        [INST_CMPNE_U8] = &&L_INST_CMPNE_U8,
+        [INST_CMPNE_U16] = &&L_INST_CMPNE_U16,
+        [INST_CMPNE_U32] = &&L_INST_CMPNE_U32,
+        [INST_CMPNE_U64] = &&L_INST_CMPNE_U64,
+        [INST_CMPNE_F32] = &&L_INST_CMPNE_F32,
+        [INST_CMPNE_F64] = &&L_INST_CMPNE_F64,
+        [INST_CMPG_I64] = &&L_INST_CMPG_I64,
+        [INST_CMPG_U8] = &&L_INST_CMPG_U8,
+        [INST_CMPG_U16] = &&L_INST_CMPG_U16,
+        [INST_CMPG_U32] = &&L_INST_CMPG_U32,
+        [INST_CMPG_U64] = &&L_INST_CMPG_U64,
+        [INST_CMPG_F32] = &&L_INST_CMPG_F32,
+        [INST_CMPG_F64] = &&L_INST_CMPG_F64,
+        [INST_CMPL_I64] = &&L_INST_CMPL_I64,
+        [INST_CMPL_U8] = &&L_INST_CMPL_U8,
+        [INST_CMPL_U16] = &&L_INST_CMPL_U16,
+        [INST_CMPL_U32] = &&L_INST_CMPL_U32,
+        [INST_CMPL_U64] = &&L_INST_CMPL_U64,
+        [INST_CMPL_F32] = &&L_INST_CMPL_F32,
+        [INST_CMPL_F64] = &&L_INST_CMPL_F64,
+        [INST_CMPGE_I64] = &&L_INST_CMPGE_I64,
+        [INST_CMPGE_U8] = &&L_INST_CMPGE_U8,
+        [INST_CMPGE_U16] = &&L_INST_CMPGE_U16,
+        [INST_CMPGE_U32] = &&L_INST_CMPGE_U32,
+        [INST_CMPGE_U64] = &&L_INST_CMPGE_U64,
+        [INST_CMPGE_F32] = &&L_INST_CMPGE_F32,
+        [INST_CMPGE_F64] = &&L_INST_CMPGE_F64,
+        [INST_CMPLE_I64] = &&L_INST_CMPLE_I64,
+        [INST_CMPLE_U8] = &&L_INST_CMPLE_U8,
+        [INST_CMPLE_U16] = &&L_INST_CMPLE_U16,
+        [INST_CMPLE_U32] = &&L_INST_CMPLE_U32,
+        [INST_CMPLE_U64] = &&L_INST_CMPLE_U64,
+        [INST_CMPLE_F32] = &&L_INST_CMPLE_F32,
+        [INST_CMPLE_F64] = &&L_INST_CMPLE_F64,
+        [INST_ADD_I64_Q] = &&L_INST_ADD_I64_Q,
+        [INST_ADD_U64_Q] = &&L_INST_ADD_U64_Q,
+        [INST_ADD_U8_Q] = &&L_INST_ADD_U8_Q,
+        [INST_ADD_F32_Q] = &&L_INST_ADD_F32_Q,
+        [INST_SUB_I64_Q] = &&L_INST_SUB_I64_Q,
+        [INST_SUB_U64_Q] = &&L_INST_SUB_U64_Q,
+        [INST_SUB_U8_Q] = &&L_INST_SUB_U8_Q,
+        [INST_SUB_F32_Q] = &&L_INST_SUB_F32_Q,
+        [INST_MUL_I64_Q] = &&L_INST_MUL_I64_Q,
+        [INST_MUL_U64_Q] = &&L_INST_MUL_U64_Q,
+        [INST_MUL_U8_Q] = &&L_INST_MUL_U8_Q,
+        [INST_MUL_F32_Q] = &&L_INST_MUL_F32_Q,
+        [INST_DIV_I64_Q] = &&L_INST_DIV_I64_Q,
+        [INST_DIV_U64_Q] = &&L_INST_DIV_U64_Q,
+        [INST_DIV_U8_Q] = &&L_INST_DIV_U8_Q,
+        [INST_DIV_F32_Q] = &&L_INST_DIV_F32_Q,
+        [INST_CMPE_I64_Q] = &&L_INST_CMPE_I64_Q,
+        [INST_CMPE_U64_Q] = &&L_INST_CMPE_U64_Q,
+        [INST_CMPE_U8_Q] = &&L_INST_CMPE_U8_Q,
+        [INST_CMPE_F32_Q] = &&L_INST_CMPE_F32_Q,
+        [INST_CMPNE_I64_Q] = &&L_INST_CMPNE_I64_Q,
+        [INST_CMPNE_U64_Q] = &&L_INST_CMPNE_U64_Q,
+        [INST_CMPNE_U8_Q] = &&L_INST_CMPNE_U8_Q,
+        [INST_CMPNE_F32_Q] = &&L_INST_CMPNE_F32_Q,
+        [INST_CMPG_I64_Q] = &&L_INST_CMPG_I64_Q,
+        [INST_CMPG_U64_Q] = &&L_INST_CMPG_U64_Q,
+        [INST_CMPG_U8_Q] = &&L_INST_CMPG_U8_Q,
+        [INST_CMPG_F32_Q] = &&L_INST_CMPG_F32_Q,
+        [INST_CMPL_I64_Q] = &&L_INST_CMPL_I64_Q,
+        [INST_CMPL_U64_Q] = &&L_INST_CMPL_U64_Q,
+        [INST_CMPL_U8_Q] = &&L_INST_CMPL_U8_Q,
+        [INST_CMPL_F32_Q] = &&L_INST_CMPL_F32_Q,
+        [INST_CMPGE_I64_Q] = &&L_INST_CMPGE_I64_Q,
+        [INST_CMPGE_U64_Q] = &&L_INST_CMPGE_U64_Q,
+        [INST_CMPGE_U8_Q] = &&L_INST_CMPGE_U8_Q,
+        [INST_CMPGE_F32_Q] = &&L_INST_CMPGE_F32_Q,
+        [INST_CMPLE_I64_Q] = &&L_INST_CMPLE_I64_Q,
+        [INST_CMPLE_U64_Q] = &&L_INST_CMPLE_U64_Q,
+        [INST_CMPLE_U8_Q] = &&L_INST_CMPLE_U8_Q,
+        [INST_CMPLE_F32_Q] = &&L_INST_CMPLE_F32_Q,
+        [INST_LOAD_LOCAL] = &&L_INST_LOAD_LOCAL,
+        [INST_LOAD_GLOBAL] = &&L_INST_LOAD_GLOBAL,
+        [INST_PTR_ADD_IMM] = &&L_INST_PTR_ADD_IMM,
+        [INST_INDEX_ADDR] = &&L_INST_INDEX_ADDR,
+        [INST_INDEXED_LOAD] = &&L_INST_INDEXED_LOAD,
+        [INST_STORE_LOCAL] = &&L_INST_STORE_LOCAL,
+        [INST_STORE_GLOBAL] = &&L_INST_STORE_GLOBAL,
+        [INST_LOOP] = &&L_INST_LOOP,
+        [INST_COPY] = &&L_INST_COPY,
+        [INST_REGION_MARK] = &&L_INST_REGION_MARK,
+        [INST_REGION_ALLOC] = &&L_INST_REGION_ALLOC,
+        [INST_REGION_RESET] = &&L_INST_REGION_RESET,
+        [INST_ARENA_NEW] = &&L_INST_ARENA_NEW,
+        [INST_ARENA_ALLOC] = &&L_INST_ARENA_ALLOC,
+        [INST_ARENA_RESET] = &&L_INST_ARENA_RESET,
+        [INST_ARENA_FREE] = &&L_INST_ARENA_FREE,
+        [INST_LOAD_LOCAL_V] = &&L_INST_LOAD_LOCAL_V,
+        [INST_STORE_LOCAL_V] = &&L_INST_STORE_LOCAL_V,
+        [INST_LOAD_GLOBAL_V] = &&L_INST_LOAD_GLOBAL_V,
+        [INST_STORE_GLOBAL_V] = &&L_INST_STORE_GLOBAL_V,
+        [INST_ALLOC_V] = &&L_INST_ALLOC_V,
+        [INST_WRITE_V] = &&L_INST_WRITE_V,
+        [INST_READ_V] = &&L_INST_READ_V,
+        [INST_INDUP_V] = &&L_INST_INDUP_V,
+        [INST_INSWAP_V] = &&L_INST_INSWAP_V,
+        [INST_BREAK] = &&L_INST_BREAK,
+        [INST_ARG] = &&L_INST_ARG,
+        [INST_SPAWN] = &&L_INST_SPAWN,
+        [INST_YIELD] = &&L_INST_YIELD,
+        [INST_RESUME] = &&L_INST_RESUME,
+        [INST_JOIN] = &&L_INST_JOIN,
+    };
+    // every opcode stops the loop, so dispatching through this after one instruction single steps
+    static const void *trap[INST_COUNT] = {
+        [0 ... INST_COUNT-1] = &&done,
+    };
+    // while profiling every instruction goes through the probe first
+    static const void *probe[INST_COUNT] = {
+        [0 ... INST_COUNT-1] = &&probe,
+    };
+    // while sampling every instruction publishes where it is first
+    static const void *sample[INST_COUNT] = {
+        [0 ... INST_COUNT-1] = &&sample,
+    };
+    static const void *count[INST_COUNT] = {
+        [0 ... INST_COUNT-1] = &&count,
+    };
+    // while watching every instruction first checks the watched slots
+    static const void *watch[INST_COUNT] = {
+        [0 ... INST_COUNT-1] = &&watch,
+    };
+    const void **dispatch = step ? trap : machine->profile != NULL ? probe : machine->sampling ? sample :
+                            machine->counting ? count : machine->watches.count > 0 ? watch : labels;
+#endif
+    uint8_t *code = machine->code;
+    const bool quicken = !machine->code_readonly;
+    uint8_t *pc = code + start;
+    Data *stack = machine->stack;
+    Data *sp = stack + machine->stack_size;
+    Data *fp = stack + machine->frame_pointer;
+    int rs = machine->return_stack_size;
+    Data a, b;
+
+#ifdef TIM_THREADED
+    if(!step) NEXT;
+    goto *labels[*pc];
+probe:
+    profile_tick(machine->profile, *pc, pc - code);
+    goto *labels[*pc];
+sample:
+    machine->sample = (uint64_t)rs << 32 | (uint32_t)(pc - code);
+    goto *labels[*pc];
+count:
+    machine->executed++;
+    goto *labels[*pc];
+watch:
+    if(debug_watch_hit(machine)) goto done;
+    goto *labels[*pc];
+#else
+    for(;;) {
+        if(machine->profile != NULL) profile_tick(machine->profile, *pc, pc - code);
+        if(machine->sampling) machine->sample = (uint64_t)rs << 32 | (uint32_t)(pc - code);
+        if(machine->counting) machine->executed++;
+        if(!step && machine->watches.count > 0 && debug_watch_hit(machine)) goto done;
+    redispatch:
+    switch((Inst_Set)*pc) {
+#endif
+    CASE(INST_NOP)
+        pc++;
+        NEXT;
+    CASE(INST_PUSH) {
+        DataType type = pc[1];
+        Word value = code_read_word(pc + 2);
+        if(type == REGISTER_TYPE) {
+            Register reg = machine->registers[value.as_u64];
+            VM_PUSH(reg.data, reg.data_type);
+        } else {
+            VM_PUSH(value, type);
+        }
+        pc += 2 + sizeof(Word);
+        NEXT;
+    }
+    CASE(INST_PUSH_STR)
+        VM_PUSH((Word){.as_pointer=machine->str_pool + code_read_u32(pc + 1)}, PTR_TYPE);
+        pc += 5;
+        NEXT;
+    CASE(INST_COPY) {
+        VM_POP(a);
+        if(a.type != PTR_TYPE) TIM_ERROR("error: copy expected ptr");
+        size_t len = strlen(a.word.as_pointer);
+        void *copy = heap_alloc(machine, len + 1, false);
+        memcpy(copy, a.word.as_pointer, len + 1);
+        VM_PUSH((Word){.as_pointer=copy}, PTR_TYPE);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_MOV) {
+        Register *reg = &machine->registers[pc[1]];
+        DataType type = pc[2];
+        if(type == TOP_TYPE) {
+            reg->data = sp[-1].word;
+            reg->data_type = sp[-1].type;
+        } else {
+            reg->data = code_read_word(pc + 3);
+            reg->data_type = type;
+        }
+        pc += 3 + sizeof(Word);
+        NEXT;
+    }
+    CASE(INST_REF)
+        VM_PUSH((Word){.as_pointer=&sp[-1].word}, PTR_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DEREF) {
+        Data *ref = sp[-1].word.as_pointer;
+        VM_PUSH(ref->word, ref->type);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_ALLOC)
+        VM_POP(a);
+        if(a.type != INT_TYPE) TIM_ERROR("error: alloc expected int");
+        if(a.word.as_int < 0) TIM_ERROR("error: cannot alloc %ld bytes\n", a.word.as_int);
+        VM_PUSH((Word){.as_pointer=heap_alloc(machine, a.word.as_int, true)}, PTR_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_REGION_MARK)
+        VM_PUSH((Word){.as_u64=machine->region_top}, U64_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_REGION_ALLOC) {
+        VM_POP(a);
+        if(a.type != INT_TYPE || a.word.as_int < 0) TIM_ERROR("error: alloc expected int");
+        size_t size = (a.word.as_u64 + 15) & ~(size_t)15;
+        if(size > machine->region_capacity - machine->region_top) TIM_ERROR("error: frame region overflow\n");
+        uint8_t *ptr = machine->region + machine->region_top;
+        memset(ptr, 0, size);
+        machine->region_top += size;
+        VM_PUSH((Word){.as_pointer=ptr}, PTR_TYPE);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_REGION_RESET)
+        machine->region_top = fp[(int32_t)code_read_u32(pc + 1)].word.as_u64;
+        pc += 5;
+        NEXT;
+    CASE(INST_ARENA_NEW) {
+        VM_POP(a);
+        if(a.type != INT_TYPE) TIM_ERROR("error: arena expected int");
+        size_t capacity = a.word.as_int < ARENA_INIT_SIZE ? ARENA_INIT_SIZE : a.word.as_int;
+        size_t handle = 0;
+        while(handle < machine->arenas.count && machine->arenas.data[handle].data != NULL) handle++;
+        if(handle == machine->arenas.count) DA_APPEND(&machine->arenas, (Arena){0});
+        machine->arenas.data[handle] = arena_init(capacity);
+        VM_PUSH((Word){.as_int=handle}, INT_TYPE);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_ARENA_ALLOC) {
+        VM_POP(b);
+        VM_POP(a);
+        if(b.type != INT_TYPE || b.word.as_int < 0) TIM_ERROR("error: arena_alloc expected int");
+        Arena *arena = machine_arena(machine, a);
+        // keeps words stored into arena memory aligned
+        size_t size = (b.word.as_u64 + 7) & ~(size_t)7;
+        void *ptr = arena_alloc(arena, size);
+        memset(ptr, 0, size);
+        VM_PUSH((Word){.as_pointer=ptr}, PTR_TYPE);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_ARENA_RESET)
+        VM_POP(a);
+        arena_reset(machine_arena(machine, a));
+        pc++;
+        NEXT;
+    CASE(INST_ARENA_FREE) {
+        VM_POP(a);
+        Arena *arena = machine_arena(machine, a);
+        arena_free(arena);
+        arena->data = NULL;
+        pc++;
+        NEXT;
+    }
+    CASE(INST_DEALLOC)
+        VM_POP(a);
+        if(a.type != PTR_TYPE) TIM_ERROR("error: expected ptr");
+        heap_free(machine, a.word.as_pointer);
+        pc++;
+        NEXT;
+    CASE(INST_WRITE) {
+        Data size, data, ptr;
+        VM_POP(size);
+        VM_POP(data);
+        if(size.type != INT_TYPE) TIM_ERROR("error: write expected int");
+        if(size.word.as_int < 0) TIM_ERROR("error: size cannot be negative");
+        VM_POP(ptr);
+        if(ptr.type != PTR_TYPE) TIM_ERROR("error: expected ptr");
+        memcpy(ptr.word.as_pointer, &data.word, size.word.as_int);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_READ) {
+        Data type, size, ptr;
+        VM_POP(type);
+        if(type.type != INT_TYPE) TIM_ERROR("error: expected u8");
+        VM_POP(size);
+        if(size.type != INT_TYPE && size.type != U8_TYPE) {
+            TIM_ERROR("error: read expected int but found %s", str_types[size.type]);
+        }
+        if(size.word.as_int < 0) TIM_ERROR("error: size cannot be negative");
+        VM_POP(ptr);
+        if(ptr.type != PTR_TYPE) TIM_ERROR("error: expected pointer");
+        uint64_t index;
+        GET_TYPE(size, index);
+        Data data = {0};
+        data.type = type.word.as_int;
+        memcpy(&data.word, ptr.word.as_pointer, index);
+        VM_PUSH(data.word, data.type);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_POP)
+        VM_POP(a);
+        pc++;
+        NEXT;
+    CASE(INST_DUP)
+        a = sp[-1];
+        VM_PUSH(a.word, a.type);
+        pc++;
+        NEXT;
+    CASE(INST_INDUP) {
+        VM_POP(a);
+        if(a.type != INT_TYPE) TIM_ERROR("error: expected int");
+        int64_t size = sp - stack;
+        int64_t index = size - a.word.as_int - 1;
+        if(size <= 0) TIM_ERROR("error: stack underflow\n");
+        if(index > size || index < 0) TIM_ERROR("error: index out of range\n");
+        b = stack[index];
+        VM_PUSH(b.word, b.type);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_SWAP)
+        a = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = a;
+        pc++;
+        NEXT;
+    CASE(INST_INSWAP) {
+        VM_POP(a);
+        if(a.type != INT_TYPE) TIM_ERROR("error: expected int");
+        int64_t size = sp - stack;
+        int64_t index = size - a.word.as_int - 1;
+        if(index > size || index < 0) TIM_ERROR("error: index out of range\n");
+        b = stack[index];
+        stack[index] = sp[-1];
+        sp[-1] = b;
+        pc++;
+        NEXT;
+    }
+    CASE(INST_ADD)
+        QUICKEN();
+        BIN_OP(+);
+        pc++;
+        NEXT;
+    CASE(INST_SUB)
+        QUICKEN();
+        BIN_OP(-);
+        pc++;
+        NEXT;
+    CASE(INST_MUL)
+        QUICKEN();
+        BIN_OP(*);
+        pc++;
+        NEXT;
+    CASE(INST_DIV)
+        QUICKEN();
+        if(sp > stack && sp[-1].word.as_int == 0) TIM_ERROR("error: cannot divide by 0\n");
+        BIN_OP(/);
+        pc++;
+        NEXT;
+    CASE(INST_MOD)
+        if(sp > stack && sp[-1].word.as_int == 0) TIM_ERROR("error: cannot divide by 0\n");
+        MATH_OP(as_int, %, INT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_AND)
+        MATH_OP(as_int, &&, INT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_OR)
+        MATH_OP(as_int, ||, INT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_F)
+        MATH_OP(as_float, +, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_F)
+        MATH_OP(as_float, -, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_F)
+        MATH_OP(as_float, *, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_F)
+        if(sp > stack && sp[-1].word.as_float == 0.0) TIM_ERROR("error: cannot divide by 0\n");
+        MATH_OP(as_float, /, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_MOD_F)
+        if(sp > stack && sp[-1].word.as_float == 0.0) TIM_ERROR("error: cannot divide by 0\n");
+        VM_POP(b);
+        VM_POP(a);
+        VM_PUSH((Word){.as_float=my_fmod(a.word.as_float, b.word.as_float)}, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE)
+        QUICKEN();
+        BIN_OP(==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE)
+        QUICKEN();
+        BIN_OP(!=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG)
+        QUICKEN();
+        BIN_OP(>);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL)
+        QUICKEN();
+        BIN_OP(<);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE)
+        QUICKEN();
+        BIN_OP(>=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE)
+        QUICKEN();
+        BIN_OP(<=);
+        pc++;
+        NEXT;
+    CASE(INST_ITOF)
+        VM_POP(a);
+        a.word.as_float = (double)a.word.as_int;
+        VM_PUSH(a.word, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_FTOI)
+        VM_POP(a);
+        a.word.as_int = (int64_t)a.word.as_float;
+        VM_PUSH(a.word, INT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_ITOC)
+        VM_POP(a);
+        a.word.as_char = (char)a.word.as_int;
+        VM_PUSH(a.word, CHAR_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_TOI)
+        sp[-1].type = INT_TYPE;
+        pc++;
+        NEXT;
+    CASE(INST_TOF)
+        sp[-1].type = FLOAT_TYPE;
+        pc++;
+        NEXT;
+    CASE(INST_TOC)
+        sp[-1].type = CHAR_TYPE;
+        pc++;
+        NEXT;
+    CASE(INST_TOVP)
+        sp[-1].type = PTR_TYPE;
+        pc++;
+        NEXT;
+    CASE(INST_CALL)
+        machine->return_stack[rs].ret = pc + 5 - code;
+        machine->return_stack[rs].fp = fp - stack;
+        rs++;
+        fp = sp;
+        pc = code + code_read_u32(pc + 1);
+        NEXT;
+    CASE(INST_RET)
+        rs--;
+        pc = code + machine->return_stack[rs].ret;
+        fp = stack + machine->return_stack[rs].fp;
+        NEXT;
+    CASE(INST_JMP)
+        pc = code + code_read_u32(pc + 1);
+        NEXT;
+    CASE(INST_LOOP) {
+        size_t target = code_read_u32(pc + 1);
+        uint32_t index = code_read_u32(pc + 5);
+        pc = code + target;
+        if(machine->loop_hook != NULL && !step) {
+            Loop_State *loop = &machine->loops[index];
+            if(loop->trace != NULL || ++loop->count == HOT_LOOP) {
+                machine->stack_size = sp - stack;
+                machine->return_stack_size = rs;
+                machine->frame_pointer = fp - stack;
+                pc = code + machine->loop_hook(machine, index, target);
+                sp = stack + machine->stack_size;
+                rs = machine->return_stack_size;
+                fp = stack + machine->frame_pointer;
+            }
+        }
+        NEXT;
+    }
+    CASE(INST_ZJMP)
+        VM_POP(a);
+        if(a.word.as_int == 0) pc = code + code_read_u32(pc + 1);
+        else pc += 5;
+        NEXT;
+    CASE(INST_NZJMP)
+        VM_POP(a);
+        if(a.word.as_int != 0) pc = code + code_read_u32(pc + 1);
+        else pc += 5;
+        NEXT;
+    CASE(INST_PRINT)
+        VM_POP(a);
+        printf("as float: %f, as int: %ld, as char: %c, as pointer: %p, type: %s\n",
+                a.word.as_float, a.word.as_int, a.word.as_char, a.word.as_pointer, str_types[a.type]);
+        pc++;
+        NEXT;
+    CASE(INST_NATIVE)
+        VM_SAVE();
+        machine->native_ptrs[NATIVE_INDEX(code_read_u32(pc + 1))](machine);
+        VM_LOAD();
+        pc += 5;
+        NEXT;
+    CASE(INST_ENTRYPOINT)
+        assert(false);
+        NEXT;
+    CASE(INST_LOAD_LIBRARY) {
+        VM_POP(a);
+        VM_POP(b);
+        char *lib_name = (char*)a.word.as_pointer;
+        char *func_name = (char*)b.word.as_pointer;
+        void *lib = dlopen(lib_name, RTLD_LAZY);
+        if(!lib) TIM_ERROR("error loading lib: %s\n", dlerror());
+        native func;
+        *(void**)(&func) = dlsym(lib, func_name);
+        if(func == NULL) TIM_ERROR("error loading %s from %s: %s\n", func_name, lib_name, dlerror());
+        machine_load_native(machine, func);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_SS)
+        VM_PUSH((Word){.as_int=sp - stack}, INT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_HALT) {
+        // a coroutine's function returned into the halt closing the code
+        if(machine->coroutines.current != 0) {
+            VM_SWITCH(coroutine_leave(machine, pc - code, true));
+            NEXT;
+        }
+        // the main program waits here for every coroutine that has not finished
+        size_t next = coroutine_next(&machine->coroutines);
+        if(next != 0) {
+            VM_SWITCH(coroutine_run(machine, next, pc - code, false));
+            NEXT;
+        }
+        pc = code + machine->code_size - 1;
+        goto done;
+    }
+    CASE(INST_ADD_I64)
+        TYPED_OP(as_int, INT_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_U8)
+        TYPED_OP(as_u8, U8_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_U16)
+        TYPED_OP(as_u16, U16_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_U32)
+        TYPED_OP(as_u32, U32_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_U64)
+        TYPED_OP(as_u64, U64_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, +);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_I64)
+        TYPED_OP(as_int, INT_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_U8)
+        TYPED_OP(as_u8, U8_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_U16)
+        TYPED_OP(as_u16, U16_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_U32)
+        TYPED_OP(as_u32, U32_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_U64)
+        TYPED_OP(as_u64, U64_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, -);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_I64)
+        TYPED_OP(as_int, INT_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_U8)
+        TYPED_OP(as_u8, U8_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_U16)
+        TYPED_OP(as_u16, U16_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_U32)
+        TYPED_OP(as_u32, U32_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_U64)
+        TYPED_OP(as_u64, U64_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, *);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_I64)
+        TYPED_DIV(as_int, INT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_U8)
+        TYPED_DIV(as_u8, U8_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_U16)
+        TYPED_DIV(as_u16, U16_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_U32)
+        TYPED_DIV(as_u32, U32_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_U64)
+        TYPED_DIV(as_u64, U64_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_F32)
+        TYPED_DIV(as_float, FLOAT_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_F64)
+        TYPED_DIV(as_double, DOUBLE_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_I64)
+        TYPED_OP(as_int, INT_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_U8)
+        TYPED_OP(as_u8, U8_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_U16)
+        TYPED_OP(as_u16, U16_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_U32)
+        TYPED_OP(as_u32, U32_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_U64)
+        TYPED_OP(as_u64, U64_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, ==);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_I64)
+        TYPED_OP(as_int, INT_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_U8)
+        TYPED_OP(as_u8, U8_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_U16)
+        TYPED_OP(as_u16, U16_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_U32)
+        TYPED_OP(as_u32, U32_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_U64)
+        TYPED_OP(as_u64, U64_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, !=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_I64)
+        TYPED_OP(as_int, INT_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_U8)
+        TYPED_OP(as_u8, U8_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_U16)
+        TYPED_OP(as_u16, U16_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_U32)
+        TYPED_OP(as_u32, U32_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_U64)
+        TYPED_OP(as_u64, U64_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, >);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_I64)
+        TYPED_OP(as_int, INT_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_U8)
+        TYPED_OP(as_u8, U8_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_U16)
+        TYPED_OP(as_u16, U16_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_U32)
+        TYPED_OP(as_u32, U32_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_U64)
+        TYPED_OP(as_u64, U64_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, <);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_I64)
+        TYPED_OP(as_int, INT_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_U8)
+        TYPED_OP(as_u8, U8_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_U16)
+        TYPED_OP(as_u16, U16_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_U32)
+        TYPED_OP(as_u32, U32_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_U64)
+        TYPED_OP(as_u64, U64_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, >=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_I64)
+        TYPED_OP(as_int, INT_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_U8)
+        TYPED_OP(as_u8, U8_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_U16)
+        TYPED_OP(as_u16, U16_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_U32)
+        TYPED_OP(as_u32, U32_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_U64)
+        TYPED_OP(as_u64, U64_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_F32)
+        TYPED_OP(as_float, FLOAT_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_F64)
+        TYPED_OP(as_double, DOUBLE_TYPE, <=);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, +, INST_ADD);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, +, INST_ADD);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, +, INST_ADD);
+        pc++;
+        NEXT;
+    CASE(INST_ADD_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, +, INST_ADD);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, -, INST_SUB);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, -, INST_SUB);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, -, INST_SUB);
+        pc++;
+        NEXT;
+    CASE(INST_SUB_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, -, INST_SUB);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, *, INST_MUL);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, *, INST_MUL);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, *, INST_MUL);
+        pc++;
+        NEXT;
+    CASE(INST_MUL_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, *, INST_MUL);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_I64_Q)
+        QUICK_DIV(as_int, INT_TYPE, INST_DIV);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_U64_Q)
+        QUICK_DIV(as_u64, U64_TYPE, INST_DIV);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_U8_Q)
+        QUICK_DIV(as_u8, U8_TYPE, INST_DIV);
+        pc++;
+        NEXT;
+    CASE(INST_DIV_F32_Q)
+        QUICK_DIV(as_float, FLOAT_TYPE, INST_DIV);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, ==, INST_CMPE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, ==, INST_CMPE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, ==, INST_CMPE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPE_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, ==, INST_CMPE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, !=, INST_CMPNE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, !=, INST_CMPNE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, !=, INST_CMPNE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPNE_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, !=, INST_CMPNE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, >, INST_CMPG);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, >, INST_CMPG);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, >, INST_CMPG);
+        pc++;
+        NEXT;
+    CASE(INST_CMPG_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, >, INST_CMPG);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, <, INST_CMPL);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, <, INST_CMPL);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, <, INST_CMPL);
+        pc++;
+        NEXT;
+    CASE(INST_CMPL_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, <, INST_CMPL);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, >=, INST_CMPGE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, >=, INST_CMPGE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, >=, INST_CMPGE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPGE_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, >=, INST_CMPGE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_I64_Q)
+        QUICK_OP(as_int, INT_TYPE, <=, INST_CMPLE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_U64_Q)
+        QUICK_OP(as_u64, U64_TYPE, <=, INST_CMPLE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_U8_Q)
+        QUICK_OP(as_u8, U8_TYPE, <=, INST_CMPLE);
+        pc++;
+        NEXT;
+    CASE(INST_CMPLE_F32_Q)
+        QUICK_OP(as_float, FLOAT_TYPE, <=, INST_CMPLE);
+        pc++;
+        NEXT;
+    CASE(INST_LOAD_LOCAL) {
+        Data *slot = fp + (int32_t)code_read_u32(pc + 1);
+        if(slot < stack || slot >= sp) TIM_ERROR("error: index out of range\n");
+        a = *slot;
+        VM_PUSH(a.word, a.type);
+        pc += 5;
+        NEXT;
+    }
+    CASE(INST_LOAD_GLOBAL) {
+        int64_t index = (int64_t)code_read_u32(pc + 1) - 1;
+        if(index < 0 || index >= VM_GLOBALS()) TIM_ERROR("error: index out of range\n");
+        a = machine->globals[index];
+        VM_PUSH(a.word, a.type);
+        pc += 5;
+        NEXT;
+    }
+    CASE(INST_PTR_ADD_IMM)
+        if(sp <= stack) TIM_ERROR("error: stack underflow\n");
+        if(IS_WIDE_TYPE(sp[-1].type)) {
+            sp[-1].word.as_u64 += code_read_u32(pc + 1);
+        } else {
+            VM_PUSH((Word){.as_int=code_read_u32(pc + 1)}, INT_TYPE);
+            BIN_OP(+);
+        }
+        sp[-1].type = PTR_TYPE;
+        pc += 5;
+        NEXT;
+    CASE(INST_INDEX_ADDR)
+        INDEX_ADDR(code_read_u32(pc + 1));
+        pc += 5;
+        NEXT;
+    CASE(INST_STORE_LOCAL) {
+        VM_POP(a);
+        Data *slot = fp + (int32_t)code_read_u32(pc + 1);
+        if(slot < stack || slot >= sp) TIM_ERROR("error: index out of range\n");
+        *slot = a;
+        pc += 5;
+        NEXT;
+    }
+    CASE(INST_STORE_GLOBAL) {
+        VM_POP(a);
+        int64_t index = (int64_t)code_read_u32(pc + 1) - 1;
+        if(index < 0 || index >= VM_GLOBALS()) TIM_ERROR("error: index out of range\n");
+        machine->globals[index] = a;
+        pc += 5;
+        NEXT;
+    }
+    CASE(INST_INDEXED_LOAD) {
+        INDEX_ADDR(pc[1]);
+        Data data = {0};
+        data.type = pc[2];
+        memcpy(&data.word, sp[-1].word.as_pointer, pc[1]);
+        sp[-1] = data;
+        pc += 3;
+        NEXT;
+    }
+    // machine_verify proved the slots, depths and operand tags these would check
+    CASE(INST_LOAD_LOCAL_V)
+        a = fp[(int32_t)code_read_u32(pc + 1)];
+        VM_PUSH(a.word, a.type);
+        pc += 5;
+        NEXT;
+    CASE(INST_STORE_LOCAL_V)
+        VM_POP(a);
+        fp[(int32_t)code_read_u32(pc + 1)] = a;
+        pc += 5;
+        NEXT;
+    // verified code has no coroutines, so its globals are always the bottom of stack
+    CASE(INST_LOAD_GLOBAL_V)
+        a = stack[code_read_u32(pc + 1) - 1];
+        VM_PUSH(a.word, a.type);
+        pc += 5;
+        NEXT;
+    CASE(INST_STORE_GLOBAL_V)
+        VM_POP(a);
+        stack[code_read_u32(pc + 1) - 1] = a;
+        pc += 5;
+        NEXT;
+    CASE(INST_ALLOC_V)
+        VM_POP(a);
+        if(a.word.as_int < 0) TIM_ERROR("error: cannot alloc %ld bytes\n", a.word.as_int);
+        VM_PUSH((Word){.as_pointer=heap_alloc(machine, a.word.as_int, true)}, PTR_TYPE);
+        pc++;
+        NEXT;
+    CASE(INST_WRITE_V) {
+        Data size, data, ptr;
+        VM_POP(size);
+        VM_POP(data);
+        VM_POP(ptr);
+        memcpy(ptr.word.as_pointer, &data.word, size.word.as_int);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_READ_V) {
+        Data type, size, ptr;
+        VM_POP(type);
+        VM_POP(size);
+        VM_POP(ptr);
+        Data data = {0};
+        data.type = type.word.as_int;
+        memcpy(&data.word, ptr.word.as_pointer, size.word.as_int);
+        VM_PUSH(data.word, data.type);
+        pc++;
+        NEXT;
+    }
+    CASE(INST_INDUP_V)
+        VM_POP(a);
+        b = sp[-a.word.as_int - 1];
+        VM_PUSH(b.word, b.type);
+        pc++;
+        NEXT;
+    CASE(INST_INSWAP_V) {
+        VM_POP(a);
+        Data *slot = sp - a.word.as_int - 1;
+        b = *slot;
+        *slot = sp[-1];
+        sp[-1] = b;
+        pc++;
+        NEXT;
+    }
+    CASE(INST_BREAK)
+        goto done;
+    CASE(INST_ARG)
+        VM_POP(a);
+        if(a.type != INT_TYPE || a.word.as_u64 >= MACHINE_ARGS) TIM_ERROR("error: no argument %" PRId64 "\n", a.word.as_int);
+        b = machine->args[a.word.as_u64];
+        VM_PUSH(b.word, b.type);
+        pc++;
+        NEXT;
+    CASE(INST_SPAWN) {
+        VM_POP(a);
+        if(a.type != INT_TYPE || a.word.as_int < 0 || a.word.as_int > sp - stack) {
+            TIM_ERROR("error: cannot spawn with %" PRId64 " arguments\n", a.word.as_int);
+        }
+        sp -= a.word.as_int;
+        size_t handle = coroutine_spawn(machine, code_read_u32(pc + 1), sp, a.word.as_int);
+        VM_PUSH((Word){.as_int=handle}, INT_TYPE);
+        pc += 5;
+        NEXT;
+    }
+    CASE(INST_YIELD) {
+        size_t next;
+        if(machine->coroutines.current != 0) {
+            VM_SWITCH(coroutine_leave(machine, pc + 1 - code, false));
+        } else if((next = coroutine_next(&machine->coroutines)) != 0) {
+            // the main program has nobody to yield to, the next coroutine gets a turn instead
+            VM_SWITCH(coroutine_run(machine, next, pc + 1 - code, false));
+        } else {
+            pc++;
+        }
+        NEXT;
+    }
+    CASE(INST_RESUME) {
+        VM_POP(a);
+        Coroutine *co = coroutine_get(machine, a);
+        if(co->state == COROUTINE_RUNNING) TIM_ERROR("error: coroutine %" PRId64 " is already running\n", a.word.as_int);
+        if(co->state == COROUTINE_DONE) {
+            VM_PUSH((Word){.as_int=0}, INT_TYPE);
+            pc++;
+            NEXT;
+        }
+        VM_SWITCH(coroutine_run(machine, a.word.as_u64, pc + 1 - code, true));
+        NEXT;
+    }
+    CASE(INST_JOIN) {
+        Coroutine *co = coroutine_get(machine, sp[-1]);
+        if(co->state == COROUTINE_DONE) {
+            sp[-1] = co->result;
+            pc++;
+            NEXT;
+        }
+        // it is waiting on the one joining it, directly or through others
+        if(co->state == COROUTINE_RUNNING) TIM_ERROR("error: coroutine %" PRId64 " cannot be joined from here\n", sp[-1].word.as_int);
+        // every coroutine gets a turn and join runs again once control is back, until the
+        // one it waits for has finished
+        VM_SWITCH(coroutine_run(machine, coroutine_next(&machine->coroutines), pc - code, false));
+        NEXT;
+    }
+#ifndef TIM_THREADED
+    default:
+        TIM_ERROR("error: unknown instruction %d\n", *pc);
+    }
+    next:
+        if(step) goto done;
+    }
+#endif
+
+done:
+    machine->stack_size = sp - stack;
+    machine->return_stack_size = rs;
+    machine->frame_pointer = fp - stack;
+    return pc - code;
+}
+
+#undef CASE
+#undef NEXT
+#undef REDISPATCH
+#undef VM_SWITCH
+#undef VM_GLOBALS
+#ifdef TIM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+// executes the instruction at index ip and returns the index of the next one
+size_t run_instruction(Machine *machine, size_t ip) {
+    if(machine->code == NULL) machine_load_code(machine);
+    machine_init_stacks(machine);
+    size_t offset = run_code(machine, machine->code_offsets[ip], true);
+    return code_offset_to_index(machine, offset);
+}
 
 void run_instructions(Machine *machine) {
 	machine_load_native(machine, native_write);
 	machine_load_native(machine, native_exit);
-    for(size_t ip = machine->entrypoint; ip < machine->program_size; ip++){
-        ip = run_instruction(machine, machine->instructions.data[ip], ip);
-    }
+    if(machine->code == NULL) machine_load_code(machine);
+    machine_verify(machine);
+    machine_init_stacks(machine);
+    run_code(machine, machine->code_offsets[machine->entrypoint], false);
 
 	for(size_t i = 2; i < machine->native_ptrs_s; i++) {
 		dlclose(machine->native_ptrs);
@@ -15,14 +15,21 @@ String_View get_word(String_View *view);
 String_View get_filename(String_View *view);
 String_View get_value(String_View *view);
 void eof_error(char *buffer, int index, int length);
-String_View prepro(char *file_name, int depth);
+// defines holds the @def macros, callers make it with hashmap_create and keep one per
+// preprocessed program so separate programs can be preprocessed at the same time
+String_View prepro(struct hashmap_s *defines, char *file_name, int depth);
 void append_to_output(char *output, int *output_index, char *value, int value_length);
-String_View pass(String_View view, int depth, char *file_name);
+String_View pass(struct hashmap_s *defines, String_View view, int depth, char *file_name);
 
 #ifndef COMMENT_CHAR
 #define COMMENT_CHAR ';'
 #endif
 
+// how errors are reported, takes a printf format ending in a newline
+#ifndef TIPP_ERROR
+#define TIPP_ERROR(...) do { fprintf(stderr, __VA_ARGS__); exit(1); } while(0)
+#endif
+
 #ifndef DA_APPEND
 #define DA_APPEND
 #ifndef ASSERT
@@ -52,15 +59,10 @@ String_View pass(String_View view, int depth, char *file_name);
 
 #ifdef TIPP_IMPLEMENTATION
 
-const unsigned initial_size = 1;
-struct hashmap_s hashmap;
-int hashmap_initted = 0;
-
 String_View read_file_to_buff(char *file_name){
     FILE *file = fopen(file_name, "r"); 
     if(file == NULL){
-        fprintf(stderr, "error: file not found: %s\n", file_name);
-        exit(1);
+        TIPP_ERROR("error: file not found: %s\n", file_name);
     }
 
     fseek(file, 0, SEEK_END);
@@ -70,9 +72,8 @@ String_View read_file_to_buff(char *file_name){
     char *current = malloc(sizeof(char) * len);
     fread(current, sizeof(char), len, file);
     if(current == NULL){
-        fprintf(stderr, "error: could not read from file: %s\n", file_name);
         fclose(file);
-        exit(1);
+        TIPP_ERROR("error: could not read from file: %s\n", file_name);
     }
 
     fclose(file);
@@ -116,21 +117,15 @@ String_View get_value(String_View *view) {
 
 void eof_error(char *buffer, int index, int length){
     if(buffer[index] == '\0' || buffer == NULL || index > length){
-        fprintf(stderr, "error: reached end of file\n");
-        exit(1);
+        TIPP_ERROR("error: reached end of file\n");
     }
 }
 
-String_View prepro(char *file_name, int depth){
-    if(!hashmap_initted){
-        int hashmap_error = hashmap_create(initial_size, &hashmap);
-        assert(hashmap_error == 0 && "COULD NOT INITIALIZE HASHMAP\n");
-        hashmap_initted = 1;
-    }
+String_View prepro(struct hashmap_s *defines, char *file_name, int depth){
     String_View buffer = read_file_to_buff(file_name);
 	assert(buffer.data != NULL && "There was an issue with the buffer\n");
 	printf("%zu\n", buffer.len);
-    String_View result = pass(buffer, depth, file_name);
+    String_View result = pass(defines, buffer, depth, file_name);
 	printf("%zu\n", result.len);
 
     return result;
@@ -166,11 +161,10 @@ void append_file_info(Tipp_Str *output, String_View filename, size_t line) {
 	free(line_nums);
 }
 
-String_View pass(String_View view, int depth, char *file_name){
+String_View pass(struct hashmap_s *defines, String_View view, int depth, char *file_name){
 	(void)file_name;
     if(depth > 500){
-        fprintf(stderr, "error: recursive import detected\n");
-        exit(1);
+        TIPP_ERROR("error: recursive import detected\n");
     }
     int index = 0; 
     int line = 1;
@@ -192,25 +186,23 @@ String_View pass(String_View view, int depth, char *file_name){
 				view = view_chop_left(view);
                 String_View value = get_value(&view);
                 line++;
-                int put_error = hashmap_put(&hashmap, def.data, def.len, (void* const)value.data);
+                int put_error = hashmap_put(defines, def.data, def.len, (void* const)value.data);
 				// TODO: error instead of assert
                 assert(put_error == 0 && "COULD NOT PLACE INTO HASHMAP\n");
             } else if(view_cmp(word, LITERAL_CREATE("imp"))){
 				view = view_chop_left(view);
                 if(*view.data != '"'){
-                    fprintf(stderr, "error: expected open quote\n");
-                    exit(1);
+                    TIPP_ERROR("error: expected open quote\n");
                 }
 				view = view_chop_left(view);
                 String_View imported_file = get_filename(&view);
                 if(*view.data != '"'){
-                    fprintf(stderr, "error: expected close quote\n");
-                    exit(1);
+                    TIPP_ERROR("error: expected close quote\n");
                 }
 				view = view_chop_left(view);
 				char *imported_name = view_to_cstr(imported_file);
 				strncpy(imported_name, imported_file.data, imported_file.len);
-                String_View imported_buffer = prepro(imported_name, depth + 1);
+                String_View imported_buffer = prepro(defines, imported_name, depth + 1);
 				append_file_info(&output, imported_file, 1);
 				for(size_t i = 0; i < imported_buffer.len; i++) {
 					DA_APPEND(&output, imported_buffer.data[i]);
@@ -221,14 +213,13 @@ String_View pass(String_View view, int depth, char *file_name){
 				view = view_chop_left(view);
 				continue;
             } else {
-                fprintf(stderr, "Unexpected keyword: "View_Print"\n", View_Arg(word));
-                exit(1);
+                TIPP_ERROR("Unexpected keyword: "View_Print"\n", View_Arg(word));
             }
         } else if(isalpha(*view.data)){
             // set a temp index because we dont want to iterate index here
             int temp_index = index;
             String_View word = get_word(&view);
-            char* const element = hashmap_get(&hashmap, word.data, word.len);
+            char* const element = hashmap_get(defines, word.data, word.len);
             if(element){
                 // if found in hashmap, set the element value instead of word value
                 for(size_t i = 0; i < strlen(element); i++){
@@ -0,0 +1,94 @@
+#!/bin/sh
+# usage: tests/run.sh [main]
+# every tests/<name>.cano with a tests/<name>.expected has to print exactly that, stdout
+# followed by stderr, under run, jit, trace and cc, and the malformed programs below have to be
+# refused by all four. cc refuses programs that use coroutines, those only run in the other three
+MAIN=${1:-build/main}
+# com writes the .tim into the working directory
+MAIN=$(cd "$(dirname "$MAIN")" && pwd)/$(basename "$MAIN")
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+fail=0
+
+# check <name> <engine> <command...>
+check() {
+    name=$1
+    engine=$2
+    shift 2
+    timeout 60 "$@" > "$TMP/out" 2> "$TMP/err"
+    cat "$TMP/err" >> "$TMP/out"
+    if ! cmp -s "$TMP/out" "$DIR/$name.expected"; then
+        echo "FAIL $name ($engine):"
+        diff "$TMP/out" "$DIR/$name.expected" | head -5
+        fail=1
+    fi
+}
+
+# compiled first, so the output is only the program's
+for expected in "$DIR"/*.expected; do
+    name=$(basename "$expected" .expected)
+    cp "$DIR/$name.cano" "$TMP/$name.cano"
+    if ! (cd "$TMP" && "$MAIN" com "$name.cano") > "$TMP/out" 2>&1; then
+        echo "FAIL $name: does not compile"
+        cat "$TMP/out"
+        fail=1
+        continue
+    fi
+    for mode in run jit trace; do
+        check "$name" $mode "$MAIN" $mode "$TMP/$name.tim"
+    done
+    # cc names the C and the binary after the path up to its first dot, so it runs in $TMP too
+    if (cd "$TMP" && "$MAIN" cc "$name.tim") > "$TMP/out" 2>&1; then
+        check "$name" cc "$TMP/$name"
+    elif ! grep -q "uses coroutines" "$TMP/out"; then
+        echo "FAIL $name (cc): does not compile"
+        cat "$TMP/out"
+        fail=1
+    fi
+done
+
+# a packed program: magic, version 2, entrypoint 0, no strings, the instruction count and
+# bytes given, then an empty line table. operands are a type byte and a LEB128 value,
+# push also takes a register byte
+packed() {
+    printf 'TIMZ\002\000\000'"$1"'\062\000\000' > "$TMP/$2.tim"
+}
+
+# refused <name> <message>, a program cc compiles has to be refused when its binary runs
+refused() {
+    for mode in run jit trace cc; do
+        if [ $mode = cc ]; then
+            (cd "$TMP" && "$MAIN" cc "$1.tim") > "$TMP/out" 2>&1 && timeout 10 "$TMP/$1" > "$TMP/out" 2>&1
+        else
+            timeout 10 "$MAIN" $mode "$TMP/$1.tim" > "$TMP/out" 2>&1
+        fi
+        if [ $? = 0 ]; then
+            echo "FAIL $1 ($mode): ran"
+            fail=1
+        elif ! grep -q "$2" "$TMP/out"; then
+            echo "FAIL $1 ($mode): expected \"$2\", got:"
+            head -3 "$TMP/out"
+            fail=1
+        fi
+    done
+}
+
+# jmp 5 in a two instruction program
+packed '\002\052\000\005' jump
+refused jump "cannot jmp out of bounds"
+
+# pop with nothing pushed
+packed '\002\012' underflow
+refused underflow "stack underflow"
+
+# push 5 with data type 77
+packed '\003\001\115\005\000\055' type
+refused type "unknown data type 77"
+
+# read from the int 5 instead of a pointer
+packed '\006\001\000\005\000\001\000\010\000\001\000\000\000\011\055' read
+refused read "expected pointer"
+
+[ $fail = 0 ] && echo "all ok"
+exit $fail